@@ -0,0 +1,393 @@
+/***************************************************************************
+ * nimsbench.c
+ *
+ * Time the stages of converting nimsread *.bin files to Mini-SEED
+ * using the same reader, scan kernels, libmseed packing and output
+ * writer as mt2mseed, and optionally the complete conversion by
+ * mt2mseed itself.
+ *
+ * For each stage the elapsed time, the throughput in MB/s and the
+ * rate in samples per second are reported.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <libmseed.h>
+
+#include "readNIMSbin.h"
+#include "scankern.h"
+#include "recwriter.h"
+
+#define PACKAGE "nimsbench"
+
+/* Stages of a conversion */
+enum stage {
+  STAGE_HEADER,
+  STAGE_READ,
+  STAGE_DEINTERLEAVE,
+  STAGE_GAPRUNS,
+  STAGE_ENCODE,
+  STAGE_WRITE,
+  STAGE_TOTAL,
+  STAGE_MT2MSEED,
+  NSTAGES
+};
+
+static const char *stagenames[NSTAGES] = {
+  "header parse", "data read", "de-interleave", "gap runs",
+  "encode", "record write", "all stages", "mt2mseed"
+};
+
+/* Packed records collected in memory */
+struct recbuf {
+  char *records;
+  size_t size;
+  size_t maxsize;
+};
+
+static int benchfile (char *binfile, double *seconds, int64_t *bytes,
+		      int64_t *samples);
+static void recbuf_handler (char *record, int reclen, void *handlerdata);
+static double elapsedtime (struct timespec *start);
+static void usage (void);
+
+static int   packreclen = 4096;
+static int   encoding   = 11;
+static char *mt2mseed   = 0;
+static char *outfile    = "nimsbench.mseed";
+
+
+int
+main (int argc, char **argv)
+{
+  double seconds[NSTAGES];
+  int64_t bytes[NSTAGES];
+  int64_t samples[NSTAGES];
+  char command[2048];
+  struct timespec start;
+  int nfiles = 0;
+  int optind;
+  int idx;
+
+  memset (seconds, 0, sizeof(seconds));
+  memset (bytes, 0, sizeof(bytes));
+  memset (samples, 0, sizeof(samples));
+
+  for ( optind = 1; optind < argc; optind++ )
+    {
+      if ( strcmp (argv[optind], "-h") == 0 )
+	{
+	  usage ();
+	  return 0;
+	}
+      else if ( optind + 1 >= argc && argv[optind][0] == '-' )
+	{
+	  fprintf (stderr, "Option %s requires a value\n", argv[optind]);
+	  return 1;
+	}
+      else if ( strcmp (argv[optind], "-r") == 0 )
+	{
+	  packreclen = strtol (argv[++optind], NULL, 10);
+	}
+      else if ( strcmp (argv[optind], "-e") == 0 )
+	{
+	  encoding = strtol (argv[++optind], NULL, 10);
+	}
+      else if ( strcmp (argv[optind], "-m") == 0 )
+	{
+	  mt2mseed = argv[++optind];
+	}
+      else if ( strcmp (argv[optind], "-o") == 0 )
+	{
+	  outfile = argv[++optind];
+	}
+      else if ( argv[optind][0] == '-' )
+	{
+	  fprintf (stderr, "Unknown option: %s\n", argv[optind]);
+	  return 1;
+	}
+      else
+	{
+	  if ( benchfile (argv[optind], seconds, bytes, samples) )
+	    return 1;
+
+	  /* Time the complete conversion by mt2mseed */
+	  if ( mt2mseed )
+	    {
+	      snprintf (command, sizeof(command),
+			"%s -r %d -e %d -o %s %s >/dev/null 2>&1",
+			mt2mseed, packreclen, encoding, outfile, argv[optind]);
+
+	      clock_gettime (CLOCK_MONOTONIC, &start);
+	      if ( system (command) )
+		{
+		  fprintf (stderr, "Error running: %s\n", command);
+		  return 1;
+		}
+	      seconds[STAGE_MT2MSEED] += elapsedtime (&start);
+	    }
+
+	  nfiles++;
+	}
+    }
+
+  if ( nfiles == 0 )
+    {
+      usage ();
+      return 1;
+    }
+
+  remove (outfile);
+
+  for ( idx = 0; idx < STAGE_TOTAL; idx++ )
+    seconds[STAGE_TOTAL] += seconds[idx];
+  bytes[STAGE_TOTAL] = bytes[STAGE_MT2MSEED] = bytes[STAGE_READ];
+  samples[STAGE_TOTAL] = samples[STAGE_MT2MSEED] = samples[STAGE_READ];
+
+  printf ("\n%d file(s), %" PRId64 " samples, %.1f MB of data, "
+	  "record length %d, encoding %d, %s kernels\n\n",
+	  nfiles, samples[STAGE_READ], bytes[STAGE_READ] / 1e6,
+	  packreclen, encoding, scan_kernelname ());
+  printf ("Stage               Seconds       MB/s    Msamples/s\n");
+
+  for ( idx = 0; idx < NSTAGES; idx++ )
+    {
+      if ( idx == STAGE_MT2MSEED && ! mt2mseed )
+	continue;
+
+      if ( bytes[idx] == 0 || seconds[idx] <= 0 )
+	{
+	  printf ("%-16s %10.4f %10s %13s\n", stagenames[idx], seconds[idx], "-", "-");
+	  continue;
+	}
+
+      printf ("%-16s %10.4f %10.1f %13.2f\n", stagenames[idx], seconds[idx],
+	      bytes[idx] / seconds[idx] / 1e6, samples[idx] / seconds[idx] / 1e6);
+    }
+
+  return 0;
+}  /* End of main() */
+
+
+/***************************************************************************
+ * benchfile:
+ *
+ * Convert a single bin file stage by stage, adding the elapsed time,
+ * the bytes and the samples processed by each stage to the totals.
+ * Data stages count the bytes of the data record, the write stage
+ * counts the bytes of the packed records and the header stage counts
+ * nothing.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+benchfile (char *binfile, double *seconds, int64_t *bytes, int64_t *samples)
+{
+  struct timespec start;
+  struct recbuf recbuf;
+  NIMSheader hdr;
+  RecWriter *rw;
+  MSRecord *msr;
+  FILE *ifp;
+  int32_t *scans;
+  int32_t *chandata;
+  int32_t *chans[SCAN_MAXCHANNELS];
+  uint8_t *gapmask;
+  ScanRun *runs[SCAN_MAXCHANNELS];
+  int maxruns[SCAN_MAXCHANNELS];
+  int nruns[SCAN_MAXCHANNELS];
+  int64_t nsamples;
+  int stage;
+  int channel;
+  int runidx;
+  int yday;
+
+  if ( ! (ifp = fopen (binfile, "rb")) )
+    {
+      fprintf (stderr, "Cannot open input file: %s (%s)\n", binfile, strerror(errno));
+      return -1;
+    }
+
+  /* Header parse */
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  if ( ! read_bin_header (ifp, &hdr, 1) )
+    {
+      fprintf (stderr, "[%s] Error reading input bin file\n", binfile);
+      return -1;
+    }
+  seconds[STAGE_HEADER] += elapsedtime (&start);
+
+  nsamples = (int64_t) hdr.nscans * hdr.nchannels;
+
+  if ( hdr.nchannels <= 0 ||
+       ! (scans = (int32_t *) malloc ((size_t) hdr.datalen)) ||
+       ! (chandata = (int32_t *) malloc ((size_t) hdr.datalen)) ||
+       ! (gapmask = (uint8_t *) malloc (hdr.nscans)) )
+    {
+      fprintf (stderr, "[%s] Error allocating memory for %d scans\n", binfile, hdr.nscans);
+      return -1;
+    }
+
+  /* Data read, leaving samples in file byte order */
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  if ( read_bin_data (ifp, &hdr, scans, hdr.nscans) != hdr.nscans )
+    {
+      fprintf (stderr, "[%s] Error reading input bin file\n", binfile);
+      return -1;
+    }
+  seconds[STAGE_READ] += elapsedtime (&start);
+  fclose (ifp);
+
+  /* De-interleave, byte swapping and flagging missing samples */
+  for ( channel = 0; channel < hdr.nchannels; channel++ )
+    chans[channel] = chandata + (size_t) channel * hdr.nscans;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  scan_deinterleave (scans, hdr.nscans, hdr.nchannels, hdr.swapflag, chans,
+		     hdr.missingdataflag, gapmask);
+  seconds[STAGE_DEINTERLEAVE] += elapsedtime (&start);
+  free (scans);
+
+  /* Runs of valid samples of each channel */
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for ( channel = 0; channel < hdr.nchannels; channel++ )
+    {
+      runs[channel] = 0;
+      maxruns[channel] = 0;
+      if ( (nruns[channel] = scan_gapruns (gapmask, hdr.nscans, channel,
+					   &runs[channel], &maxruns[channel])) < 0 )
+	{
+	  fprintf (stderr, "[%s] Error allocating memory\n", binfile);
+	  return -1;
+	}
+    }
+  seconds[STAGE_GAPRUNS] += elapsedtime (&start);
+
+  /* Encode each run into records collected in memory */
+  memset (&recbuf, 0, sizeof(struct recbuf));
+  msr = msr_init (NULL);
+  ms_strncpclean (msr->network, "XX", 2);
+  ms_strncpclean (msr->station, "BENCH", 5);
+  ms_md2doy (hdr.start_time[0], hdr.start_time[1], hdr.start_time[2], &yday);
+  msr->samprate = 1.0 / hdr.dt;
+  msr->sampletype = 'i';
+  msr->reclen = packreclen;
+  msr->encoding = encoding;
+  msr->byteorder = 1;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for ( channel = 0; channel < hdr.nchannels; channel++ )
+    {
+      snprintf (msr->channel, sizeof(msr->channel), "BQ%d", channel + 1);
+
+      for ( runidx = 0; runidx < nruns[channel]; runidx++ )
+	{
+	  msr->starttime = ms_time2hptime (hdr.start_time[0], yday, hdr.start_time[3],
+					   hdr.start_time[4], hdr.start_time[5], 0) +
+	    (hptime_t) (runs[channel][runidx].start / msr->samprate * HPTMODULUS);
+	  msr->datasamples = chans[channel] + runs[channel][runidx].start;
+	  msr->samplecnt = msr->numsamples = runs[channel][runidx].length;
+
+	  if ( msr_pack (msr, recbuf_handler, &recbuf, NULL, 1, 0) < 0 )
+	    {
+	      fprintf (stderr, "[%s] Error packing Mini-SEED\n", binfile);
+	      return -1;
+	    }
+	}
+
+      free (runs[channel]);
+    }
+  seconds[STAGE_ENCODE] += elapsedtime (&start);
+
+  msr->datasamples = 0;
+  msr_free (&msr);
+  free (chandata);
+  free (gapmask);
+
+  /* Record write */
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  if ( ! (rw = rw_open (outfile, RW_BUFSIZE, 0)) ||
+       rw_write (rw, recbuf.records, recbuf.size) ||
+       rw_close (rw) )
+    {
+      fprintf (stderr, "Error writing output file %s: %s\n", outfile, strerror(errno));
+      return -1;
+    }
+  seconds[STAGE_WRITE] += elapsedtime (&start);
+  free (recbuf.records);
+
+  for ( stage = STAGE_READ; stage < STAGE_WRITE; stage++ )
+    {
+      bytes[stage] += hdr.datalen;
+      samples[stage] += nsamples;
+    }
+  bytes[STAGE_WRITE] += recbuf.size;
+  samples[STAGE_WRITE] += nsamples;
+
+  return 0;
+}  /* End of benchfile() */
+
+
+/***************************************************************************
+ * recbuf_handler:
+ * Appends passed records to the record buffer.
+ ***************************************************************************/
+static void
+recbuf_handler (char *record, int reclen, void *handlerdata)
+{
+  struct recbuf *recbuf = (struct recbuf *) handlerdata;
+  char *newrecords;
+
+  if ( recbuf->size + reclen > recbuf->maxsize )
+    {
+      recbuf->maxsize = ( recbuf->maxsize ) ? recbuf->maxsize * 2 : 1024 * (size_t) reclen;
+
+      if ( ! (newrecords = (char *) realloc (recbuf->records, recbuf->maxsize)) )
+	{
+	  fprintf (stderr, "Error allocating memory for records\n");
+	  exit (1);
+	}
+
+      recbuf->records = newrecords;
+    }
+
+  memcpy (recbuf->records + recbuf->size, record, reclen);
+  recbuf->size += reclen;
+}  /* End of recbuf_handler() */
+
+
+/***************************************************************************
+ * elapsedtime:
+ *
+ * Returns the seconds elapsed since the specified monotonic time
+ ***************************************************************************/
+static double
+elapsedtime (struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}  /* End of elapsedtime() */
+
+
+/***************************************************************************
+ * usage:
+ ***************************************************************************/
+static void
+usage (void)
+{
+  fprintf (stderr, "Time the stages of converting bin files to Mini-SEED.\n\n");
+  fprintf (stderr, "Usage: %s [options] file1 [file2 ...]\n\n", PACKAGE);
+  fprintf (stderr,
+	   " -r bytes       Record length, default: 4096\n"
+	   " -e encoding    Encoding format, default: 11 (Steim2)\n"
+	   " -m mt2mseed    Also time the complete conversion by this mt2mseed\n"
+	   " -o outfile     Output file, removed at the end, default: nimsbench.mseed\n"
+	   "\n");
+}  /* End of usage() */
@@ -0,0 +1,493 @@
+/***************************************************************************
+ * nimsgen.c
+ *
+ * Generate synthetic magnetotelluric time series as nimsread *.bin
+ * files for benchmarking mt2mseed.
+ *
+ * The files have the layout expected by read_bin_header(): a Fortran
+ * header record with the site, timing and gap table, followed by a
+ * single data record of 5-channel scans of 32-bit integers.  Gaps are
+ * filled with the missing data flag (gap type 2005) and listed in the
+ * gap table.  Like gfortran, data records longer than the maximum
+ * subrecord length are split into subrecords, the leading marker of
+ * a subrecord that is continued and the trailing marker of a
+ * continuation are negative.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#define PACKAGE "nimsgen"
+
+/* Maximum number of channels in each data scan */
+#define MAXCHANNELS 8
+
+/* Missing data flag value used for gaps */
+#define MISSINGFLAG -999999
+
+/* Maximum number of gaps in a normal and a padded header */
+#define MAXGAPS 100
+#define MAXPADGAPS 418
+
+/* Length of a padded header record */
+#define PADDEDLEN 5108
+
+/* Default maximum subrecord length of gfortran */
+#define MAXSUBREC 2147483639
+
+/* Signal characters */
+#define SIGNAL_WALK 0          /* Random walk */
+#define SIGNAL_MT   1          /* 1/f noise with a daily variation */
+
+/* Gap in the generated data, start at 1 */
+struct gap {
+  int32_t start;
+  int32_t length;
+};
+
+static int putvalues (FILE *ofp, void *values, int count);
+static int putdata (FILE *ofp, void *values, int count);
+static double gaussian (void);
+static uint64_t nextrandom (void);
+static int parameter_proc (int argcount, char **argvec);
+static void usage (void);
+
+static int     nscans    = 1000000;
+static int     nchannels = 5;
+static double  samprate  = 8.0;
+static double  gapdensity = 0.0;
+static int     gaplength = 60;
+static int     bigendian = 0;
+static int     sigtype    = SIGNAL_MT;
+static int     padheader = 0;
+static int32_t maxsubrec = MAXSUBREC;
+static uint64_t seed     = 1;
+static char   *outfile   = 0;
+
+static int swapflag = 0;
+static uint64_t randomstate;
+
+/* State of the data record written by putdata() */
+static int64_t recordleft;     /* Bytes of the record not yet written */
+static int32_t subleft;        /* Bytes of the subrecord not yet written */
+static int32_t sublen;
+static int subrecno;
+
+
+int
+main (int argc, char **argv)
+{
+  FILE *ofp;
+  struct gap *gaps = 0;
+  int ngaps = 0;
+  int maxgaps;
+  int32_t *scan;
+  int32_t *scans;
+  float site[5];
+  int32_t times[12] = { 2008, 7, 10, 0, 0, 0, 2008, 7, 10, 0, 0, 0 };
+  int32_t values[4];
+  int32_t reclen;
+  int32_t nskip;
+  double level[MAXCHANNELS];
+  double pink[MAXCHANNELS][3];
+  double white;
+  double daily;
+  int chunk;
+  int scanidx;
+  int gapidx;
+  int channel;
+  int idx;
+
+  if ( parameter_proc (argc, argv) < 0 )
+    return 1;
+
+  randomstate = seed * 0x9E3779B97F4A7C15ULL + 1;
+  swapflag = ( bigendian != ( *(const uint16_t *) "\0\1" == 1 ) );
+
+  /* Place gaps evenly with jitter, gap density is in gaps per million scans */
+  maxgaps = ( padheader ) ? MAXPADGAPS : MAXGAPS;
+  ngaps = (int) (gapdensity * nscans / 1e6 + 0.5);
+  if ( ngaps > maxgaps )
+    {
+      fprintf (stderr, "Limiting %d gaps to %d, the maximum for the header\n",
+	       ngaps, maxgaps);
+      ngaps = maxgaps;
+    }
+  if ( ngaps > 0 && (int64_t) ngaps * (gaplength + 1) >= nscans )
+    {
+      fprintf (stderr, "Too many or too long gaps for %d scans\n", nscans);
+      return 1;
+    }
+
+  if ( ngaps > 0 && ! (gaps = (struct gap *) malloc (sizeof(struct gap) * ngaps)) )
+    {
+      fprintf (stderr, "Error allocating memory\n");
+      return 1;
+    }
+
+  for ( gapidx = 0; gapidx < ngaps; gapidx++ )
+    {
+      chunk = nscans / ngaps;
+      gaps[gapidx].length = 1 + nextrandom () % gaplength;
+      gaps[gapidx].start = 1 + (int64_t) gapidx * chunk +
+	nextrandom () % (chunk - gaps[gapidx].length);
+    }
+
+  if ( ! (ofp = fopen (outfile, "wb")) )
+    {
+      fprintf (stderr, "Cannot open output file: %s\n", outfile);
+      return 1;
+    }
+
+  /* Header record */
+  nskip = ( padheader ) ? PADDEDLEN / 4 - 21 - 3 * ngaps : 0;
+  reclen = 4 * (21 + 3 * ngaps + nskip);
+
+  site[0] = 44.56;
+  site[1] = -123.28;
+  site[2] = 15.5;
+  site[3] = 1.0 / samprate;
+  site[4] = 70.0;
+
+  values[0] = nscans;
+  values[1] = 2005;
+  values[2] = MISSINGFLAG;
+  values[3] = ngaps;
+
+  putvalues (ofp, &reclen, 1);
+  putvalues (ofp, site, 5);
+  putvalues (ofp, times, 12);
+  putvalues (ofp, values, 4);
+  for ( gapidx = 0; gapidx < ngaps; gapidx++ )
+    {
+      values[0] = gaps[gapidx].start;
+      values[1] = gaps[gapidx].length;
+      values[2] = 0;
+      putvalues (ofp, values, 3);
+    }
+  values[0] = 0;
+  for ( idx = 0; idx < nskip; idx++ )
+    putvalues (ofp, values, 1);
+  putvalues (ofp, &reclen, 1);
+
+  /* Data record, generated in chunks of scans */
+  recordleft = (int64_t) nscans * nchannels * 4;
+  subleft = 0;
+  subrecno = -1;
+
+  chunk = 65536;
+  if ( ! (scans = (int32_t *) malloc (sizeof(int32_t) * nchannels * chunk)) )
+    {
+      fprintf (stderr, "Error allocating memory\n");
+      return 1;
+    }
+
+  memset (level, 0, sizeof(level));
+  memset (pink, 0, sizeof(pink));
+  gapidx = 0;
+
+  for ( scanidx = 0; scanidx < nscans; scanidx++ )
+    {
+      scan = scans + nchannels * (scanidx % chunk);
+
+      while ( gapidx < ngaps &&
+	      scanidx >= gaps[gapidx].start - 1 + gaps[gapidx].length )
+	gapidx++;
+
+      daily = sin (2 * M_PI * scanidx / (samprate * 86400.0));
+
+      for ( channel = 0; channel < nchannels; channel++ )
+	{
+	  white = gaussian ();
+
+	  if ( sigtype == SIGNAL_WALK )
+	    {
+	      level[channel] += white * 50;
+	    }
+	  else
+	    {
+	      /* Pink noise filter, magnetic channels have more power at
+	       * long periods and a daily variation */
+	      pink[channel][0] = 0.99765 * pink[channel][0] + white * 0.0990460;
+	      pink[channel][1] = 0.96300 * pink[channel][1] + white * 0.2965164;
+	      pink[channel][2] = 0.57000 * pink[channel][2] + white * 1.0526913;
+	      level[channel] = (pink[channel][0] + pink[channel][1] +
+				pink[channel][2] + white * 0.1848) * 2000;
+	      if ( channel < 3 )
+		level[channel] += daily * 50000;
+	    }
+
+	  if ( gapidx < ngaps && scanidx >= gaps[gapidx].start - 1 )
+	    scan[channel] = MISSINGFLAG;
+	  else
+	    scan[channel] = (int32_t) lrint (level[channel]);
+	}
+
+      if ( (scanidx + 1) % chunk == 0 || scanidx + 1 == nscans )
+	{
+	  if ( putdata (ofp, scans, nchannels * ((scanidx % chunk) + 1)) )
+	    {
+	      fprintf (stderr, "Error writing output file: %s\n", outfile);
+	      return 1;
+	    }
+	}
+    }
+
+  if ( fclose (ofp) )
+    {
+      fprintf (stderr, "Error writing output file: %s\n", outfile);
+      return 1;
+    }
+
+  fprintf (stderr, "Wrote %d scans at %g Hz with %d gaps to %s\n",
+	   nscans, samprate, ngaps, outfile);
+
+  free (scans);
+  if ( gaps )
+    free (gaps);
+
+  return 0;
+}  /* End of main() */
+
+
+/***************************************************************************
+ * putvalues:
+ *
+ * Write 32-bit values in the output byte order, the values are
+ * swapped in place and restored if needed.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+putvalues (FILE *ofp, void *values, int count)
+{
+  uint32_t *words = (uint32_t *) values;
+  size_t written;
+  int idx;
+
+  if ( swapflag )
+    for ( idx = 0; idx < count; idx++ )
+      words[idx] = __builtin_bswap32 (words[idx]);
+
+  written = fwrite (values, 4, count, ofp);
+
+  if ( swapflag )
+    for ( idx = 0; idx < count; idx++ )
+      words[idx] = __builtin_bswap32 (words[idx]);
+
+  return ( written == (size_t) count ) ? 0 : -1;
+}  /* End of putvalues() */
+
+
+/***************************************************************************
+ * putdata:
+ *
+ * Write 32-bit values of the data record in the output byte order,
+ * starting a new subrecord when the current one is complete and
+ * writing the trailing marker after the last value of each subrecord.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+putdata (FILE *ofp, void *values, int count)
+{
+  uint32_t *words = (uint32_t *) values;
+  const char *bytes = (const char *) values;
+  size_t length = (size_t) count * 4;
+  size_t part;
+  int32_t marker;
+  int retval = 0;
+  int idx;
+
+  if ( swapflag )
+    for ( idx = 0; idx < count; idx++ )
+      words[idx] = __builtin_bswap32 (words[idx]);
+
+  while ( length > 0 && retval == 0 )
+    {
+      if ( subleft == 0 )
+	{
+	  sublen = ( recordleft > maxsubrec ) ? maxsubrec : (int32_t) recordleft;
+	  subleft = sublen;
+	  subrecno++;
+	  marker = ( recordleft > maxsubrec ) ? -sublen : sublen;
+	  retval = putvalues (ofp, &marker, 1);
+	}
+
+      part = ( length < (size_t) subleft ) ? length : (size_t) subleft;
+      if ( fwrite (bytes, 1, part, ofp) != part )
+	retval = -1;
+
+      bytes += part;
+      length -= part;
+      subleft -= (int32_t) part;
+      recordleft -= part;
+
+      if ( subleft == 0 )
+	{
+	  marker = ( subrecno ) ? -sublen : sublen;
+	  if ( putvalues (ofp, &marker, 1) )
+	    retval = -1;
+	}
+    }
+
+  if ( swapflag )
+    for ( idx = 0; idx < count; idx++ )
+      words[idx] = __builtin_bswap32 (words[idx]);
+
+  return retval;
+}  /* End of putdata() */
+
+
+/***************************************************************************
+ * gaussian:
+ *
+ * Returns a normally distributed random value with unit variance
+ ***************************************************************************/
+static double
+gaussian (void)
+{
+  double u1 = (nextrandom () >> 11) * (1.0 / 9007199254740992.0);
+  double u2 = (nextrandom () >> 11) * (1.0 / 9007199254740992.0);
+
+  return sqrt (-2.0 * log (u1 + 1e-300)) * cos (2 * M_PI * u2);
+}  /* End of gaussian() */
+
+
+/***************************************************************************
+ * nextrandom:
+ *
+ * Returns the next value of a xorshift64* generator, the output only
+ * depends on the seed.
+ ***************************************************************************/
+static uint64_t
+nextrandom (void)
+{
+  randomstate ^= randomstate >> 12;
+  randomstate ^= randomstate << 25;
+  randomstate ^= randomstate >> 27;
+
+  return randomstate * 0x2545F4914F6CDD1DULL;
+}  /* End of nextrandom() */
+
+
+/***************************************************************************
+ * parameter_proc:
+ *
+ * Process the command line parameters.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+parameter_proc (int argcount, char **argvec)
+{
+  int optind;
+
+  for ( optind = 1; optind < argcount; optind++ )
+    {
+      if ( strcmp (argvec[optind], "-h") == 0 )
+	{
+	  usage ();
+	  exit (0);
+	}
+      else if ( strcmp (argvec[optind], "-B") == 0 )
+	{
+	  bigendian = 1;
+	}
+      else if ( strcmp (argvec[optind], "-P") == 0 )
+	{
+	  padheader = 1;
+	}
+      else if ( optind + 1 >= argcount && argvec[optind][0] == '-' )
+	{
+	  fprintf (stderr, "Option %s requires a value\n", argvec[optind]);
+	  return -1;
+	}
+      else if ( strcmp (argvec[optind], "-n") == 0 )
+	{
+	  nscans = strtol (argvec[++optind], NULL, 10);
+	}
+      else if ( strcmp (argvec[optind], "-c") == 0 )
+	{
+	  nchannels = strtol (argvec[++optind], NULL, 10);
+	}
+      else if ( strcmp (argvec[optind], "-r") == 0 )
+	{
+	  samprate = strtod (argvec[++optind], NULL);
+	}
+      else if ( strcmp (argvec[optind], "-g") == 0 )
+	{
+	  gapdensity = strtod (argvec[++optind], NULL);
+	}
+      else if ( strcmp (argvec[optind], "-G") == 0 )
+	{
+	  gaplength = strtol (argvec[++optind], NULL, 10);
+	}
+      else if ( strcmp (argvec[optind], "-s") == 0 )
+	{
+	  optind++;
+	  if ( strcmp (argvec[optind], "walk") == 0 )
+	    sigtype = SIGNAL_WALK;
+	  else if ( strcmp (argvec[optind], "mt") == 0 )
+	    sigtype = SIGNAL_MT;
+	  else
+	    {
+	      fprintf (stderr, "Unknown signal: %s\n", argvec[optind]);
+	      return -1;
+	    }
+	}
+      else if ( strcmp (argvec[optind], "-R") == 0 )
+	{
+	  maxsubrec = strtol (argvec[++optind], NULL, 10);
+	}
+      else if ( strcmp (argvec[optind], "-S") == 0 )
+	{
+	  seed = strtoull (argvec[++optind], NULL, 10);
+	}
+      else if ( argvec[optind][0] == '-' )
+	{
+	  fprintf (stderr, "Unknown option: %s\n", argvec[optind]);
+	  return -1;
+	}
+      else
+	{
+	  outfile = argvec[optind];
+	}
+    }
+
+  if ( ! outfile || nscans <= 0 || samprate <= 0.0 || gaplength < 1 ||
+       nchannels < 1 || nchannels > MAXCHANNELS ||
+       maxsubrec < 1 || maxsubrec > MAXSUBREC )
+    {
+      usage ();
+      return -1;
+    }
+
+  return 0;
+}  /* End of parameter_proc() */
+
+
+/***************************************************************************
+ * usage:
+ ***************************************************************************/
+static void
+usage (void)
+{
+  fprintf (stderr, "Generate synthetic nimsread bin files.\n\n");
+  fprintf (stderr, "Usage: %s [options] outfile\n\n", PACKAGE);
+  fprintf (stderr,
+	   " -n scans       Number of scans, default: 1000000\n"
+	   " -c channels    Number of channels in each scan, 1 to 8, default: 5\n"
+	   " -r rate        Sample rate in Hz, default: 8\n"
+	   " -g density     Gaps per million scans, default: 0\n"
+	   " -G length      Maximum gap length in scans, default: 60\n"
+	   " -s signal      Signal character: walk (random walk) or mt (1/f), default: mt\n"
+	   " -B             Write big-endian data, default is little-endian\n"
+	   " -P             Pad the header record to 5108 bytes\n"
+	   " -R bytes       Maximum length of data subrecords, default: 2147483639\n"
+	   " -S seed        Seed for the random generator, default: 1\n"
+	   "\n");
+}  /* End of usage() */
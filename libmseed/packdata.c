@@ -2,19 +2,90 @@
  * Routines for packing text/ASCII, INT_16, INT_32, FLOAT_32, FLOAT_64,
  * STEIM1 and STEIM2 data records.
  *
- * modified: 2017.053
+ * modified: 2026.289
  ************************************************************************/
 
 #include <memory.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "libmseed.h"
 #include "packdata.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STEIM2_X86 1
+#include <immintrin.h>
+#endif
+
 /* Control for printing debugging information */
 int encodedebug = 0;
 
+/* Steim2 encoder levels in order of preference */
+#define STEIM2_SCALAR 0
+#define STEIM2_SSE2   1
+#define STEIM2_AVX2   2
+
+/* Differences examined for each block of Steim2 word positions, the
+ * positions plus the 6 differences following the last one, rounded
+ * up to a multiple of 16 */
+#define STEIM2_POSITIONS 64
+#define STEIM2_DIFFS     80
+
+/* Differences and packing cases of a block of Steim2 word positions.
+ * The packing case of a position is the index of the first packing
+ * in steim2words that represents the differences starting there, or
+ * 7 if the difference does not fit in 30 bits. */
+struct steim2block
+{
+  int32_t diffs[STEIM2_DIFFS];
+  uint8_t widths[STEIM2_DIFFS]; /* Index of narrowest packing width */
+  uint8_t cases[STEIM2_POSITIONS];
+};
+
+typedef void (*steim2blockfn) (int32_t *input, int samplecount, int start,
+                               int32_t diff0, struct steim2block *block);
+
+/* Steim2 data word packings in order of preference, differences are
+ * masked and multiplied into place, unused differences have no mask.
+ * The 4 x 8-bit packing is stored as bytes, in big-endian byte order
+ * irrespective of the swap flag, as by steim2_encode_scalar(). */
+static const struct steim2word
+{
+  uint32_t nibble;   /* 2-bit nibble of the word in the control word */
+  uint32_t dnib;     /* 2-bit decode nibble in the top bits of the word */
+  int bytes;         /* Word is stored as bytes */
+  uint32_t mask[7];  /* Mask of each difference */
+  uint32_t scale[7]; /* Power of 2 shifting each difference into place */
+} steim2words[8] = {
+    {0x3, 0x2ul << 30, 0, {0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF}, {1ul << 24, 1ul << 20, 1ul << 16, 1ul << 12, 1ul << 8, 1ul << 4, 1}},
+    {0x3, 0x1ul << 30, 0, {0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0}, {1ul << 25, 1ul << 20, 1ul << 15, 1ul << 10, 1ul << 5, 1, 0}},
+    {0x3, 0x0ul << 30, 0, {0x3F, 0x3F, 0x3F, 0x3F, 0x3F, 0, 0}, {1ul << 24, 1ul << 18, 1ul << 12, 1ul << 6, 1, 0, 0}},
+    {0x1, 0x0ul << 30, 1, {0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0}, {1ul << 24, 1ul << 16, 1ul << 8, 1, 0, 0, 0}},
+    {0x2, 0x3ul << 30, 0, {0x3FF, 0x3FF, 0x3FF, 0, 0, 0, 0}, {1ul << 20, 1ul << 10, 1, 0, 0, 0, 0}},
+    {0x2, 0x2ul << 30, 0, {0x7FFF, 0x7FFF, 0, 0, 0, 0, 0}, {1ul << 15, 1, 0, 0, 0, 0, 0}},
+    {0x2, 0x1ul << 30, 0, {0x3FFFFFFF, 0, 0, 0, 0, 0, 0}, {1, 0, 0, 0, 0, 0, 0}},
+    {0, 0, 0, {0, 0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0, 0}}};
+
+/* Largest value of d ^ (d >> 31) for a difference d that fits in the
+ * packing width of each of the steim2words */
+static const int32_t steim2limits[7] = {7, 15, 31, 127, 511, 16383, 536870911};
+
+static int steim2_level (void);
+static int steim2_encode_scalar (int32_t *input, int samplecount, int32_t *output,
+                                 int outputlength, int32_t diff0,
+                                 char *srcname, int swapflag);
+static int steim2_encode_blocks (int32_t *input, int samplecount, int32_t *output,
+                                 int outputlength, int32_t diff0,
+                                 char *srcname, int swapflag,
+                                 steim2blockfn blockfn);
+#if STEIM2_X86
+static void steim2_block_sse2 (int32_t *input, int samplecount, int start,
+                               int32_t diff0, struct steim2block *block);
+static void steim2_block_avx2 (int32_t *input, int samplecount, int start,
+                               int32_t diff0, struct steim2block *block);
+#endif
+
 /************************************************************************
  * msr_encode_text:
  *
@@ -425,6 +496,42 @@ int
 msr_encode_steim2 (int32_t *input, int samplecount, int32_t *output,
                    int outputlength, int32_t diff0,
                    char *srcname, int swapflag)
+{
+  /* The scalar encoder logs each word when debugging */
+  if (!encodedebug)
+  {
+    switch (steim2_level ())
+    {
+#if STEIM2_X86
+    case STEIM2_AVX2:
+      return steim2_encode_blocks (input, samplecount, output, outputlength,
+                                   diff0, srcname, swapflag, steim2_block_avx2);
+    case STEIM2_SSE2:
+      return steim2_encode_blocks (input, samplecount, output, outputlength,
+                                   diff0, srcname, swapflag, steim2_block_sse2);
+#endif
+    default:
+      break;
+    }
+  }
+
+  return steim2_encode_scalar (input, samplecount, output, outputlength,
+                               diff0, srcname, swapflag);
+} /* End of msr_encode_steim2() */
+
+/************************************************************************
+ * steim2_encode_scalar:
+ *
+ * Encode Steim2 data frames one word at a time, determining the bit
+ * width of each difference and trying the packings in order.  This is
+ * the portable version of msr_encode_steim2().
+ *
+ * Return number of samples in output buffer on success, -1 on failure.
+ ************************************************************************/
+static int
+steim2_encode_scalar (int32_t *input, int samplecount, int32_t *output,
+                      int outputlength, int32_t diff0,
+                      char *srcname, int swapflag)
 {
   uint32_t *frameptr;  /* Frame pointer in output */
   int32_t *Xnp = NULL; /* Reverse integration constant, aka last sample */
@@ -709,4 +816,365 @@ msr_encode_steim2 (int32_t *input, int samplecount, int32_t *output,
     memset (output + (frameidx * 16), 0, outputlength - (frameidx * 64));
 
   return outputsamples;
-} /* End of msr_encode_steim2() */
+} /* End of steim2_encode_scalar() */
+
+/************************************************************************
+ * steim2_encode_blocks:
+ *
+ * Encode Steim2 data frames using the packing cases determined for
+ * blocks of word positions by blockfn.  Each word is assembled from
+ * the steim2words entry of its case, the frames are identical to
+ * those of steim2_encode_scalar().
+ *
+ * Return number of samples in output buffer on success, -1 on failure.
+ ************************************************************************/
+static int
+steim2_encode_blocks (int32_t *input, int samplecount, int32_t *output,
+                      int outputlength, int32_t diff0,
+                      char *srcname, int swapflag,
+                      steim2blockfn blockfn)
+{
+  struct steim2block block;
+  const struct steim2word *packing;
+  const int32_t *diffs;
+  uint32_t *frameptr;  /* Frame pointer in output */
+  int32_t *Xnp = NULL; /* Reverse integration constant, aka last sample */
+  uint32_t word;
+  int swapword[2];
+  int outputsamples = 0;
+  int maxframes     = outputlength / 64;
+  int blockstart    = 0;
+  int position;
+  int pcase;
+  int frameidx;
+  int startnibble;
+  int widx;
+
+  if (samplecount <= 0)
+    return 0;
+
+  if (!input || !output || outputlength <= 0)
+    return -1;
+
+  /* Words of 4 x 8-bit differences are always in big-endian byte order */
+  swapword[0] = swapflag;
+  swapword[1] = !ms_bigendianhost ();
+
+  blockfn (input, samplecount, blockstart, diff0, &block);
+
+  for (frameidx = 0; frameidx < maxframes && outputsamples < samplecount; frameidx++)
+  {
+    frameptr = (uint32_t *)output + (16 * frameidx);
+
+    /* Set 64-byte frame to 0's */
+    memset (frameptr, 0, 64);
+
+    /* Save forward integration constant (X0), pointer to reverse integration constant (Xn)
+     * and set the starting nibble index depending on frame. */
+    if (frameidx == 0)
+    {
+      frameptr[1] = input[0];
+
+      if (swapflag)
+        ms_gswap4a (&frameptr[1]);
+
+      Xnp = (int32_t *)&frameptr[2];
+
+      startnibble = 3; /* First frame: skip nibbles, X0, and Xn */
+    }
+    else
+    {
+      startnibble = 1; /* Subsequent frames: skip nibbles */
+    }
+
+    for (widx = startnibble; widx < 16 && outputsamples < samplecount; widx++)
+    {
+      /* Continue with the next block at the first unpacked difference */
+      if (outputsamples - blockstart >= STEIM2_POSITIONS)
+      {
+        blockstart = outputsamples;
+        blockfn (input, samplecount, blockstart, diff0, &block);
+      }
+
+      position = outputsamples - blockstart;
+      pcase    = block.cases[position];
+
+      if (pcase == 7)
+      {
+        ms_log (2, "msr_encode_steim2(%s): Unable to represent difference in <= 30 bits\n",
+                srcname);
+        return -1;
+      }
+
+      /* Mask the values, shift to proper location and set in word */
+      packing = &steim2words[pcase];
+      diffs   = block.diffs + position;
+      word    = packing->dnib |
+             ((uint32_t)diffs[0] & packing->mask[0]) * packing->scale[0] |
+             ((uint32_t)diffs[1] & packing->mask[1]) * packing->scale[1] |
+             ((uint32_t)diffs[2] & packing->mask[2]) * packing->scale[2] |
+             ((uint32_t)diffs[3] & packing->mask[3]) * packing->scale[3] |
+             ((uint32_t)diffs[4] & packing->mask[4]) * packing->scale[4] |
+             ((uint32_t)diffs[5] & packing->mask[5]) * packing->scale[5] |
+             ((uint32_t)diffs[6] & packing->mask[6]) * packing->scale[6];
+
+      if (swapword[packing->bytes])
+        ms_gswap4a (&word);
+
+      frameptr[widx] = word;
+      frameptr[0] |= packing->nibble << (30 - 2 * widx);
+
+      /* Packing case N holds 7 - N differences */
+      outputsamples += 7 - pcase;
+    } /* Done with words in frame */
+
+    /* Swap word with nibbles */
+    if (swapflag)
+      ms_gswap4a (&frameptr[0]);
+  } /* Done with frames */
+
+  /* Set Xn (reverse integration constant) in first frame to last sample */
+  if (Xnp)
+  {
+    *Xnp = *(input + outputsamples - 1);
+    if (swapflag)
+      ms_gswap4a (Xnp);
+  }
+
+  /* Pad any remaining bytes */
+  if ((frameidx * 64) < outputlength)
+    memset (output + (frameidx * 16), 0, outputlength - (frameidx * 64));
+
+  return outputsamples;
+} /* End of steim2_encode_blocks() */
+
+#if STEIM2_X86
+/************************************************************************
+ * steim2_block_sse2:
+ *
+ * Determine the differences and packing cases of the block of word
+ * positions at difference start with SSE2.  The first difference is
+ * diff0, differences beyond samplecount fit no packing.
+ *
+ * The packing width of each difference is the number of limits in
+ * steim2limits it exceeds, compared in 16-bit lanes except for the 30
+ * bit limit.  The case of each position is the first packing whose
+ * count of differences all fit its width, found from the running
+ * maximum width of the following differences in byte lanes.
+ ************************************************************************/
+static void __attribute__ ((target ("sse2")))
+steim2_block_sse2 (int32_t *input, int samplecount, int start,
+                   int32_t diff0, struct steim2block *block)
+{
+  __m128i value[4];
+  __m128i half[2];
+  __m128i width[2];
+  __m128i wide;
+  __m128i limit;
+  __m128i maxwidth;
+  __m128i pcase;
+  int count = samplecount - start;
+  int idx   = 0;
+  int vidx;
+  int widx;
+
+  if (count > STEIM2_DIFFS)
+    count = STEIM2_DIFFS;
+
+  /* Add first difference to block */
+  if (start == 0)
+  {
+    block->diffs[0] = diff0;
+    idx             = 1;
+  }
+
+  for (; idx + 4 <= count; idx += 4)
+    _mm_storeu_si128 ((__m128i *)(block->diffs + idx),
+                      _mm_sub_epi32 (_mm_loadu_si128 ((__m128i *)(input + start + idx)),
+                                     _mm_loadu_si128 ((__m128i *)(input + start + idx - 1))));
+
+  for (; idx < count; idx++)
+    block->diffs[idx] = (int32_t)((uint32_t)input[start + idx] - (uint32_t)input[start + idx - 1]);
+
+  /* Differences after the last sample, INT32_MIN fits no packing */
+  for (; idx < STEIM2_DIFFS; idx++)
+    block->diffs[idx] = INT32_MIN;
+
+  limit = _mm_set1_epi32 (steim2limits[6]);
+
+  for (idx = 0; idx < STEIM2_DIFFS; idx += 16)
+  {
+    for (vidx = 0; vidx < 4; vidx++)
+    {
+      value[vidx] = _mm_loadu_si128 ((__m128i *)(block->diffs + idx + 4 * vidx));
+      value[vidx] = _mm_xor_si128 (value[vidx], _mm_srai_epi32 (value[vidx], 31));
+    }
+
+    wide = _mm_packs_epi16 (_mm_packs_epi32 (_mm_cmpgt_epi32 (value[0], limit),
+                                             _mm_cmpgt_epi32 (value[1], limit)),
+                            _mm_packs_epi32 (_mm_cmpgt_epi32 (value[2], limit),
+                                             _mm_cmpgt_epi32 (value[3], limit)));
+
+    /* Values saturate at 32767, beyond the 15-bit limit */
+    half[0]  = _mm_packs_epi32 (value[0], value[1]);
+    half[1]  = _mm_packs_epi32 (value[2], value[3]);
+    width[0] = _mm_setzero_si128 ();
+    width[1] = _mm_setzero_si128 ();
+
+    for (widx = 0; widx < 6; widx++)
+    {
+      width[0] = _mm_sub_epi16 (width[0], _mm_cmpgt_epi16 (half[0], _mm_set1_epi16 (steim2limits[widx])));
+      width[1] = _mm_sub_epi16 (width[1], _mm_cmpgt_epi16 (half[1], _mm_set1_epi16 (steim2limits[widx])));
+    }
+
+    _mm_storeu_si128 ((__m128i *)(block->widths + idx),
+                      _mm_sub_epi8 (_mm_packs_epi16 (width[0], width[1]), wide));
+  }
+
+  /* Packing 6 - widx is usable if the widx + 1 differences it holds
+   * all fit, the first usable packing has the smallest index */
+  for (idx = 0; idx < STEIM2_POSITIONS; idx += 16)
+  {
+    maxwidth = _mm_setzero_si128 ();
+    pcase    = _mm_set1_epi8 (7);
+
+    for (widx = 0; widx < 7; widx++)
+    {
+      maxwidth = _mm_max_epu8 (maxwidth, _mm_loadu_si128 ((__m128i *)(block->widths + idx + widx)));
+      limit    = _mm_set1_epi8 (6 - widx);
+      pcase    = _mm_min_epu8 (pcase, _mm_or_si128 (limit, _mm_cmpgt_epi8 (maxwidth, limit)));
+    }
+
+    _mm_storeu_si128 ((__m128i *)(block->cases + idx), pcase);
+  }
+} /* End of steim2_block_sse2() */
+
+/************************************************************************
+ * steim2_block_avx2:
+ *
+ * Determine the differences and packing cases of the block of word
+ * positions at difference start with AVX2, as steim2_block_sse2().
+ ************************************************************************/
+static void __attribute__ ((target ("avx2")))
+steim2_block_avx2 (int32_t *input, int samplecount, int start,
+                   int32_t diff0, struct steim2block *block)
+{
+  __m256i value[2];
+  __m256i half;
+  __m256i width;
+  __m256i limit;
+  __m256i maxwidth;
+  __m256i pcase;
+  int count = samplecount - start;
+  int idx   = 0;
+  int widx;
+
+  if (count > STEIM2_DIFFS)
+    count = STEIM2_DIFFS;
+
+  /* Add first difference to block */
+  if (start == 0)
+  {
+    block->diffs[0] = diff0;
+    idx             = 1;
+  }
+
+  for (; idx + 8 <= count; idx += 8)
+    _mm256_storeu_si256 ((__m256i *)(block->diffs + idx),
+                         _mm256_sub_epi32 (_mm256_loadu_si256 ((__m256i *)(input + start + idx)),
+                                           _mm256_loadu_si256 ((__m256i *)(input + start + idx - 1))));
+
+  for (; idx < count; idx++)
+    block->diffs[idx] = (int32_t)((uint32_t)input[start + idx] - (uint32_t)input[start + idx - 1]);
+
+  /* Differences after the last sample, INT32_MIN fits no packing */
+  for (; idx < STEIM2_DIFFS; idx++)
+    block->diffs[idx] = INT32_MIN;
+
+  limit = _mm256_set1_epi32 (steim2limits[6]);
+
+  for (idx = 0; idx < STEIM2_DIFFS; idx += 16)
+  {
+    value[0] = _mm256_loadu_si256 ((__m256i *)(block->diffs + idx));
+    value[0] = _mm256_xor_si256 (value[0], _mm256_srai_epi32 (value[0], 31));
+    value[1] = _mm256_loadu_si256 ((__m256i *)(block->diffs + idx + 8));
+    value[1] = _mm256_xor_si256 (value[1], _mm256_srai_epi32 (value[1], 31));
+
+    /* Packing interleaves the 128-bit lanes, restored before storing */
+    half  = _mm256_packs_epi32 (value[0], value[1]);
+    width = _mm256_sub_epi16 (_mm256_setzero_si256 (),
+                              _mm256_packs_epi32 (_mm256_cmpgt_epi32 (value[0], limit),
+                                                  _mm256_cmpgt_epi32 (value[1], limit)));
+
+    for (widx = 0; widx < 6; widx++)
+      width = _mm256_sub_epi16 (width, _mm256_cmpgt_epi16 (half, _mm256_set1_epi16 (steim2limits[widx])));
+
+    width = _mm256_permute4x64_epi64 (width, 0xD8);
+
+    _mm_storeu_si128 ((__m128i *)(block->widths + idx),
+                      _mm_packs_epi16 (_mm256_castsi256_si128 (width),
+                                       _mm256_extracti128_si256 (width, 1)));
+  }
+
+  for (idx = 0; idx < STEIM2_POSITIONS; idx += 32)
+  {
+    maxwidth = _mm256_setzero_si256 ();
+    pcase    = _mm256_set1_epi8 (7);
+
+    for (widx = 0; widx < 7; widx++)
+    {
+      maxwidth = _mm256_max_epu8 (maxwidth, _mm256_loadu_si256 ((__m256i *)(block->widths + idx + widx)));
+      limit    = _mm256_set1_epi8 (6 - widx);
+      pcase    = _mm256_min_epu8 (pcase, _mm256_or_si256 (limit, _mm256_cmpgt_epi8 (maxwidth, limit)));
+    }
+
+    _mm256_storeu_si256 ((__m256i *)(block->cases + idx), pcase);
+  }
+} /* End of steim2_block_avx2() */
+#endif
+
+/************************************************************************
+ * steim2_level:
+ *
+ * Determine the Steim2 encoder level supported by the processor, the
+ * level can be limited by setting the ENCODE_STEIM2_KERNEL environment
+ * variable to "scalar" or "sse2".  The level is determined once and
+ * cached with atomic accesses, as the first call may be made by
+ * several threads at once.  Without vector kernels the level is
+ * always scalar.
+ ************************************************************************/
+static int
+steim2_level (void)
+{
+#if STEIM2_X86
+  static int level = -1;
+  char *envvariable;
+  int best;
+
+  if ((best = __atomic_load_n (&level, __ATOMIC_RELAXED)) >= 0)
+    return best;
+
+  best = STEIM2_SCALAR;
+
+  __builtin_cpu_init ();
+
+  if (__builtin_cpu_supports ("avx2"))
+    best = STEIM2_AVX2;
+  else if (__builtin_cpu_supports ("sse2"))
+    best = STEIM2_SSE2;
+
+  if ((envvariable = getenv ("ENCODE_STEIM2_KERNEL")))
+  {
+    if (!strcmp (envvariable, "scalar"))
+      best = STEIM2_SCALAR;
+    else if (!strcmp (envvariable, "sse2") && best > STEIM2_SSE2)
+      best = STEIM2_SSE2;
+  }
+
+  __atomic_store_n (&level, best, __ATOMIC_RELAXED);
+
+  return best;
+#else
+  return STEIM2_SCALAR;
+#endif
+} /* End of steim2_level() */
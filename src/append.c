@@ -0,0 +1,301 @@
+/***************************************************************************
+ * append.c
+ *
+ * State of the channels of an output file that is appended to by
+ * further runs or further input files.
+ *
+ * For each channel the last record written is kept along with its
+ * offset in the file.  Records of an existing file are read by
+ * ap_load().  When the next data of a channel follows its last record
+ * in time, the record can be unpacked with ap_unpack() and packed
+ * again together with the new samples, rewriting it in place.  The
+ * record sequence number and the Steim compression history of the
+ * channel continue from the rewritten record, the sample before the
+ * record is recovered from its first frame by ap_history().
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "append.h"
+
+static int32_t bitfield (uint32_t word, int shift, int bits);
+
+
+/***************************************************************************
+ * ap_init:
+ *
+ * Allocate an empty append state.
+ *
+ * Returns a new AppendState on success, and NULL on failure
+ ***************************************************************************/
+AppendState *
+ap_init (void)
+{
+  return (AppendState *) calloc (1, sizeof(AppendState));
+}  /* End of ap_init() */
+
+
+/***************************************************************************
+ * ap_load:
+ *
+ * Read the records of an existing output file and keep the last
+ * record of each channel.  A file that does not exist is treated as
+ * empty.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+int
+ap_load (AppendState *as, const char *path, flag verbose)
+{
+  MSFileParam *msfp = NULL;
+  MSRecord *msr = NULL;
+  AppendChannel *ac;
+  struct stat st;
+  char srcname[50];
+  off_t fpos;
+  int retcode;
+  int retval = 0;
+
+  if ( stat (path, &st) )
+    return ( errno == ENOENT ) ? 0 : -1;
+
+  if ( st.st_size == 0 )
+    return 0;
+
+  while ( (retcode = ms_readmsr_r (&msfp, &msr, path, -1, &fpos, NULL, 1, 0,
+				   verbose)) == MS_NOERROR )
+    {
+      msr_srcname (msr, srcname, 0);
+
+      if ( ! (ac = ap_channel (as, srcname)) ||
+	   ap_update (ac, msr->record, msr->reclen, fpos) )
+	{
+	  retval = -1;
+	  break;
+	}
+
+      as->loaded++;
+    }
+
+  if ( retval == 0 && retcode != MS_ENDOFFILE )
+    {
+      ms_log (2, "Cannot read %s: %s\n", path, ms_errorstr (retcode));
+      retval = -1;
+    }
+
+  ms_readmsr_r (&msfp, &msr, NULL, 0, NULL, NULL, 0, 0, 0);
+
+  return retval;
+}  /* End of ap_load() */
+
+
+/***************************************************************************
+ * ap_channel:
+ *
+ * Find the state of a channel, adding it if not found.
+ *
+ * Returns the AppendChannel on success, and NULL on failure
+ ***************************************************************************/
+AppendChannel *
+ap_channel (AppendState *as, const char *srcname)
+{
+  AppendChannel *ac;
+
+  for ( ac = as->channels; ac != 0; ac = ac->next )
+    if ( ! strcmp (ac->srcname, srcname) )
+      return ac;
+
+  if ( ! (ac = (AppendChannel *) calloc (1, sizeof(AppendChannel))) )
+    return NULL;
+
+  strncpy (ac->srcname, srcname, sizeof(ac->srcname) - 1);
+  ac->next = as->channels;
+  as->channels = ac;
+  as->count++;
+
+  return ac;
+}  /* End of ap_channel() */
+
+
+/***************************************************************************
+ * ap_update:
+ *
+ * Set the last record of a channel, written at offset of the file.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+int
+ap_update (AppendChannel *ac, const char *record, int reclen, off_t offset)
+{
+  char *newrecord;
+
+  if ( reclen != ac->reclen )
+    {
+      if ( ! (newrecord = (char *) realloc (ac->record, reclen)) )
+	return -1;
+
+      ac->record = newrecord;
+      ac->reclen = reclen;
+    }
+
+  memcpy (ac->record, record, reclen);
+  ac->offset = offset;
+
+  return 0;
+}  /* End of ap_update() */
+
+
+/***************************************************************************
+ * ap_unpack:
+ *
+ * Unpack the last record of a channel including its samples.  The
+ * caller must free the record with msr_free().
+ *
+ * Returns a new MSRecord on success, and NULL if there is no record or
+ * it cannot be unpacked
+ ***************************************************************************/
+MSRecord *
+ap_unpack (AppendChannel *ac)
+{
+  MSRecord *msr = NULL;
+
+  if ( ! ac->record )
+    return NULL;
+
+  if ( msr_unpack (ac->record, ac->reclen, &msr, 1, 0) != MS_NOERROR )
+    {
+      msr_free (&msr);
+      return NULL;
+    }
+
+  return msr;
+}  /* End of ap_unpack() */
+
+
+/***************************************************************************
+ * ap_history:
+ *
+ * Determine the last sample packed before a Steim 1 or 2 compressed
+ * record, the compression history of the record, from the first
+ * sample X0 and the first difference of its first frame.  The record
+ * must have been unpacked by ap_unpack().
+ *
+ * Returns 0 on success, and -1 if the record is not Steim compressed
+ ***************************************************************************/
+int
+ap_history (MSRecord *msr, int32_t *lastsample)
+{
+  const unsigned char *frame;
+  uint32_t words[4];
+  int16_t half;
+  int32_t diff;
+  flag swapflag;
+  int nibble;
+  int dnib;
+  int idx;
+
+  if ( ( msr->encoding != DE_STEIM1 && msr->encoding != DE_STEIM2 ) ||
+       msr->numsamples <= 0 ||
+       msr->fsdh->data_offset + 64 > msr->reclen )
+    return -1;
+
+  frame = (const unsigned char *) msr->record + msr->fsdh->data_offset;
+  swapflag = ( msr->byteorder != ms_bigendianhost () );
+
+  memcpy (words, frame, sizeof(words));
+  if ( swapflag )
+    for ( idx = 0; idx < 4; idx++ )
+      ms_gswap4a (&words[idx]);
+
+  /* The first difference is the first value of word 3 */
+  nibble = (words[0] >> 24) & 0x3;
+  dnib = (words[3] >> 30) & 0x3;
+
+  switch ( nibble )
+    {
+    case 1:
+      diff = (int8_t) frame[12];
+      break;
+    case 2:
+      if ( msr->encoding == DE_STEIM1 )
+	{
+	  memcpy (&half, frame + 12, sizeof(half));
+	  if ( swapflag )
+	    ms_gswap2a (&half);
+	  diff = half;
+	}
+      else if ( dnib == 1 )
+	diff = bitfield (words[3], 0, 30);
+      else if ( dnib == 2 )
+	diff = bitfield (words[3], 15, 15);
+      else if ( dnib == 3 )
+	diff = bitfield (words[3], 20, 10);
+      else
+	return -1;
+      break;
+    case 3:
+      if ( msr->encoding == DE_STEIM1 )
+	diff = (int32_t) words[3];
+      else if ( dnib == 0 )
+	diff = bitfield (words[3], 24, 6);
+      else if ( dnib == 1 )
+	diff = bitfield (words[3], 25, 5);
+      else if ( dnib == 2 )
+	diff = bitfield (words[3], 24, 4);
+      else
+	return -1;
+      break;
+    default:
+      diff = 0;
+      break;
+    }
+
+  *lastsample = (int32_t) words[1] - diff;
+
+  return 0;
+}  /* End of ap_history() */
+
+
+/***************************************************************************
+ * ap_free:
+ *
+ * Free an append state and all channels.
+ ***************************************************************************/
+void
+ap_free (AppendState *as)
+{
+  AppendChannel *ac, *nextac;
+
+  if ( ! as )
+    return;
+
+  for ( ac = as->channels; ac != 0; ac = nextac )
+    {
+      nextac = ac->next;
+      free (ac->record);
+      free (ac);
+    }
+
+  free (as);
+}  /* End of ap_free() */
+
+
+/***************************************************************************
+ * bitfield:
+ *
+ * Extract a signed field of bits from a word, starting at bit shift.
+ *
+ * Returns the sign extended value
+ ***************************************************************************/
+static int32_t
+bitfield (uint32_t word, int shift, int bits)
+{
+  uint32_t value = (word >> shift) & ((1u << bits) - 1);
+  uint32_t signbit = 1u << (bits - 1);
+
+  return (int32_t) (value ^ signbit) - (int32_t) signbit;
+}  /* End of bitfield() */
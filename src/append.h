@@ -0,0 +1,40 @@
+#ifndef APPEND_H
+#define APPEND_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+#include <libmseed.h>
+
+/* Last record written for a channel of the output file */
+typedef struct AppendChannel_s {
+  char srcname[50];            /* NET_STA_LOC_CHAN */
+  char *record;                /* Copy of the last record, NULL if none */
+  int reclen;
+  off_t offset;                /* File offset of the last record */
+  struct AppendChannel_s *next;
+} AppendChannel;
+
+/* Channels of an output file that is appended to */
+typedef struct AppendState_s {
+  AppendChannel *channels;
+  int count;
+  int64_t loaded;              /* Records read from the existing file */
+  int64_t continued;           /* Records rewritten to continue a channel */
+} AppendState;
+
+AppendState *ap_init (void);
+int ap_load (AppendState *as, const char *path, flag verbose);
+AppendChannel *ap_channel (AppendState *as, const char *srcname);
+int ap_update (AppendChannel *ac, const char *record, int reclen, off_t offset);
+MSRecord *ap_unpack (AppendChannel *ac);
+int ap_history (MSRecord *msr, int32_t *lastsample);
+void ap_free (AppendState *as);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APPEND_H */
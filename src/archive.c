@@ -0,0 +1,325 @@
+/***************************************************************************
+ * archive.c
+ *
+ * Output of packed records to an SDS (SeisComP Data Structure)
+ * archive of day files:
+ *
+ *   ROOT/YEAR/NET/STA/CHAN.D/NET.STA.LOC.CHAN.D.YEAR.DAY
+ *
+ * Records are appended to the day files, which are created along with
+ * their directories as needed.  A bounded number of day files are
+ * kept open, when another file is needed the least recently used one
+ * is closed, so interleaved channels and segments do not open and
+ * close a file for each segment.
+ *
+ * The records written to a day file must not extend into the next
+ * day, segments should be split at ar_dayend() before packing.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "archive.h"
+
+#define DAY_HPTIME ((hptime_t) 86400 * HPTMODULUS)
+
+static ArchiveFile *openfile (Archive *ar, const char *path);
+static int closefile (Archive *ar, ArchiveFile *af);
+static int makedirs (char *path);
+
+
+/***************************************************************************
+ * ar_init:
+ *
+ * Create an archive writer for the SDS archive at root, keeping at
+ * most maxopen day files open.  Each file gets an output buffer of
+ * bufsize bytes, but at least AR_MINBUFSIZE.  The flags are passed to
+ * rw_open() for each file, which is always appended to.
+ *
+ * Returns a new Archive on success, and NULL on failure
+ ***************************************************************************/
+Archive *
+ar_init (const char *root, int maxopen, size_t bufsize, int flags)
+{
+  Archive *ar;
+
+  if ( ! (ar = (Archive *) calloc (1, sizeof(Archive))) )
+    return NULL;
+
+  if ( ! (ar->root = strdup (root)) )
+    {
+      free (ar);
+      return NULL;
+    }
+
+  ar->maxopen = ( maxopen > 0 ) ? maxopen : AR_MAXOPEN;
+  ar->bufsize = ( bufsize < AR_MINBUFSIZE ) ? AR_MINBUFSIZE : bufsize;
+  ar->flags = flags | RW_APPEND;
+
+  return ar;
+}  /* End of ar_init() */
+
+
+/***************************************************************************
+ * ar_file:
+ *
+ * Find the day file for the specified codes and the day of time,
+ * opening it if needed.  The file becomes the most recently used.  If
+ * path is not NULL the path of the file is copied to it.
+ *
+ * Returns the RecWriter of the file on success, and NULL on failure
+ * with errno set.
+ ***************************************************************************/
+RecWriter *
+ar_file (Archive *ar, const char *net, const char *sta, const char *loc,
+	 const char *chan, hptime_t time, char *path, size_t pathsize)
+{
+  ArchiveFile *af;
+  BTime btime;
+  char filepath[1024];
+
+  if ( ms_hptime2btime (time, &btime) )
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+
+  snprintf (filepath, sizeof(filepath), "%s/%04d/%s/%s/%s.D/%s.%s.%s.%s.D.%04d.%03d",
+	    ar->root, btime.year, net, sta, chan,
+	    net, sta, loc, chan, btime.year, btime.day);
+
+  if ( path )
+    {
+      strncpy (path, filepath, pathsize - 1);
+      path[pathsize - 1] = '\0';
+    }
+
+  for ( af = ar->head; af != 0; af = af->next )
+    if ( ! strcmp (af->path, filepath) )
+      break;
+
+  if ( ! af )
+    return ( (af = openfile (ar, filepath)) ) ? af->rw : NULL;
+
+  /* Move to the front of the list */
+  if ( af != ar->head )
+    {
+      af->prev->next = af->next;
+      if ( af->next )
+	af->next->prev = af->prev;
+      else
+	ar->tail = af->prev;
+
+      af->prev = 0;
+      af->next = ar->head;
+      ar->head->prev = af;
+      ar->head = af;
+    }
+
+  return af->rw;
+}  /* End of ar_file() */
+
+
+/***************************************************************************
+ * ar_dayend:
+ *
+ * Returns the time of the start of the day following time
+ ***************************************************************************/
+hptime_t
+ar_dayend (hptime_t time)
+{
+  hptime_t day = time / DAY_HPTIME;
+
+  if ( time < 0 && time % DAY_HPTIME )
+    day--;
+
+  return (day + 1) * DAY_HPTIME;
+}  /* End of ar_dayend() */
+
+
+/***************************************************************************
+ * ar_closeall:
+ *
+ * Flush and close all open day files.  Their write counts are added
+ * to the archive, which can still be used.
+ *
+ * Returns 0 on success, and -1 if any data could not be written.
+ ***************************************************************************/
+int
+ar_closeall (Archive *ar)
+{
+  int retval = 0;
+
+  while ( ar->head )
+    if ( closefile (ar, ar->head) )
+      retval = -1;
+
+  return retval;
+}  /* End of ar_closeall() */
+
+
+/***************************************************************************
+ * ar_free:
+ *
+ * Close all open day files, ignoring errors, and free the archive
+ * writer.
+ ***************************************************************************/
+void
+ar_free (Archive *ar)
+{
+  if ( ! ar )
+    return;
+
+  ar_closeall (ar);
+
+  free (ar->root);
+  free (ar);
+}  /* End of ar_free() */
+
+
+/***************************************************************************
+ * openfile:
+ *
+ * Open a day file for appending, creating its directories if needed,
+ * and add it to the front of the list.  If the maximum number of files
+ * is open the least recently used file is closed first.
+ *
+ * Returns the new ArchiveFile on success, and NULL on failure
+ ***************************************************************************/
+static ArchiveFile *
+openfile (Archive *ar, const char *path)
+{
+  ArchiveFile *af;
+  char *dirpath;
+  char *sep;
+
+  if ( ar->nopen >= ar->maxopen && ar->tail )
+    {
+      ar->evictions++;
+
+      if ( closefile (ar, ar->tail) )
+	return NULL;
+    }
+
+  if ( ! (af = (ArchiveFile *) calloc (1, sizeof(ArchiveFile))) )
+    return NULL;
+
+  if ( ! (af->path = strdup (path)) )
+    {
+      free (af);
+      return NULL;
+    }
+
+  if ( ! (af->rw = rw_open (path, ar->bufsize, ar->flags)) && errno == ENOENT )
+    {
+      /* Create the directories of a new station, channel or year */
+      if ( (dirpath = strdup (path)) )
+	{
+	  if ( (sep = strrchr (dirpath, '/')) )
+	    {
+	      *sep = '\0';
+
+	      if ( makedirs (dirpath) == 0 )
+		af->rw = rw_open (path, ar->bufsize, ar->flags);
+	    }
+
+	  free (dirpath);
+	}
+    }
+
+  if ( ! af->rw )
+    {
+      free (af->path);
+      free (af);
+      return NULL;
+    }
+
+  af->next = ar->head;
+  if ( ar->head )
+    ar->head->prev = af;
+  else
+    ar->tail = af;
+  ar->head = af;
+
+  ar->nopen++;
+  ar->opens++;
+
+  return af;
+}  /* End of openfile() */
+
+
+/***************************************************************************
+ * closefile:
+ *
+ * Flush and close a day file, removing it from the list, and add its
+ * write counts to the archive.
+ *
+ * Returns 0 on success, and -1 if any data could not be written.
+ ***************************************************************************/
+static int
+closefile (Archive *ar, ArchiveFile *af)
+{
+  int retval = 0;
+
+  if ( rw_flush (af->rw) )
+    retval = -1;
+
+  ar->writtenbytes += af->rw->offset - af->rw->origin;
+  ar->writecalls += af->rw->writecalls;
+
+  if ( rw_close (af->rw) )
+    retval = -1;
+
+  if ( af->prev )
+    af->prev->next = af->next;
+  else
+    ar->head = af->next;
+
+  if ( af->next )
+    af->next->prev = af->prev;
+  else
+    ar->tail = af->prev;
+
+  ar->nopen--;
+
+  free (af->path);
+  free (af);
+
+  return retval;
+}  /* End of closefile() */
+
+
+/***************************************************************************
+ * makedirs:
+ *
+ * Create a directory and any missing parent directories.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+makedirs (char *path)
+{
+  char *sep;
+
+  for ( sep = strchr (path + 1, '/'); sep != 0; sep = strchr (sep + 1, '/') )
+    {
+      *sep = '\0';
+
+      if ( mkdir (path, 0777) && errno != EEXIST )
+	{
+	  *sep = '/';
+	  return -1;
+	}
+
+      *sep = '/';
+    }
+
+  if ( mkdir (path, 0777) && errno != EEXIST )
+    return -1;
+
+  return 0;
+}  /* End of makedirs() */
@@ -0,0 +1,54 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <libmseed.h>
+
+#include "recwriter.h"
+
+/* Default maximum number of open archive files */
+#define AR_MAXOPEN 64
+
+/* Minimum output buffer size of an archive file */
+#define AR_MINBUFSIZE (64 * 1024)
+
+/* An open day file of the archive, in least recently used order */
+typedef struct ArchiveFile_s {
+  char *path;
+  RecWriter *rw;
+  struct ArchiveFile_s *prev;  /* More recently used file */
+  struct ArchiveFile_s *next;  /* Less recently used file */
+} ArchiveFile;
+
+/* An SDS archive with a bounded set of open day files */
+typedef struct Archive_s {
+  char *root;
+  int maxopen;
+  int nopen;
+  size_t bufsize;              /* Output buffer size of each file */
+  int flags;                   /* RecWriter flags */
+  ArchiveFile *head;           /* Most recently used file */
+  ArchiveFile *tail;           /* Least recently used file */
+  int64_t opens;               /* Files opened, including reopens */
+  int64_t evictions;           /* Files closed to open another */
+  int64_t writtenbytes;        /* Bytes written by closed files */
+  int64_t writecalls;          /* Write calls of closed files */
+} Archive;
+
+Archive *ar_init (const char *root, int maxopen, size_t bufsize, int flags);
+RecWriter *ar_file (Archive *ar, const char *net, const char *sta,
+		    const char *loc, const char *chan, hptime_t time,
+		    char *path, size_t pathsize);
+hptime_t ar_dayend (hptime_t time);
+int ar_closeall (Archive *ar);
+void ar_free (Archive *ar);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ARCHIVE_H */
@@ -0,0 +1,527 @@
+/***************************************************************************
+ * inventory.c
+ *
+ * A catalog of the header information of input files, read without
+ * reading their data.
+ *
+ * For bin files only the header record is read, the data record is
+ * skipped by seeking over it using its length marker and the end of
+ * data marker is checked, so a truncated file is reported as an error.
+ * Raw NIMS files have no header, the time of their data is determined
+ * from the GPS time stamps of all blocks, which requires reading the
+ * whole file.
+ *
+ * Files are read by a pool of threads, each taking the next file of
+ * the list, and the catalog is printed in the order of the list as
+ * CSV with a line per file or as a JSON array of objects.
+ ***************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libmseed.h>
+
+#include "inventory.h"
+#include "readNIMSraw.h"
+
+/* Size of the stdio buffer, holding the longest (padded) header */
+#define IV_BUFSIZE 8192
+
+/* Files shared by the threads of iv_scan() */
+struct ivpool {
+  InvEntry *entries;
+  int count;
+  int next;                    /* Index of the next file to read */
+  pthread_mutex_t lock;
+};
+
+static void *ivworker (void *arg);
+static int readentry (InvEntry *entry);
+static int readbin (InvEntry *entry, FILE *ifp, NIMSheader *hdr);
+static int readraw (InvEntry *entry, int fd, NIMSheader *hdr);
+static void printcsv (FILE *fp, InvEntry *entry);
+static void printjson (FILE *fp, InvEntry *entry);
+static void printcsvstring (FILE *fp, const char *string);
+static void printjsonstring (FILE *fp, const char *string);
+static void timestrings (InvEntry *entry, char *start, char *end);
+
+
+/***************************************************************************
+ * iv_scan:
+ *
+ * Read the header information of count files with nworkers threads.
+ * The path of each entry must be set, all other fields are set by
+ * this routine.
+ *
+ * Returns the number of files that could not be read on success, and
+ * -1 if no thread could be started
+ ***************************************************************************/
+int
+iv_scan (InvEntry *entries, int count, int nworkers)
+{
+  struct ivpool pool;
+  pthread_t *threads;
+  int started;
+  int failed = 0;
+  int idx;
+
+  if ( nworkers > count )
+    nworkers = count;
+
+  if ( nworkers <= 1 )
+    {
+      for ( idx = 0; idx < count; idx++ )
+	if ( readentry (&entries[idx]) )
+	  failed++;
+
+      return failed;
+    }
+
+  if ( ! (threads = (pthread_t *) malloc (sizeof(pthread_t) * nworkers)) )
+    return -1;
+
+  pool.entries = entries;
+  pool.count = count;
+  pool.next = 0;
+  pthread_mutex_init (&pool.lock, NULL);
+
+  for ( started = 0; started < nworkers; started++ )
+    if ( pthread_create (&threads[started], NULL, ivworker, &pool) )
+      break;
+
+  for ( idx = 0; idx < started; idx++ )
+    pthread_join (threads[idx], NULL);
+
+  pthread_mutex_destroy (&pool.lock);
+  free (threads);
+
+  if ( started == 0 )
+    return -1;
+
+  for ( idx = 0; idx < count; idx++ )
+    if ( entries[idx].status )
+      failed++;
+
+  return failed;
+}  /* End of iv_scan() */
+
+
+/***************************************************************************
+ * iv_print:
+ *
+ * Print the catalog of count entries read by iv_scan() in the
+ * specified format, IV_CSV or IV_JSON.
+ *
+ * Returns 0 on success, and -1 on write errors
+ ***************************************************************************/
+int
+iv_print (FILE *fp, InvEntry *entries, int count, int format)
+{
+  int idx;
+
+  if ( format == IV_JSON )
+    fprintf (fp, "[");
+  else
+    fprintf (fp, "path,format,status,size,byteorder,start,end,samplerate,"
+	     "scans,channels,latitude,longitude,elevation,declination,gaptype,"
+	     "missingflag,ngaps,gaps\n");
+
+  for ( idx = 0; idx < count; idx++ )
+    {
+      if ( format == IV_JSON )
+	{
+	  fprintf (fp, "%s\n  ", ( idx ) ? "," : "");
+	  printjson (fp, &entries[idx]);
+	}
+      else
+	{
+	  printcsv (fp, &entries[idx]);
+	}
+    }
+
+  if ( format == IV_JSON )
+    fprintf (fp, "\n]\n");
+
+  if ( fflush (fp) || ferror (fp) )
+    return -1;
+
+  return 0;
+}  /* End of iv_print() */
+
+
+/***************************************************************************
+ * iv_free:
+ *
+ * Free the gap tables of count entries.
+ ***************************************************************************/
+void
+iv_free (InvEntry *entries, int count)
+{
+  int idx;
+
+  for ( idx = 0; idx < count; idx++ )
+    {
+      free (entries[idx].gaps);
+      entries[idx].gaps = 0;
+    }
+}  /* End of iv_free() */
+
+
+/***************************************************************************
+ * ivworker:
+ *
+ * Thread of iv_scan(), reading the next file of the pool until all
+ * files have been read.
+ ***************************************************************************/
+static void *
+ivworker (void *arg)
+{
+  struct ivpool *pool = (struct ivpool *) arg;
+  int idx;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&pool->lock);
+      idx = pool->next++;
+      pthread_mutex_unlock (&pool->lock);
+
+      if ( idx >= pool->count )
+	break;
+
+      readentry (&pool->entries[idx]);
+    }
+
+  return NULL;
+}  /* End of ivworker() */
+
+
+/***************************************************************************
+ * readentry:
+ *
+ * Read the header information of the file of an entry.  Errors are
+ * reported to stderr.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+readentry (InvEntry *entry)
+{
+  char iobuf[IV_BUFSIZE];
+  NIMSheader hdr;
+  char lenrecord[4];
+  struct stat st;
+  FILE *ifp;
+  int retval;
+
+  entry->status = -1;
+
+  if ( (ifp = fopen (entry->path, "rb")) == NULL )
+    {
+      fprintf (stderr, "Cannot open input file: %s (%s)\n",
+	       entry->path, strerror(errno));
+      return -1;
+    }
+
+  setvbuf (ifp, iobuf, _IOFBF, sizeof(iobuf));
+
+  if ( fstat (fileno (ifp), &st) ||
+       fread (lenrecord, 1, 4, ifp) != 4 )
+    {
+      fprintf (stderr, "[%s] Error reading input file\n", entry->path);
+      fclose (ifp);
+      return -1;
+    }
+
+  entry->size = st.st_size;
+
+  if ( is_bin_file (lenrecord, 4) )
+    {
+      rewind (ifp);
+      retval = readbin (entry, ifp, &hdr);
+    }
+  else
+    {
+      retval = readraw (entry, fileno (ifp), &hdr);
+    }
+
+  fclose (ifp);
+
+  if ( retval )
+    return -1;
+
+  entry->lat = hdr.lat;
+  entry->lon = hdr.lon;
+  entry->elev = hdr.elev;
+  entry->decl = hdr.decl;
+  entry->dt = hdr.dt;
+  memcpy (entry->start_time, hdr.start_time, sizeof(entry->start_time));
+  entry->nscans = hdr.nscans;
+  entry->nchannels = hdr.nchannels;
+  entry->gaptyp = hdr.gaptyp;
+  entry->missingdataflag = hdr.missingdataflag;
+  entry->ngaps = hdr.ngaps;
+  entry->bigendian = ( entry->raw ) ? 1 : ms_bigendianhost () ^ hdr.swapflag;
+
+  if ( hdr.ngaps > 0 )
+    {
+      if ( ! (entry->gaps = (NIMSgap *) malloc (sizeof(NIMSgap) * hdr.ngaps)) )
+	{
+	  fprintf (stderr, "[%s] Error allocating memory\n", entry->path);
+	  return -1;
+	}
+
+      memcpy (entry->gaps, hdr.gaps, sizeof(NIMSgap) * hdr.ngaps);
+    }
+
+  entry->status = 0;
+
+  return 0;
+}  /* End of readentry() */
+
+
+/***************************************************************************
+ * readbin:
+ *
+ * Read the header record of a bin file and check the end of data
+ * marker, seeking over the data record and its subrecords.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+readbin (InvEntry *entry, FILE *ifp, NIMSheader *hdr)
+{
+  if ( ! read_bin_header (ifp, hdr, 0) )
+    {
+      fprintf (stderr, "[%s] Error reading input bin file\n", entry->path);
+      return -1;
+    }
+
+  if ( skip_bin_data (ifp, hdr) < 0 )
+    {
+      fprintf (stderr, "[%s] Data record truncated\n", entry->path);
+      return -1;
+    }
+
+  return 0;
+}  /* End of readbin() */
+
+
+/***************************************************************************
+ * readraw:
+ *
+ * Determine the header information of a raw NIMS file by locating its
+ * data blocks in a memory mapping of the file.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+readraw (InvEntry *entry, int fd, NIMSheader *hdr)
+{
+  void *map;
+  int retval = 0;
+
+  map = mmap (NULL, (size_t) entry->size, PROT_READ, MAP_SHARED, fd, 0);
+
+  if ( map == MAP_FAILED )
+    {
+      fprintf (stderr, "Cannot map input file: %s (%s)\n",
+	       entry->path, strerror(errno));
+      return -1;
+    }
+
+  madvise (map, (size_t) entry->size, MADV_SEQUENTIAL);
+
+  if ( ! is_raw_file ((const char *) map, (size_t) entry->size) )
+    {
+      fprintf (stderr, "[%s] Not a bin file or raw NIMS file\n", entry->path);
+      retval = -1;
+    }
+  else if ( ! parse_raw_header ((const char *) map, (size_t) entry->size, hdr, 0) )
+    {
+      fprintf (stderr, "[%s] Error reading input raw NIMS file\n", entry->path);
+      retval = -1;
+    }
+  else
+    {
+      entry->raw = 1;
+    }
+
+  munmap (map, (size_t) entry->size);
+
+  return retval;
+}  /* End of readraw() */
+
+
+/***************************************************************************
+ * printcsv:
+ *
+ * Print the CSV line of an entry, the gap table is a single field of
+ * start:length pairs separated by semicolons.
+ ***************************************************************************/
+static void
+printcsv (FILE *fp, InvEntry *entry)
+{
+  char start[40];
+  char end[40];
+  int idx;
+
+  printcsvstring (fp, entry->path);
+
+  if ( entry->status )
+    {
+      fprintf (fp, ",,error,,,,,,,,,,,,,,,\n");
+      return;
+    }
+
+  timestrings (entry, start, end);
+
+  fprintf (fp, ",%s,ok,%" PRId64 ",%s,%s,%s,%.6g,%d,%d,%.5f,%.5f,%.1f,%.2f,%d,%d,%d,",
+	   ( entry->raw ) ? "raw" : "bin", entry->size,
+	   ( entry->bigendian ) ? "big" : "little", start, end,
+	   1 / entry->dt, entry->nscans, entry->nchannels, entry->lat, entry->lon,
+	   entry->elev, entry->decl, entry->gaptyp,
+	   entry->missingdataflag, entry->ngaps);
+
+  for ( idx = 0; idx < entry->ngaps; idx++ )
+    fprintf (fp, "%s%d:%d", ( idx ) ? ";" : "",
+	     entry->gaps[idx].start, entry->gaps[idx].length);
+
+  fputc ('\n', fp);
+}  /* End of printcsv() */
+
+
+/***************************************************************************
+ * printjson:
+ *
+ * Print the JSON object of an entry.
+ ***************************************************************************/
+static void
+printjson (FILE *fp, InvEntry *entry)
+{
+  char start[40];
+  char end[40];
+  int idx;
+
+  fprintf (fp, "{\"path\": ");
+  printjsonstring (fp, entry->path);
+
+  if ( entry->status )
+    {
+      fprintf (fp, ", \"status\": \"error\"}");
+      return;
+    }
+
+  timestrings (entry, start, end);
+
+  fprintf (fp, ", \"format\": \"%s\", \"status\": \"ok\", \"size\": %" PRId64 ", \"byteorder\": \"%s\",\n   "
+	   "\"start\": \"%s\", \"end\": \"%s\", \"samplerate\": %.6g, \"scans\": %d, \"channels\": %d,\n   "
+	   "\"latitude\": %.5f, \"longitude\": %.5f, \"elevation\": %.1f, \"declination\": %.2f,\n   "
+	   "\"gaptype\": %d, \"missingflag\": %d, \"gaps\": [",
+	   ( entry->raw ) ? "raw" : "bin", entry->size, ( entry->bigendian ) ? "big" : "little", start, end,
+	   1 / entry->dt, entry->nscans, entry->nchannels, entry->lat, entry->lon, entry->elev,
+	   entry->decl, entry->gaptyp, entry->missingdataflag);
+
+  for ( idx = 0; idx < entry->ngaps; idx++ )
+    fprintf (fp, "%s{\"start\": %d, \"length\": %d}", ( idx ) ? ", " : "",
+	     entry->gaps[idx].start, entry->gaps[idx].length);
+
+  fprintf (fp, "]}");
+}  /* End of printjson() */
+
+
+/***************************************************************************
+ * printcsvstring:
+ *
+ * Print a CSV field, quoted if it contains a separator, quote or line
+ * break.
+ ***************************************************************************/
+static void
+printcsvstring (FILE *fp, const char *string)
+{
+  const char *cp;
+
+  if ( ! strpbrk (string, ",\"\r\n") )
+    {
+      fputs (string, fp);
+      return;
+    }
+
+  fputc ('"', fp);
+
+  for ( cp = string; *cp; cp++ )
+    {
+      if ( *cp == '"' )
+	fputc ('"', fp);
+      fputc (*cp, fp);
+    }
+
+  fputc ('"', fp);
+}  /* End of printcsvstring() */
+
+
+/***************************************************************************
+ * printjsonstring:
+ *
+ * Print a string as a quoted JSON string.
+ ***************************************************************************/
+static void
+printjsonstring (FILE *fp, const char *string)
+{
+  const unsigned char *cp;
+
+  fputc ('"', fp);
+
+  for ( cp = (const unsigned char *) string; *cp; cp++ )
+    {
+      if ( *cp == '"' || *cp == '\\' )
+	fprintf (fp, "\\%c", *cp);
+      else if ( *cp < 0x20 )
+	fprintf (fp, "\\u%04x", *cp);
+      else
+	fputc (*cp, fp);
+    }
+
+  fputc ('"', fp);
+}  /* End of printjsonstring() */
+
+
+/***************************************************************************
+ * timestrings:
+ *
+ * Format the times of the first and last scan of an entry as ISO
+ * strings, empty if the start date is invalid.
+ ***************************************************************************/
+static void
+timestrings (InvEntry *entry, char *start, char *end)
+{
+  hptime_t starttime;
+  int yday;
+
+  start[0] = end[0] = '\0';
+
+  if ( ms_md2doy (entry->start_time[0], entry->start_time[1],
+		  entry->start_time[2], &yday) )
+    return;
+
+  starttime = ms_time2hptime (entry->start_time[0], yday, entry->start_time[3],
+			      entry->start_time[4], entry->start_time[5], 0);
+
+  ms_hptime2isotimestr (starttime, start, 1);
+
+  if ( entry->nscans > 0 )
+    ms_hptime2isotimestr (starttime + (hptime_t) ((entry->nscans - 1) * (double) entry->dt * HPTMODULUS + 0.5),
+			  end, 1);
+  else
+    strcpy (end, start);
+}  /* End of timestrings() */
@@ -0,0 +1,42 @@
+#ifndef INVENTORY_H
+#define INVENTORY_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "readNIMSbin.h"
+
+/* Catalog formats */
+#define IV_CSV  0
+#define IV_JSON 1
+
+/* Header information of an input file */
+typedef struct InvEntry_s {
+  const char *path;
+  int status;                  /* 0 if the header was read, -1 otherwise */
+  int raw;                     /* Raw NIMS file instead of a bin file */
+  int bigendian;               /* Byte order of the file */
+  int64_t size;                /* File size in bytes */
+  float lat, lon, elev, decl, dt;
+  int32_t start_time[6];       /* Year, month, day, hour, min, sec */
+  int32_t nscans;
+  int32_t nchannels;           /* Channels of each scan, 0 if unknown */
+  int32_t gaptyp;
+  int32_t missingdataflag;
+  int32_t ngaps;
+  NIMSgap *gaps;               /* Gap table, NULL if no gaps */
+} InvEntry;
+
+int iv_scan (InvEntry *entries, int count, int nworkers);
+int iv_print (FILE *fp, InvEntry *entries, int count, int format);
+void iv_free (InvEntry *entries, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INVENTORY_H */
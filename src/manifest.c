@@ -0,0 +1,1014 @@
+/***************************************************************************
+ * manifest.c
+ *
+ * A manifest of converted input files, used to skip files that have
+ * not changed since they were converted.
+ *
+ * For each converted file the size, modification time and a fast hash
+ * of the first and last MF_HASHLEN bytes are recorded, along with the
+ * number of records and samples packed and the output files written.
+ *
+ * The manifest is a text file with one tab separated line per file:
+ *
+ *   size mtime hash records samples noutputs path output1 output2 ...
+ *
+ * Lines are only appended, each with a single write() once the output
+ * of a file is complete, and a later line for the same file replaces
+ * earlier ones.  A line cut short by an interrupted run is ignored.
+ * When lines have been superseded the manifest is compacted by writing
+ * a new file and renaming it over the old one, so the manifest is
+ * always consistent.
+ ***************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "manifest.h"
+
+#define MF_HEADER "# mt2mseed manifest 1\n"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+static uint64_t fnvhash (uint64_t hash, const unsigned char *data, size_t length);
+static int statfile (const char *path, ManifestEntry *entry, int hash);
+static int hasoutput (ManifestEntry *entry, const char *output);
+static ManifestEntry *table_find (ManifestTable *table, const char *path);
+static int table_put (ManifestTable *table, ManifestEntry *entry);
+static int table_index (ManifestTable *table, int nslots);
+static void table_free (ManifestTable *table);
+static ManifestEntry *dupentry (ManifestEntry *entry);
+static int setoutputs (ManifestEntry *entry, char **outputs, int noutputs);
+static void freeentry (ManifestEntry *entry);
+static ManifestEntry *parseline (char *line);
+static int writeentry (int fd, ManifestEntry *entry);
+static int writeall (int fd, const char *data, size_t length);
+static int compact (Manifest *mf);
+
+
+/***************************************************************************
+ * mf_open:
+ *
+ * Open a manifest, loading the entries of an existing file.  If the
+ * file contains superseded or unusable lines it is compacted first.
+ * The manifest is then opened for appending new entries, creating it
+ * if needed.
+ *
+ * Returns a new Manifest on success, and NULL on failure with errno
+ * set.
+ ***************************************************************************/
+Manifest *
+mf_open (const char *path)
+{
+  Manifest *mf;
+  ManifestEntry *entry;
+  FILE *fp;
+  char *line = 0;
+  size_t linesize = 0;
+  ssize_t linelen;
+  struct stat st;
+  int errsave;
+
+  if ( ! (mf = (Manifest *) calloc (1, sizeof(Manifest))) )
+    return NULL;
+
+  mf->journal = -1;
+
+  if ( ! (mf->path = strdup (path)) )
+    {
+      free (mf);
+      return NULL;
+    }
+
+  if ( (fp = fopen (path, "r")) )
+    {
+      while ( (linelen = getline (&line, &linesize, fp)) > 0 )
+	{
+	  if ( line[0] == '#' && line[linelen - 1] == '\n' )
+	    continue;
+
+	  /* Lines without a newline were cut short */
+	  if ( line[linelen - 1] != '\n' || ! (entry = parseline (line)) )
+	    {
+	      mf->stale++;
+	      continue;
+	    }
+
+	  if ( table_put (&mf->converted, entry) )
+	    mf->stale++;
+	}
+
+      if ( line )
+	free (line);
+
+      if ( ferror (fp) )
+	{
+	  errsave = errno;
+	  fclose (fp);
+	  mf_close (mf);
+	  errno = errsave;
+	  return NULL;
+	}
+
+      fclose (fp);
+    }
+  else if ( errno != ENOENT )
+    {
+      errsave = errno;
+      mf_close (mf);
+      errno = errsave;
+      return NULL;
+    }
+
+  mf->loaded = mf->converted.count;
+
+  if ( mf->stale > 0 )
+    {
+      if ( compact (mf) )
+	{
+	  errsave = errno;
+	  mf_close (mf);
+	  errno = errsave;
+	  return NULL;
+	}
+
+      return mf;
+    }
+
+  if ( (mf->journal = open (path, O_WRONLY | O_APPEND | O_CREAT, 0666)) < 0 ||
+       fstat (mf->journal, &st) ||
+       ( st.st_size == 0 && writeall (mf->journal, MF_HEADER, strlen (MF_HEADER)) ) )
+    {
+      errsave = errno;
+      mf_close (mf);
+      errno = errsave;
+      return NULL;
+    }
+
+  return mf;
+}  /* End of mf_open() */
+
+
+/***************************************************************************
+ * mf_lookup:
+ *
+ * Returns the entry of a converted input file, or NULL if the file is
+ * not in the manifest
+ ***************************************************************************/
+ManifestEntry *
+mf_lookup (Manifest *mf, const char *path)
+{
+  return table_find (&mf->converted, path);
+}  /* End of mf_lookup() */
+
+
+/***************************************************************************
+ * mf_unchanged:
+ *
+ * Check if an input file is unchanged since the conversion recorded by
+ * an entry: the size, modification time and hash must match and all
+ * output files must still exist.  The file is only hashed if its size
+ * and modification time match.
+ *
+ * Returns 1 if the file is unchanged, and 0 otherwise
+ ***************************************************************************/
+int
+mf_unchanged (ManifestEntry *entry)
+{
+  ManifestEntry current;
+  struct stat st;
+  int idx;
+
+  if ( statfile (entry->path, &current, 0) ||
+       current.size != entry->size || current.mtime != entry->mtime )
+    return 0;
+
+  if ( statfile (entry->path, &current, 1) || current.hash != entry->hash )
+    return 0;
+
+  for ( idx = 0; idx < entry->noutputs; idx++ )
+    if ( stat (entry->outputs[idx], &st) )
+      return 0;
+
+  return 1;
+}  /* End of mf_unchanged() */
+
+
+/***************************************************************************
+ * mf_prepare:
+ *
+ * Record the current size, modification time and hash of an input
+ * file that will be converted, before it is read.  Until the file is
+ * committed its pending entry lists the outputs of its previous
+ * conversion, if any, which may be overwritten.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+int
+mf_prepare (Manifest *mf, const char *path)
+{
+  ManifestEntry *entry;
+  ManifestEntry *previous;
+
+  if ( ! (entry = (ManifestEntry *) calloc (1, sizeof(ManifestEntry))) )
+    return -1;
+
+  if ( ! (entry->path = strdup (path)) ||
+       statfile (path, entry, 1) )
+    {
+      freeentry (entry);
+      return -1;
+    }
+
+  if ( (previous = table_find (&mf->converted, path)) &&
+       setoutputs (entry, previous->outputs, previous->noutputs) )
+    {
+      freeentry (entry);
+      return -1;
+    }
+
+  if ( table_put (&mf->pending, entry) < 0 )
+    {
+      freeentry (entry);
+      return -1;
+    }
+
+  return 0;
+}  /* End of mf_prepare() */
+
+
+/***************************************************************************
+ * mf_overlaps:
+ *
+ * Check if any output of an entry is also an output of a file being
+ * converted, which would overwrite it.
+ *
+ * Returns 1 if an output is shared, and 0 otherwise
+ ***************************************************************************/
+int
+mf_overlaps (Manifest *mf, ManifestEntry *entry)
+{
+  ManifestEntry *pending;
+  int pidx;
+  int idx;
+
+  for ( pidx = 0; pidx < mf->pending.count; pidx++ )
+    {
+      pending = mf->pending.entries[pidx];
+
+      for ( idx = 0; idx < entry->noutputs; idx++ )
+	if ( hasoutput (pending, entry->outputs[idx]) )
+	  return 1;
+    }
+
+  return 0;
+}  /* End of mf_overlaps() */
+
+
+/***************************************************************************
+ * mf_complete:
+ *
+ * Set the number of records and samples packed from an input file
+ * prepared with mf_prepare() and the output files written, ready to
+ * be committed.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+int
+mf_complete (Manifest *mf, const char *path, int64_t records, int64_t samples,
+	     char **outputs, int noutputs)
+{
+  ManifestEntry *pending;
+
+  if ( ! (pending = table_find (&mf->pending, path)) )
+    return -1;
+
+  if ( setoutputs (pending, outputs, noutputs) )
+    return -1;
+
+  pending->records = records;
+  pending->samples = samples;
+
+  return 0;
+}  /* End of mf_complete() */
+
+
+/***************************************************************************
+ * mf_commit:
+ *
+ * Record the conversion of an input file completed with mf_complete(),
+ * appending its entry to the manifest.  This should only be called
+ * once all output files of the input file have been written and
+ * closed.  Files with tabs or newlines in their names cannot be
+ * recorded and are skipped.
+ *
+ * Files loaded from the manifest that were not converted again but
+ * share an output file with the entry have had that output
+ * overwritten, they are recorded with an invalid size so that they are
+ * converted by the next run.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+int
+mf_commit (Manifest *mf, const char *path)
+{
+  ManifestEntry *pending;
+  ManifestEntry *entry;
+  ManifestEntry *other;
+  int oidx;
+  int idx;
+
+  if ( ! (pending = table_find (&mf->pending, path)) )
+    return -1;
+
+  if ( strpbrk (path, "\t\n") )
+    return 0;
+  for ( idx = 0; idx < pending->noutputs; idx++ )
+    if ( strpbrk (pending->outputs[idx], "\t\n") )
+      return 0;
+
+  for ( idx = 0; idx < mf->loaded; idx++ )
+    {
+      other = mf->converted.entries[idx];
+
+      if ( other->size < 0 || table_find (&mf->pending, other->path) )
+	continue;
+
+      for ( oidx = 0; oidx < other->noutputs; oidx++ )
+	if ( hasoutput (pending, other->outputs[oidx]) )
+	  break;
+
+      if ( oidx < other->noutputs )
+	{
+	  other->size = -1;
+
+	  if ( writeentry (mf->journal, other) )
+	    return -1;
+
+	  mf->stale++;
+	}
+    }
+
+  if ( ! (entry = dupentry (pending)) )
+    return -1;
+
+  if ( writeentry (mf->journal, entry) )
+    {
+      freeentry (entry);
+      return -1;
+    }
+
+  switch ( table_put (&mf->converted, entry) )
+    {
+    case 1:
+      mf->stale++;
+      break;
+    case -1:
+      freeentry (entry);
+      return -1;
+    }
+
+  return 0;
+}  /* End of mf_commit() */
+
+
+/***************************************************************************
+ * mf_close:
+ *
+ * Compact the manifest if entries were superseded, close it and free
+ * it.
+ *
+ * Returns 0 on success, and -1 if the manifest could not be written.
+ ***************************************************************************/
+int
+mf_close (Manifest *mf)
+{
+  int retval = 0;
+
+  if ( ! mf )
+    return 0;
+
+  if ( mf->journal >= 0 && mf->stale > 0 && compact (mf) )
+    retval = -1;
+
+  if ( mf->journal >= 0 && close (mf->journal) )
+    retval = -1;
+
+  table_free (&mf->converted);
+  table_free (&mf->pending);
+  free (mf->path);
+  free (mf);
+
+  return retval;
+}  /* End of mf_close() */
+
+
+/***************************************************************************
+ * fnvhash:
+ *
+ * Returns the 64-bit FNV-1a hash of data, continuing from hash
+ ***************************************************************************/
+static uint64_t
+fnvhash (uint64_t hash, const unsigned char *data, size_t length)
+{
+  size_t idx;
+
+  for ( idx = 0; idx < length; idx++ )
+    {
+      hash ^= data[idx];
+      hash *= FNV_PRIME;
+    }
+
+  return hash;
+}  /* End of fnvhash() */
+
+
+/***************************************************************************
+ * statfile:
+ *
+ * Determine the size and modification time of a file and, if hash is
+ * set, the hash of its first and last MF_HASHLEN bytes.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+statfile (const char *path, ManifestEntry *entry, int hash)
+{
+  unsigned char *buffer;
+  struct stat st;
+  off_t offset;
+  ssize_t nread;
+  size_t length;
+  int retval = 0;
+  int pass;
+  int fd;
+
+  if ( (fd = open (path, O_RDONLY)) < 0 )
+    return -1;
+
+  if ( fstat (fd, &st) )
+    {
+      close (fd);
+      return -1;
+    }
+
+  entry->size = st.st_size;
+  entry->mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  entry->hash = FNV_OFFSET;
+
+  if ( ! hash )
+    {
+      close (fd);
+      return 0;
+    }
+
+  if ( ! (buffer = (unsigned char *) malloc (MF_HASHLEN)) )
+    {
+      close (fd);
+      return -1;
+    }
+
+  /* Hash the head, and the tail not already hashed */
+  for ( pass = 0; pass < 2 && retval == 0; pass++ )
+    {
+      if ( pass == 0 )
+	{
+	  offset = 0;
+	  length = ( st.st_size < MF_HASHLEN ) ? (size_t) st.st_size : MF_HASHLEN;
+	}
+      else
+	{
+	  if ( st.st_size <= MF_HASHLEN )
+	    break;
+
+	  offset = ( st.st_size - MF_HASHLEN > MF_HASHLEN ) ? st.st_size - MF_HASHLEN : MF_HASHLEN;
+	  length = (size_t) (st.st_size - offset);
+	}
+
+      while ( length > 0 )
+	{
+	  if ( (nread = pread (fd, buffer, length, offset)) <= 0 )
+	    {
+	      if ( nread < 0 && errno == EINTR )
+		continue;
+
+	      retval = -1;
+	      break;
+	    }
+
+	  entry->hash = fnvhash (entry->hash, buffer, (size_t) nread);
+	  offset += nread;
+	  length -= nread;
+	}
+    }
+
+  free (buffer);
+  close (fd);
+
+  return retval;
+}  /* End of statfile() */
+
+
+/***************************************************************************
+ * hasoutput:
+ *
+ * Returns 1 if output is one of the output files of an entry, and 0
+ * otherwise
+ ***************************************************************************/
+static int
+hasoutput (ManifestEntry *entry, const char *output)
+{
+  int idx;
+
+  for ( idx = 0; idx < entry->noutputs; idx++ )
+    if ( ! strcmp (entry->outputs[idx], output) )
+      return 1;
+
+  return 0;
+}  /* End of hasoutput() */
+
+
+/***************************************************************************
+ * table_find:
+ *
+ * Returns the entry of a file in a table, or NULL if not found
+ ***************************************************************************/
+static ManifestEntry *
+table_find (ManifestTable *table, const char *path)
+{
+  int slot;
+
+  if ( table->nslots == 0 )
+    return NULL;
+
+  slot = (int) (fnvhash (FNV_OFFSET, (const unsigned char *) path, strlen (path)) &
+		(uint64_t) (table->nslots - 1));
+
+  while ( table->slots[slot] )
+    {
+      if ( ! strcmp (table->entries[table->slots[slot] - 1]->path, path) )
+	return table->entries[table->slots[slot] - 1];
+
+      slot = (slot + 1) & (table->nslots - 1);
+    }
+
+  return NULL;
+}  /* End of table_find() */
+
+
+/***************************************************************************
+ * table_put:
+ *
+ * Add an entry to a table, replacing and freeing an entry for the same
+ * file.
+ *
+ * Returns 0 if added, 1 if an entry was replaced and -1 on failure
+ ***************************************************************************/
+static int
+table_put (ManifestTable *table, ManifestEntry *entry)
+{
+  ManifestEntry **entries;
+  int slot = 0;
+  int idx;
+
+  if ( table->nslots > 0 )
+    {
+      slot = (int) (fnvhash (FNV_OFFSET, (const unsigned char *) entry->path,
+			     strlen (entry->path)) & (uint64_t) (table->nslots - 1));
+
+      while ( table->slots[slot] )
+	{
+	  idx = table->slots[slot] - 1;
+
+	  if ( ! strcmp (table->entries[idx]->path, entry->path) )
+	    {
+	      freeentry (table->entries[idx]);
+	      table->entries[idx] = entry;
+	      return 1;
+	    }
+
+	  slot = (slot + 1) & (table->nslots - 1);
+	}
+    }
+
+  if ( table->count >= table->maxcount )
+    {
+      if ( ! (entries = (ManifestEntry **) realloc (table->entries, sizeof(ManifestEntry *) *
+						     ((table->maxcount) ? table->maxcount * 2 : 64))) )
+	return -1;
+
+      table->entries = entries;
+      table->maxcount = (table->maxcount) ? table->maxcount * 2 : 64;
+    }
+
+  table->entries[table->count++] = entry;
+
+  /* Keep the slots at most half full */
+  if ( table->count * 2 > table->nslots )
+    {
+      if ( table_index (table, (table->nslots) ? table->nslots * 2 : 128) )
+	{
+	  table->count--;
+	  return -1;
+	}
+    }
+  else
+    {
+      table->slots[slot] = table->count;
+    }
+
+  return 0;
+}  /* End of table_put() */
+
+
+/***************************************************************************
+ * table_index:
+ *
+ * Rebuild the hash slots of a table with nslots slots, a power of 2.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+table_index (ManifestTable *table, int nslots)
+{
+  int *slots;
+  int slot;
+  int idx;
+
+  if ( ! (slots = (int *) calloc (nslots, sizeof(int))) )
+    return -1;
+
+  for ( idx = 0; idx < table->count; idx++ )
+    {
+      slot = (int) (fnvhash (FNV_OFFSET, (const unsigned char *) table->entries[idx]->path,
+			     strlen (table->entries[idx]->path)) & (uint64_t) (nslots - 1));
+
+      while ( slots[slot] )
+	slot = (slot + 1) & (nslots - 1);
+
+      slots[slot] = idx + 1;
+    }
+
+  if ( table->slots )
+    free (table->slots);
+
+  table->slots = slots;
+  table->nslots = nslots;
+
+  return 0;
+}  /* End of table_index() */
+
+
+/***************************************************************************
+ * table_free:
+ *
+ * Free all entries of a table.
+ ***************************************************************************/
+static void
+table_free (ManifestTable *table)
+{
+  int idx;
+
+  for ( idx = 0; idx < table->count; idx++ )
+    freeentry (table->entries[idx]);
+
+  if ( table->entries )
+    free (table->entries);
+  if ( table->slots )
+    free (table->slots);
+
+  memset (table, 0, sizeof(ManifestTable));
+}  /* End of table_free() */
+
+
+/***************************************************************************
+ * dupentry:
+ *
+ * Returns a copy of an entry, or NULL on failure
+ ***************************************************************************/
+static ManifestEntry *
+dupentry (ManifestEntry *entry)
+{
+  ManifestEntry *dup;
+
+  if ( ! (dup = (ManifestEntry *) malloc (sizeof(ManifestEntry))) )
+    return NULL;
+
+  *dup = *entry;
+  dup->noutputs = 0;
+  dup->outputs = 0;
+
+  if ( ! (dup->path = strdup (entry->path)) ||
+       setoutputs (dup, entry->outputs, entry->noutputs) )
+    {
+      freeentry (dup);
+      return NULL;
+    }
+
+  return dup;
+}  /* End of dupentry() */
+
+
+/***************************************************************************
+ * setoutputs:
+ *
+ * Replace the output files of an entry with copies of outputs.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+setoutputs (ManifestEntry *entry, char **outputs, int noutputs)
+{
+  char **copies = 0;
+  int idx;
+
+  if ( noutputs > 0 )
+    {
+      if ( ! (copies = (char **) calloc (noutputs, sizeof(char *))) )
+	return -1;
+
+      for ( idx = 0; idx < noutputs; idx++ )
+	{
+	  if ( ! (copies[idx] = strdup (outputs[idx])) )
+	    {
+	      while ( idx-- > 0 )
+		free (copies[idx]);
+	      free (copies);
+	      return -1;
+	    }
+	}
+    }
+
+  for ( idx = 0; idx < entry->noutputs; idx++ )
+    free (entry->outputs[idx]);
+  if ( entry->outputs )
+    free (entry->outputs);
+
+  entry->outputs = copies;
+  entry->noutputs = noutputs;
+
+  return 0;
+}  /* End of setoutputs() */
+
+
+/***************************************************************************
+ * freeentry:
+ *
+ * Free an entry and its strings.
+ ***************************************************************************/
+static void
+freeentry (ManifestEntry *entry)
+{
+  int idx;
+
+  for ( idx = 0; idx < entry->noutputs; idx++ )
+    free (entry->outputs[idx]);
+  if ( entry->outputs )
+    free (entry->outputs);
+  if ( entry->path )
+    free (entry->path);
+
+  free (entry);
+}  /* End of freeentry() */
+
+
+/***************************************************************************
+ * parseline:
+ *
+ * Parse an entry from a manifest line, which is modified.
+ *
+ * Returns a new entry on success, and NULL if the line is not usable
+ ***************************************************************************/
+static ManifestEntry *
+parseline (char *line)
+{
+  ManifestEntry *entry;
+  char *fields[7];
+  char *field;
+  char *next;
+  char *end;
+  int nfields;
+  int idx;
+
+  line[strlen (line) - 1] = '\0';
+
+  /* Fixed fields up to and including the input file */
+  field = line;
+  for ( nfields = 0; nfields < 7 && field; nfields++ )
+    {
+      fields[nfields] = field;
+
+      if ( (next = strchr (field, '\t')) )
+	*next++ = '\0';
+      field = next;
+    }
+
+  if ( nfields < 7 || ! *fields[6] )
+    return NULL;
+
+  if ( ! (entry = (ManifestEntry *) calloc (1, sizeof(ManifestEntry))) )
+    return NULL;
+
+  errno = 0;
+  entry->size = strtoll (fields[0], &end, 10);
+  if ( *end ) errno = EINVAL;
+  entry->mtime = strtoll (fields[1], &end, 10);
+  if ( *end ) errno = EINVAL;
+  entry->hash = strtoull (fields[2], &end, 16);
+  if ( *end ) errno = EINVAL;
+  entry->records = strtoll (fields[3], &end, 10);
+  if ( *end ) errno = EINVAL;
+  entry->samples = strtoll (fields[4], &end, 10);
+  if ( *end ) errno = EINVAL;
+  entry->noutputs = (int) strtol (fields[5], &end, 10);
+  if ( *end || entry->noutputs < 0 ) errno = EINVAL;
+
+  if ( errno || ! (entry->path = strdup (fields[6])) ||
+       ( entry->noutputs > 0 &&
+	 ! (entry->outputs = (char **) calloc (entry->noutputs, sizeof(char *))) ) )
+    {
+      entry->noutputs = 0;
+      freeentry (entry);
+      return NULL;
+    }
+
+  for ( idx = 0; idx < entry->noutputs; idx++ )
+    {
+      if ( ! field || ! *field )
+	break;
+
+      if ( (next = strchr (field, '\t')) )
+	*next++ = '\0';
+
+      if ( ! (entry->outputs[idx] = strdup (field)) )
+	break;
+
+      field = next;
+    }
+
+  /* The number of outputs must match */
+  if ( idx < entry->noutputs || field )
+    {
+      entry->noutputs = idx;
+      freeentry (entry);
+      return NULL;
+    }
+
+  return entry;
+}  /* End of parseline() */
+
+
+/***************************************************************************
+ * writeentry:
+ *
+ * Write an entry as a single line with a single write.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+writeentry (int fd, ManifestEntry *entry)
+{
+  char fixed[160];
+  char *line;
+  size_t length;
+  int retval;
+  int idx;
+
+  snprintf (fixed, sizeof(fixed), "%" PRId64 "\t%" PRId64 "\t%016" PRIx64 "\t%"
+	    PRId64 "\t%" PRId64 "\t%d\t", entry->size, entry->mtime, entry->hash,
+	    entry->records, entry->samples, entry->noutputs);
+
+  length = strlen (fixed) + strlen (entry->path) + 1;
+  for ( idx = 0; idx < entry->noutputs; idx++ )
+    length += strlen (entry->outputs[idx]) + 1;
+
+  if ( ! (line = (char *) malloc (length + 1)) )
+    return -1;
+
+  strcpy (line, fixed);
+  strcat (line, entry->path);
+  for ( idx = 0; idx < entry->noutputs; idx++ )
+    {
+      strcat (line, "\t");
+      strcat (line, entry->outputs[idx]);
+    }
+  strcat (line, "\n");
+
+  retval = writeall (fd, line, length);
+  free (line);
+
+  return retval;
+}  /* End of writeentry() */
+
+
+/***************************************************************************
+ * writeall:
+ *
+ * Write all length bytes of data, continuing after partial writes.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+writeall (int fd, const char *data, size_t length)
+{
+  ssize_t written;
+
+  while ( length > 0 )
+    {
+      if ( (written = write (fd, data, length)) < 0 )
+	{
+	  if ( errno == EINTR )
+	    continue;
+	  return -1;
+	}
+
+      data += written;
+      length -= written;
+    }
+
+  return 0;
+}  /* End of writeall() */
+
+
+/***************************************************************************
+ * compact:
+ *
+ * Rewrite the manifest with only the current entries.  The entries are
+ * written and synced to a temporary file which is then renamed over
+ * the manifest, and the manifest is reopened for appending.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+compact (Manifest *mf)
+{
+  char *tmppath;
+  int retval = 0;
+  int errsave;
+  int fd;
+  int idx;
+
+  if ( ! (tmppath = (char *) malloc (strlen (mf->path) + 5)) )
+    return -1;
+
+  sprintf (tmppath, "%s.tmp", mf->path);
+
+  if ( (fd = open (tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0 )
+    {
+      free (tmppath);
+      return -1;
+    }
+
+  if ( writeall (fd, MF_HEADER, strlen (MF_HEADER)) )
+    retval = -1;
+
+  for ( idx = 0; idx < mf->converted.count && retval == 0; idx++ )
+    if ( writeentry (fd, mf->converted.entries[idx]) )
+      retval = -1;
+
+  if ( retval == 0 && fsync (fd) )
+    retval = -1;
+
+  errsave = errno;
+  if ( close (fd) && retval == 0 )
+    {
+      errsave = errno;
+      retval = -1;
+    }
+
+  if ( retval == 0 && rename (tmppath, mf->path) )
+    {
+      errsave = errno;
+      retval = -1;
+    }
+
+  if ( retval )
+    {
+      unlink (tmppath);
+      free (tmppath);
+      errno = errsave;
+      return -1;
+    }
+
+  free (tmppath);
+
+  if ( mf->journal >= 0 )
+    close (mf->journal);
+
+  if ( (mf->journal = open (mf->path, O_WRONLY | O_APPEND)) < 0 )
+    return -1;
+
+  mf->stale = 0;
+
+  return 0;
+}  /* End of compact() */
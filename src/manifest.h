@@ -0,0 +1,58 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* Bytes hashed at the start and at the end of an input file */
+#define MF_HASHLEN 65536
+
+/* State of an input file and the output produced from it */
+typedef struct ManifestEntry_s {
+  char *path;                  /* Input file as given */
+  int64_t size;
+  int64_t mtime;               /* Modification time in nanoseconds */
+  uint64_t hash;               /* FNV-1a hash of the head and tail */
+  int64_t records;             /* Records packed from the file */
+  int64_t samples;             /* Samples packed from the file */
+  int noutputs;
+  char **outputs;              /* Output files written for the file */
+} ManifestEntry;
+
+/* Entries indexed by input file */
+typedef struct ManifestTable_s {
+  ManifestEntry **entries;
+  int count;
+  int maxcount;
+  int *slots;                  /* Hash slots, entry index + 1 or 0 if empty */
+  int nslots;
+} ManifestTable;
+
+/* A manifest of converted files, kept in an append-only journal */
+typedef struct Manifest_s {
+  char *path;
+  int journal;                 /* Journal descriptor opened for appending */
+  ManifestTable converted;     /* Entries of converted files */
+  ManifestTable pending;       /* Entries of files being converted */
+  int loaded;                  /* Entries loaded from the journal */
+  int stale;                   /* Journal lines superseded or unusable */
+} Manifest;
+
+Manifest *mf_open (const char *path);
+ManifestEntry *mf_lookup (Manifest *mf, const char *path);
+int mf_unchanged (ManifestEntry *entry);
+int mf_prepare (Manifest *mf, const char *path);
+int mf_overlaps (Manifest *mf, ManifestEntry *entry);
+int mf_complete (Manifest *mf, const char *path, int64_t records,
+		 int64_t samples, char **outputs, int noutputs);
+int mf_commit (Manifest *mf, const char *path);
+int mf_close (Manifest *mf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MANIFEST_H */
@@ -13,27 +13,299 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <libmseed.h>
 
 #include "readNIMSbin.h"
+#include "readNIMSraw.h"
+#include "scankern.h"
+#include "recwriter.h"
+#include "manifest.h"
+#include "archive.h"
+#include "append.h"
+#include "inventory.h"
 
-#define VERSION "1.1"
+#define VERSION "1.2"
 #define PACKAGE "mt2mseed"
 
+/* Size of huge pages for buffers of a conversion context */
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/* Scans of a chunk when streaming data records too long for a single
+ * Fortran record without -k */
+#define STREAM_SCANS 1048576
+
+/* Methods to locate missing data */
+#define GAPS_TABLE  0          /* Header gap table, scanning if unusable */
+#define GAPS_VERIFY 1          /* Header gap table verified by scanning */
+#define GAPS_SCAN   2          /* Scanning for missing data values */
+
+/* SEED codes given for an input file, NULL codes use the defaults */
+struct srccodes {
+  char *network;
+  char *station;
+  char *location;
+};
+
 struct listnode {
   char *key;
   char *data;
+  struct srccodes *codes;      /* Codes of a list file entry, if any */
   struct listnode *next;
 };
 
-static int packmsr (MSRecord *msr);
-static int binconvert (char *binfile);
+/* Packed records for a single channel segment, buffered in memory
+ * until they can be written in input file order */
+struct segbuf {
+  char network[11];
+  char station[11];
+  char location[11];
+  char channel[11];
+  hptime_t starttime;
+  char *records;
+  size_t recsize;
+  size_t maxrecsize;
+  struct segbuf *next;
+};
+
+/* Counters and seconds spent in each stage of a conversion, summed
+ * over threads when channels are packed concurrently */
+struct convstats {
+  int64_t files;
+  int64_t failed;              /* Files not converted completely */
+  int64_t databytes;           /* Bytes of input data records */
+  int64_t scans;
+  int64_t missing;             /* Missing samples */
+  int64_t segments;            /* Channel segments packed */
+  int64_t gaps;                /* Gaps between segments of each channel */
+  int64_t packedsamples;
+  int64_t packedrecords;
+  int64_t outbytes;            /* Bytes of packed records */
+  double header;               /* Header parsing */
+  double read;                 /* Reading the data record */
+  double swap;                 /* Byte swapping, if not done by de-interleaving */
+  double split;                /* De-interleaving and locating missing data */
+  double pack;                 /* Packing records with msr_pack() */
+  double write;                /* Writing records to output files */
+};
+
+/* Conversion state for a single input file */
+struct convjob {
+  char *binfile;
+  struct srccodes *codes;      /* SEED codes of the file, if not defaults */
+  flag buffered;               /* Buffer output segments instead of writing */
+  flag discard;                /* Discard packed records, only count them */
+  struct segbuf *segs;
+  struct segbuf *lastseg;
+  struct convstats stats;
+  char **outputs;              /* Output files written for the file */
+  int noutputs;
+};
+
+/* Output of a channel segment that is packed incrementally */
+struct segout {
+  RecWriter *ofp;              /* Output file when writing directly */
+  struct segbuf *seg;          /* Output segment when buffered */
+  struct convjob *job;         /* Job of the segment, for write times */
+  AppendChannel *append;       /* Channel of the segment when appending */
+  flag replace;                /* First record replaces the last of the channel */
+};
+
+/* Incremental packing state of a single channel when streaming */
+struct chanstream {
+  MSRecord *msr;
+  int32_t *samples;            /* Samples not yet packed */
+  int numsamples;
+  int maxsamples;
+  int segstartidx;             /* Scan index of the segment start */
+  hptime_t segstarttime;
+  int64_t segpacked;           /* Samples of the segment already packed */
+  int segments;                /* Number of segments started */
+  hptime_t segdayend;          /* End of the day of the segment */
+  flag daysplit;               /* Segment continues at a day boundary */
+  struct segout so;
+};
+
+/* An open input bin file, read with stdio or in memory */
+struct bininput {
+  FILE *ifp;
+  char *map;                   /* Complete file in memory, if not NULL */
+  size_t maplen;
+  flag mapped;                 /* File is memory mapped, not allocated */
+  const int32_t *scans;        /* First data scan in the mapped file */
+  int32_t *decoded;            /* Scans decoded from a raw NIMS file */
+};
+
+/* Input data of a single bin file, shared by the channel packers */
+struct bindata {
+  char *binfile;
+  int32_t *chans[SCAN_MAXCHANNELS]; /* Contiguous samples of each channel */
+  int nchannels;               /* Number of channels in each scan */
+  uint8_t *gapmask;            /* Missing sample flags of each scan */
+  int missing;                 /* Number of missing samples */
+  flag usetable;               /* Segment data using the header gap table */
+  ScanRun *tabruns;            /* Runs of all channels if using the table */
+  int ntabruns;
+  int nscans;
+  int missingdataflag;
+  flag swapflag;               /* Scans are in the byte order of the file */
+  hptime_t starttime;
+};
+
+/* A reusable buffer of a conversion context, it only grows */
+struct ctxbuf {
+  void *data;
+  size_t size;
+  flag mapped;                 /* Anonymous mapping, not allocated */
+};
+
+/* Buffers and template MSRecord reused for all files converted by a
+ * thread, avoiding allocation and page faults on fresh memory for
+ * each file */
+struct convctx {
+  struct ctxbuf idata;         /* Interleaved scans read from the file */
+  struct ctxbuf chandata;      /* Contiguous samples of each channel */
+  struct ctxbuf gapmask;       /* Missing sample flags of each scan */
+  ScanRun *tabruns;            /* Runs of valid scans from the gap table */
+  int maxtabruns;
+  MSRecord *template;          /* Template record, reset for each file */
+};
+
+/* State for packing a single channel in its own thread */
+struct chanpack {
+  pthread_t thread;
+  flag started;
+  struct bindata *bd;
+  int channel;
+  char *chan;
+  MSRecord *msr;
+  struct convjob job;          /* Channel output segments and counts */
+  int retval;
+};
+
+/* Shared state for the worker pool converting files concurrently */
+struct workpool {
+  pthread_mutex_t lock;
+  pthread_cond_t committed;
+  struct listnode *nextfile;   /* Next input file to be converted */
+  int nextindex;               /* List index of next input file */
+  int commitindex;             /* List index of next file to write output */
+};
+
+/* Bounded queue between two stages of the conversion pipeline */
+struct stagequeue {
+  pthread_mutex_t lock;
+  pthread_cond_t notempty;
+  pthread_cond_t notfull;
+  void **items;
+  int size;                    /* Maximum number of queued items */
+  int head;
+  int count;
+  flag closed;                 /* No more items will be added */
+  int maxdepth;                /* Maximum number of queued items seen */
+  int64_t puts;
+  int64_t depthsum;            /* Sum of queue depths seen by puts */
+  double putstall;             /* Seconds producer waited for space */
+  double getstall;             /* Seconds consumer waited for items */
+};
+
+/* An input file passing through the conversion pipeline */
+struct pipeitem {
+  char *binfile;
+  struct bininput in;
+  int status;                  /* Result of loading the file */
+  struct convjob job;
+};
+
+/* Queues connecting the stages of the conversion pipeline */
+struct pipeline {
+  struct stagequeue readq;     /* Loaded files from reader to encoder */
+  struct stagequeue writeq;    /* Packed files from encoder to writer */
+};
+
+static int packmsr (MSRecord *msr, struct convjob *job, struct segout *so,
+		    flag flush);
+static RecWriter *openoutput (struct convjob *job, char *net, char *sta,
+			      char *loc, char *chan, hptime_t starttime);
+static int releaseoutput (RecWriter *ofp, struct convstats *stats);
+static int addoutput (struct convjob *job, const char *ofname);
+static void freeoutputs (struct convjob *job);
+static int closeoutput (RecWriter *ofp, struct convstats *stats);
+static int writesegs (struct convjob *job);
+static void freesegs (struct convjob *job);
+static int binconvert (char *binfile, struct convjob *job,
+		       struct bininput *loaded, struct convctx *ctx);
+static void *ctx_reserve (struct ctxbuf *buf, size_t size);
+static MSRecord *ctx_template (struct convctx *ctx, struct srccodes *codes,
+			      double samprate);
+static void ctx_free (struct convctx *ctx);
+static int openinput (char *binfile, NIMSheader *hdr, struct bininput *in,
+		      struct convstats *stats);
+static int openstdio (char *binfile, NIMSheader *hdr, struct bininput *in,
+		      struct convstats *stats);
+static int loadinput (char *binfile, struct bininput *in);
+static void closeinput (struct bininput *in);
+static int readscans (struct bininput *in, NIMSheader *hdr, int32_t *scans,
+		      int nscans, struct convstats *stats);
+static int streamchannels (struct bininput *in, NIMSheader *hdr, struct bindata *bd,
+			   char chans[][6], int nchannels, MSRecord *template,
+			   struct convjob *job, struct convctx *ctx);
+static int packstream (struct bindata *bd, struct chanstream *cs,
+		       struct convjob *job, flag flush);
+static int splitscans (struct bindata *bd, NIMSheader *hdr,
+		       const int32_t *scans, int startscan, int nscans,
+		       ScanRun **tabruns, int *maxtabruns);
+static int tableruns (NIMSheader *hdr, int startscan, int nscans,
+		      ScanRun **runs, int *maxruns);
+static int checkruns (struct bindata *bd, int nscans, int nchannels,
+		      ScanRun *runs, int nruns);
+static int dayscans (struct bindata *bd, double samprate, int startscan,
+		     int count);
+static int packchannel (struct bindata *bd, int channel, char *chan,
+			MSRecord *msr, struct convjob *job);
+static int packappend (struct bindata *bd, int channel, int scanidx,
+		       int count, MSRecord *msr, struct convjob *job);
+static int packchannels (struct bindata *bd, char chans[][6], int nchannels,
+			 MSRecord *template, struct convjob *job);
+static void *chanworker (void *arg);
+static int convertpool (int nworkers);
+static void *poolworker (void *arg);
+static int convertpipeline (int depth);
+static void *pipereader (void *arg);
+static void *pipewriter (void *arg);
+static int queue_init (struct stagequeue *q, int size);
+static void queue_put (struct stagequeue *q, void *item);
+static void *queue_get (struct stagequeue *q);
+static void queue_close (struct stagequeue *q);
+static void queue_report (struct stagequeue *q, const char *name,
+			  const char *producer, const char *consumer);
+static void queue_free (struct stagequeue *q);
+static double elapsedtime (struct timespec *start);
+static void addstats (struct convstats *total, struct convstats *stats);
+static void reportfile (struct convjob *job, int status);
+static int openstats (void);
+static int closestats (double elapsed);
+static int commitdeferred (flag commit);
+static int closemanifest (flag commit);
+static void printstats (struct convstats *stats);
+static void printjsonstring (const char *string);
 static int parameter_proc (int argcount, char **argvec);
 static char *getoptval (int argcount, char **argvec, int argopt);
+static int selectinputs (void);
 static int readlistfile (char *listfile);
-static void addnode (struct listnode **listroot, char *key, char *data);
+static struct srccodes *parsecodes (char *net, char *sta, char *loc);
+static void freecodes (struct srccodes *codes);
+static struct listnode *addnode (struct listnode **listroot, char *key, char *data);
+static int sweepconvert (void);
+static int inventoryscan (void);
 static void record_handler (char *record, int reclen, void *handlerdata);
+static void discard_handler (char *record, int reclen, void *handlerdata);
+static void segbuf_handler (char *record, int reclen, void *handlerdata);
 static void usage (void);
 
 static int   verbose     = 0;
@@ -41,46 +313,218 @@ static int   packreclen  = -1;
 static int   encoding    = 11;
 static int   byteorder   = -1;
 static int   chanfiles   = 0;
+static int   workers     = 1;
+static int   chanthreads = 0;
+static int   chunkscans  = 0;
+static int   mapinput    = 0;
+static int   hugepages   = 0;
+static int   pipedepth   = 0;
+static int   sweep       = 0;
+static int   inventory   = -1;
+static int   gapmode     = GAPS_TABLE;
+static char *chancodes[NIMS_MAXCHANNELS];
+static int   nchancodes  = 0;
 static char  srateblkt   = 0;
 static char *network     = "EM";
 static char *station     = 0;
 static char *location    = 0;
 static char *outfile     = 0;
-static FILE *outfp       = 0;
+static RecWriter *outfp  = 0;
+static int   stdoutfd    = -1;
+static char *archivedir  = 0;
+static int   maxopen     = AR_MAXOPEN;
+static Archive *archive  = 0;
+static int   appendmode  = 0;
+static AppendState *appendstate = 0;
+static size_t outbufsize = RW_BUFSIZE;
+static int   outflags    = 0;
+static char *statsfile   = 0;
+static FILE *statsfp     = 0;
+static char *manifestfile = 0;
+static Manifest *manifest = 0;
+static char  outfpname[1024];
+static char  outfpnet[11];
+static char  outfpsta[11];
+static char **deferred   = 0;
+static int   ndeferred   = 0;
+static int   maxdeferred = 0;
 
 /* A list of input files */
 struct listnode *filelist = 0;
 
-static int64_t packedsamples = 0;
-static int64_t packedrecords = 0;
+/* Statistics of all converted files */
+static struct convstats totals;
+
+static int64_t writtenbytes = 0;
+static int64_t writecalls = 0;
 
 int
 main (int argc, char **argv)
 {
   struct listnode *flp;
+  struct convjob job;
+  struct convctx ctx;
+  struct timespec start;
+  int status;
   
   /* Process given parameters (command line and parameter file) */
   if (parameter_proc (argc, argv) < 0)
     return -1;
   
-  /* Convert each input bin file */
-  flp = filelist;
-  while ( flp != 0 )
+  if ( sweep )
+    {
+      /* Convert input bin files with all record lengths and encodings */
+      return sweepconvert ();
+    }
+  
+  if ( inventory >= 0 )
+    {
+      /* Print a catalog of the headers of the input files */
+      return inventoryscan ();
+    }
+  
+  /* Write records to the original standard output and send all other
+   * output to stderr, including the messages of readNIMSbin and the
+   * log messages of libmseed */
+  if ( outfile && strcmp (outfile, "-") == 0 )
+    {
+      if ( isatty (STDOUT_FILENO) )
+	{
+	  fprintf (stderr, "Not writing Mini-SEED to a terminal, redirect standard output\n");
+	  return 1;
+	}
+      
+      fflush (stdout);
+      
+      if ( (stdoutfd = dup (STDOUT_FILENO)) < 0 ||
+	   dup2 (STDERR_FILENO, STDOUT_FILENO) < 0 )
+	{
+	  fprintf (stderr, "Error redirecting standard output: %s\n", strerror(errno));
+	  return 1;
+	}
+    }
+  
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  
+  if ( statsfile && openstats () )
+    return 1;
+  
+  /* Skip input files unchanged since recorded in the manifest */
+  if ( manifestfile && selectinputs () )
+    return 1;
+  
+  if ( archivedir &&
+       ! (archive = ar_init (archivedir, maxopen, outbufsize / maxopen, outflags)) )
     {
+      fprintf (stderr, "Error allocating memory\n");
+      return 1;
+    }
+  
+  /* Read the last record of each channel of the output file */
+  if ( appendmode )
+    {
+      if ( ! (appendstate = ap_init ()) ||
+	   ap_load (appendstate, outfile, verbose - 2) )
+	{
+	  fprintf (stderr, "Error reading output file to append to: %s\n", outfile);
+	  return 1;
+	}
+      
       if ( verbose )
-	fprintf (stderr, "Reading %s\n", flp->data);
+	fprintf (stderr, "Read %" PRId64 " records of %d channels from %s\n",
+		 appendstate->loaded, appendstate->count, outfile);
+    }
+  
+  if ( pipedepth > 0 )
+    {
+      /* Read, pack and write input bin files in a pipeline */
+      if ( convertpipeline (pipedepth) )
+	return 1;
+    }
+  else if ( workers > 1 )
+    {
+      /* Convert input bin files concurrently */
+      if ( convertpool (workers) )
+	return 1;
+    }
+  else
+    {
+      /* Convert each input bin file */
+      memset (&ctx, 0, sizeof(struct convctx));
+      
+      flp = filelist;
+      while ( flp != 0 )
+	{
+	  if ( verbose )
+	    fprintf (stderr, "Reading %s\n", flp->data);
+	  
+	  memset (&job, 0, sizeof(struct convjob));
+	  job.codes = flp->codes;
+	  status = binconvert (flp->data, &job, NULL, &ctx);
+	  
+	  reportfile (&job, status);
+	  
+	  flp = flp->next;
+	}
+      
+      ctx_free (&ctx);
+    }
+  
+  /* Close user specified output file, files written to it are only
+   * recorded in the manifest if it was written successfully */
+  status = 0;
+  if ( outfp && closeoutput (outfp, &totals) )
+    status = -1;
+  
+  if ( appendstate )
+    {
+      if ( verbose )
+	fprintf (stderr, "Rewrote %" PRId64 " records to continue channels\n",
+		 appendstate->continued);
+      
+      ap_free (appendstate);
+      appendstate = 0;
+    }
+  
+  /* Close the open archive files */
+  if ( archive )
+    {
+      if ( verbose )
+	fprintf (stderr, "Opened %" PRId64 " archive files, %" PRId64 " closed to open others\n",
+		 archive->opens, archive->evictions);
       
-      binconvert (flp->data);
+      if ( ar_closeall (archive) )
+	{
+	  fprintf (stderr, "Error writing archive files: %s\n", strerror(errno));
+	  status = -1;
+	}
       
-      flp = flp->next;
+      writtenbytes += archive->writtenbytes;
+      writecalls += archive->writecalls;
+      
+      ar_free (archive);
+      archive = 0;
     }
   
+  if ( manifest && closemanifest ( status == 0 ) )
+    return 1;
+  
   fprintf (stderr, "Packed %" PRId64 " samples into %" PRId64 " records\n",
-	   packedsamples, packedrecords);
+	   totals.packedsamples, totals.packedrecords);
+  
+  if ( verbose )
+    {
+      fprintf (stderr, "Wrote %" PRId64 " bytes with %" PRId64 " write calls\n",
+	       writtenbytes, writecalls);
+      fprintf (stderr, "Packed %" PRId64 " segments with %" PRId64 " gaps, %" PRId64 " samples missing\n",
+	       totals.segments, totals.gaps, totals.missing);
+      fprintf (stderr, "Stage seconds: header %.3f, read %.3f, swap %.3f, de-interleave %.3f, "
+	       "pack %.3f, write %.3f\n", totals.header, totals.read, totals.swap,
+	       totals.split, totals.pack, totals.write);
+    }
   
-  /* Close user specified output file */
-  if ( outfp )
-    fclose (outfp);
+  if ( statsfp && closestats (elapsedtime (&start)) )
+    return 1;
   
   return 0;
 }  /* End of main() */
@@ -94,160 +538,527 @@ main (int argc, char **argv)
  * written to it, otherwise filenames will be created for each channel
  * segment and will include the start time of the segment.
  *
+ * If the conversion job is buffered the records are collected in
+ * memory for the segment and written later by writesegs().
+ *
+ * A segment may be packed incrementally by passing the same segment
+ * output state (so) for each call, the output is set up by the first
+ * call and only complete records are packed until flush is set.  If
+ * so is NULL all samples are packed as a complete segment.
+ *
  * Returns 0 on success, and -1 on failure
  ***************************************************************************/
 static int
-packmsr (MSRecord *msr)
+packmsr (MSRecord *msr, struct convjob *job, struct segout *so, flag flush)
 {
-  FILE *ofp = 0;
-  char ofname[1024], timestr[20];
+  struct segout segout;
+  struct segbuf *seg = 0;
+  struct timespec start;
+  void (*handler) (char *, int, void *);
+  void *handlerdata;
   int64_t trpackedsamples = 0;
   int64_t trpackedrecords = 0;
+  double writetime;
+  
+  if ( ! so )
+    {
+      memset (&segout, 0, sizeof(struct segout));
+      so = &segout;
+      flush = 1;
+    }
+  
+  so->job = job;
+  
+  /* Set up output at the start of a segment */
+  if ( job->discard )
+    {
+      handler = &discard_handler;
+      handlerdata = NULL;
+    }
+  else if ( ! so->ofp && ! so->seg )
+    {
+      if ( job->buffered )
+	{
+	  /* Add a new segment buffer to the job */
+	  if ( ! (seg = (struct segbuf *) calloc (1, sizeof(struct segbuf))) )
+	    {
+	      fprintf (stderr, "Error allocating memory\n");
+	      return -1;
+	    }
+	  
+	  memcpy (seg->network, msr->network, sizeof(seg->network));
+	  memcpy (seg->station, msr->station, sizeof(seg->station));
+	  memcpy (seg->location, msr->location, sizeof(seg->location));
+	  memcpy (seg->channel, msr->channel, sizeof(seg->channel));
+	  seg->starttime = msr->starttime;
+	  
+	  if ( job->lastseg )
+	    job->lastseg->next = seg;
+	  else
+	    job->segs = seg;
+	  job->lastseg = seg;
+	  
+	  so->seg = seg;
+	}
+      else
+	{
+	  if ( ! (so->ofp = openoutput (job, msr->network, msr->station,
+					msr->location, msr->channel,
+					msr->starttime)) )
+	    return -1;
+	}
+    }
+  
+  if ( job->discard )
+    {
+      /* Records are only counted */
+    }
+  else if ( so->seg )
+    {
+      handler = &segbuf_handler;
+      handlerdata = so->seg;
+    }
+  else
+    {
+      handler = &record_handler;
+      handlerdata = so;
+    }
   
-  if ( outfile )
+  msr->reclen = packreclen;
+  msr->encoding = encoding;
+  msr->byteorder = byteorder;
+  
+  /* Pack output data, records written directly are timed as writing */
+  writetime = job->stats.write;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  trpackedrecords = msr_pack (msr, handler, handlerdata,
+			      &trpackedsamples, flush, verbose-2);
+  job->stats.pack += elapsedtime (&start) - (job->stats.write - writetime);
+  
+  if ( trpackedrecords < 0 )
+    {
+      fprintf (stderr, "Error packing data\n");
+      flush = 1;
+    }
+  else
+    {
+      job->stats.packedrecords += trpackedrecords;
+      job->stats.packedsamples += trpackedsamples;
+      job->stats.outbytes += trpackedrecords * msr->reclen;
+    }
+  
+  /* End of segment, close file only if not shared */
+  if ( flush )
+    {
+      if ( so->ofp )
+	releaseoutput (so->ofp, &job->stats);
+      
+      so->ofp = 0;
+      so->seg = 0;
+    }
+  
+  return ( trpackedrecords < 0 ) ? -1 : 0;
+}  /* End of packmsr() */
+
+
+/***************************************************************************
+ * openoutput:
+ *
+ * Open the output file for a channel segment.  If a single output
+ * file has been specified it will be opened and all output will be
+ * written to it.  When writing to an archive the day file of the
+ * segment is used, segments must not span days.  Otherwise a single
+ * file for all channels and segments is named from the first segment,
+ * or when separate channel files are requested a new file is named
+ * for each segment.
+ *
+ * The returned file should only be closed by the caller with
+ * releaseoutput().  The name of the file is added to the output files
+ * of the job.
+ *
+ * Returns a RecWriter on success, and 0 on failure
+ ***************************************************************************/
+static RecWriter *
+openoutput (struct convjob *job, char *net, char *sta, char *loc,
+	    char *chan, hptime_t starttime)
+{
+  RecWriter *ofp = 0;
+  char ofname[1024], timestr[20];
+  int status;
+  
+  if ( archive )
+    {
+      /* Find or open the day file in the archive */
+      if ( ! (ofp = ar_file (archive, net, sta, loc, chan, starttime,
+			     ofname, sizeof(ofname))) )
+	{
+	  fprintf (stderr, "Error opening archive file %s: %s\n",
+		   ofname, strerror(errno));
+	  return 0;
+	}
+    }
+  else if ( outfile )
     {
       /* Open user specified output file */
       if ( ! outfp )
 	{
-	  if ( ! (outfp = fopen (outfile, "w")) )
+	  if ( stdoutfd >= 0 )
+	    outfp = rw_fdopen (stdoutfd, outbufsize, outflags);
+	  else
+	    outfp = rw_open (outfile, outbufsize,
+			     ( appendstate ) ? outflags | RW_UPDATE : outflags);
+	  
+	  if ( ! outfp )
 	    {
 	      fprintf (stderr, "Error opening output file: %s\n",
 		       strerror(errno));
-	      return -1;
+	      return 0;
 	    }
+	  
+	  strncpy (outfpname, outfile, sizeof(outfpname) - 1);
 	}
       
       ofp = outfp;
     }
-  	else if (! chanfiles) {
+  else if ( ! chanfiles )
+    {
+      /* Start a new file when the network or station changes, with
+       * codes given for each file in list files */
+      if ( outfp && ( strcmp (outfpnet, net) || strcmp (outfpsta, sta) ) )
+	{
+	  status = closeoutput (outfp, &job->stats);
+	  outfp = 0;
+	  
+	  commitdeferred ( status == 0 );
+	}
+      
       /* Generate the output file name for all channels and segments
        * and open output file */
       if ( ! outfp )
-  	{
-      ms_hptime2isotimestr (msr->starttime, timestr, 0);
-
-      snprintf (ofname, sizeof(ofname), "%s.%s.%s",
-    		msr->network, msr->station, timestr);
-
-  	  if ( ! (outfp = fopen (ofname, "w")) )
-  	    {
-  	      fprintf (stderr, "Error opening output file: %s\n",
-  		       strerror(errno));
-  	      return -1;
-  	    }
-  	}
-        
-       ofp = outfp; 
-  	}
-  	else	  
+	{
+	  ms_hptime2isotimestr (starttime, timestr, 0);
+	  
+	  snprintf (ofname, sizeof(ofname), "%s.%s.%s",
+		    net, sta, timestr);
+	  
+	  if ( ! (outfp = rw_open (ofname, outbufsize, outflags)) )
+	    {
+	      fprintf (stderr, "Error opening output file: %s\n",
+		       strerror(errno));
+	      return 0;
+	    }
+	  
+	  strcpy (outfpname, ofname);
+	  strcpy (outfpnet, net);
+	  strcpy (outfpsta, sta);
+	}
+      
+      ofp = outfp;
+    }
+  else
     {
       /* Generate the output file name for new channel and/or
        * segment and open output file */
-      ms_hptime2isotimestr (msr->starttime, timestr, 0);
-
+      ms_hptime2isotimestr (starttime, timestr, 0);
+      
       snprintf (ofname, sizeof(ofname), "%s.%s.%s.%s",
-		msr->network, msr->station, timestr, msr->channel);
+		net, sta, timestr, chan);
       
-      if ( ! (ofp = fopen (ofname, "w")) )
+      if ( ! (ofp = rw_open (ofname, outbufsize, outflags)) )
 	{
 	  fprintf (stderr, "Error opening output file: %s\n",
 		   strerror(errno));
-	  return -1;
+	  return 0;
 	}
     }
   
-  msr->encoding = encoding;
-  
-  /* Pack output data */
-  trpackedrecords = msr_pack (msr, &record_handler, ofp,
-			      &trpackedsamples, 1, verbose-2);
-  
-  if ( trpackedrecords < 0 )
-    {
-      fprintf (stderr, "Error packing data\n");
-      return -1;
-    }
-  else
+  if ( addoutput (job, ( ofp == outfp ) ? outfpname : ofname) )
     {
-      packedrecords += trpackedrecords;
-      packedsamples += trpackedsamples;
+      fprintf (stderr, "Error allocating memory\n");
+      if ( ofp != outfp && ! archive )
+	rw_close (ofp);
+      return 0;
     }
   
-  /* Close file only if not the user specified file */
-  if ( ofp && ofp != outfp )
-    {
-      fclose (ofp);
-    }
+  return ofp;
+}  /* End of openoutput() */
+
+
+/***************************************************************************
+ * releaseoutput:
+ *
+ * Release the output file of a segment opened with openoutput(),
+ * closing it unless it is the shared output file (outfp) or an
+ * archive file, which stay open for further segments.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+releaseoutput (RecWriter *ofp, struct convstats *stats)
+{
+  if ( ofp == outfp || archive )
+    return 0;
+  
+  return closeoutput (ofp, stats);
+}  /* End of releaseoutput() */
+
+
+/***************************************************************************
+ * addoutput:
+ *
+ * Add an output file name to the output files of a job, unless already
+ * listed.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+addoutput (struct convjob *job, const char *ofname)
+{
+  char **outputs;
+  int idx;
+  
+  for ( idx = job->noutputs - 1; idx >= 0; idx-- )
+    if ( ! strcmp (job->outputs[idx], ofname) )
+      return 0;
+  
+  if ( ! (outputs = (char **) realloc (job->outputs, sizeof(char *) * (job->noutputs + 1))) )
+    return -1;
+  
+  job->outputs = outputs;
+  
+  if ( ! (job->outputs[job->noutputs] = strdup (ofname)) )
+    return -1;
+  
+  job->noutputs++;
   
   return 0;
-}  /* End of packmsr() */
+}  /* End of addoutput() */
 
 
 /***************************************************************************
- * binconvert:
+ * freeoutputs:
+ *
+ * Free the output file names of a job.
+ ***************************************************************************/
+static void
+freeoutputs (struct convjob *job)
+{
+  int idx;
+  
+  for ( idx = 0; idx < job->noutputs; idx++ )
+    free (job->outputs[idx]);
+  
+  if ( job->outputs )
+    free (job->outputs);
+  
+  job->outputs = 0;
+  job->noutputs = 0;
+}  /* End of freeoutputs() */
+
+
+/***************************************************************************
+ * closeoutput:
+ *
+ * Flush and close an output file, adding its write counts to the
+ * totals and the time spent to the write time of stats.
  *
  * Returns 0 on success, and -1 on failure
  ***************************************************************************/
 static int
-binconvert (char *binfile)
+closeoutput (RecWriter *ofp, struct convstats *stats)
 {
-  FILE *ifp = 0;
-  MSRecord *msr = 0;
-  struct blkt_1000_s Blkt1000;
-  struct blkt_100_s Blkt100;
+  struct timespec start;
+  int retval = 0;
   
-  int dataidx;
-  int datacnt;
-  int startidx;
-  int channel;
-  int yday;
-  int nscans; 
-  int datasize;
-  int start_time[6];
-  int missingdataflag;
-  hptime_t starttime;
-  int32_t *idata = 0;
-  int32_t *cdata = 0;
-  float samprate;
-  char chan[6];
+  clock_gettime (CLOCK_MONOTONIC, &start);
   
-  /* Open input file */
-  if ( (ifp = fopen (binfile, "rb")) == NULL )
+  if ( rw_flush (ofp) )
     {
-      fprintf (stderr, "Cannot open input file: %s (%s)\n",
-	       binfile, strerror(errno));
-      return -1;
+      fprintf (stderr, "Error writing to output file: %s\n", strerror(errno));
+      retval = -1;
     }
   
-  /* Parse bin file */
-  if ( ! (datasize = read_bin_file (ifp, &samprate, &nscans, start_time,
-				    &idata, &missingdataflag)) )
+  writtenbytes += ofp->offset - ofp->origin;
+  writecalls += ofp->writecalls;
+  
+  if ( rw_close (ofp) )
     {
-      fprintf (stderr, "[%s] Error reading input bin file\n", binfile);
-      return -1;
+      fprintf (stderr, "Error closing output file: %s\n", strerror(errno));
+      retval = -1;
     }
   
-  if ( verbose > 0 )
-    fprintf (stderr, "[%s] Missing data flag (value): %d\n", binfile, missingdataflag);
+  stats->write += elapsedtime (&start);
   
-  if ( samprate <= 0.0 )
-    {
-      fprintf (stderr, "[%s] Error with sample rate\n", binfile);
-      return -1;
+  return retval;
+}  /* End of closeoutput() */
+
+
+/***************************************************************************
+ * writesegs:
+ *
+ * Write all buffered segments of a conversion job to their output
+ * files, in the order they were packed, and free the buffers.  The
+ * time spent is added to the write time of the job.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+writesegs (struct convjob *job)
+{
+  struct timespec start;
+  struct segbuf *seg;
+  RecWriter *ofp;
+  double writetime = job->stats.write;
+  int retval = 0;
+  
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  
+  for ( seg = job->segs; seg != 0; seg = seg->next )
+    {
+      if ( ! (ofp = openoutput (job, seg->network, seg->station,
+				seg->location, seg->channel, seg->starttime)) )
+	{
+	  retval = -1;
+	  continue;
+	}
+      
+      if ( seg->recsize > 0 &&
+	   rw_write (ofp, seg->records, seg->recsize) )
+	{
+	  fprintf (stderr, "Error writing to output file: %s\n", strerror(errno));
+	  retval = -1;
+	}
+      
+      if ( releaseoutput (ofp, &job->stats) )
+	retval = -1;
+    }
+  
+  freesegs (job);
+  
+  /* Includes the time of closing files */
+  job->stats.write = writetime + elapsedtime (&start);
+  
+  return retval;
+}  /* End of writesegs() */
+
+
+/***************************************************************************
+ * freesegs:
+ *
+ * Free all buffered segments of a conversion job.
+ ***************************************************************************/
+static void
+freesegs (struct convjob *job)
+{
+  struct segbuf *seg, *nextseg;
+  
+  seg = job->segs;
+  while ( seg != 0 )
+    {
+      nextseg = seg->next;
+      
+      if ( seg->records )
+	free (seg->records);
+      free (seg);
+      
+      seg = nextseg;
+    }
+  
+  job->segs = job->lastseg = 0;
+}  /* End of freesegs() */
+
+
+/***************************************************************************
+ * binconvert:
+ *
+ * Convert a single bin file to Mini-SEED, packing records for each
+ * channel segment with packmsr() using the specified job state.  The
+ * complete data record is read into memory unless streaming in chunks
+ * of scans was requested.  If loaded is not NULL it holds the file as
+ * loaded by loadinput(), which is released by this routine.
+ *
+ * Buffers and the template MSRecord are taken from the conversion
+ * context, which keeps them for the next file.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+binconvert (char *binfile, struct convjob *job, struct bininput *loaded,
+	    struct convctx *ctx)
+{
+  struct bininput in;
+  MSRecord *msr = 0;
+  NIMSheader hdr;
+  
+  struct bindata bd;
+  struct timespec start;
+  int channel;
+  int nchannels;
+  int yday;
+  int nscans; 
+  int *start_time;
+  hptime_t starttime;
+  const int32_t *scans;
+  int32_t *idata = 0;
+  int32_t *chandata = 0;
+  uint8_t *gapmask = 0;
+  float samprate;
+  char chans[NIMS_MAXCHANNELS][6];
+  int retval = 0;
+  
+  job->binfile = binfile;
+  
+  /* Open input file and parse bin file header */
+  if ( loaded )
+    in = *loaded;
+  else
+    memset (&in, 0, sizeof(struct bininput));
+  
+  if ( openinput (binfile, &hdr, &in, &job->stats) )
+    return -1;
+  
+  nscans = hdr.nscans;
+  samprate = 1 / hdr.dt;
+  start_time = hdr.start_time;
+  
+  if ( verbose > 0 )
+    fprintf (stderr, "[%s] Missing data flag (value): %d\n", binfile, hdr.missingdataflag);
+  
+  if ( samprate <= 0.0 )
+    {
+      fprintf (stderr, "[%s] Error with sample rate\n", binfile);
+      closeinput (&in);
+      return -1;
+    }
+  
+  if ( hdr.nchannels <= 0 )
+    {
+      fprintf (stderr, "[%s] Unexpected data array size (%lld bytes) for %d scans\n",
+	       binfile, (long long) hdr.datalen, nscans);
+      closeinput (&in);
+      return -1;
     }
   
-  if ( datasize != (nscans * 5 * sizeof(int32_t)) )
+  if ( nchancodes > 0 && hdr.nchannels != nchancodes )
     {
-      fprintf (stderr, "[%s] Unexpected data array size (%d bytes) for %d scans of 5 channels",
-	       binfile, datasize, nscans);
+      fprintf (stderr, "[%s] Data scans have %d channels, %d channel codes specified\n",
+	       binfile, hdr.nchannels, nchancodes);
+      closeinput (&in);
       return -1;
     }
   
+  if ( verbose >= 1 && hdr.nchannels != SCAN_CHANNELS )
+    fprintf (stderr, "[%s] Data scans have %d channels\n", binfile, hdr.nchannels);
+  
+  job->stats.databytes += hdr.datalen;
+  job->stats.scans += nscans;
+  
   if ( ms_md2doy (start_time[0], start_time[1], start_time[2], &yday) )
     {
       fprintf (stderr, "Error converting month and day-of-month to day-of-year\n");
       fprintf (stderr, "  Input year: %d, month: %d, day-of-month: %d\n",
 	       start_time[0], start_time[1], start_time[2]);
+      closeinput (&in);
       return -1;
     }
   
@@ -260,119 +1071,2336 @@ binconvert (char *binfile)
     }
   
   /* Initialize MSRecord */
-  if ( ! (msr = msr_init(msr)) )
+  if ( ! (msr = ctx_template (ctx, job->codes, samprate)) )
     {
       fprintf (stderr, "[%s] Error initializing MSRecord\n", binfile);
+      closeinput (&in);
       return -1;
     }
-
-  /* Allocate channel specific buffer */
-  if ( ! (cdata = (int32_t *) malloc (sizeof(int32_t) * nscans)) )
+  
+  /* Set start time */
+  starttime = ms_time2hptime (start_time[0], yday, start_time[3],
+			      start_time[4], start_time[5], 0);
+  
+  memset (&bd, 0, sizeof(struct bindata));
+  bd.binfile = binfile;
+  bd.nscans = nscans;
+  bd.nchannels = hdr.nchannels;
+  bd.missingdataflag = hdr.missingdataflag;
+  bd.swapflag = ( in.map ) ? hdr.swapflag : 0;
+  bd.starttime = starttime;
+  
+  /* Use the gap table only if it describes filled gaps consistently */
+  if ( gapmode != GAPS_SCAN )
+    {
+      bd.usetable = check_bin_gaps (&hdr);
+      
+      if ( verbose >= 1 )
+	{
+	  if ( bd.usetable )
+	    fprintf (stderr, "[%s] Segmenting data using gap table with %d gaps\n",
+		     binfile, hdr.ngaps);
+	  else
+	    fprintf (stderr, "[%s] Gap table (type %d) not usable, scanning data values\n",
+		     binfile, hdr.gaptyp);
+	}
+    }
+  
+  /* Determine channel codes for the channels of each scan, from the
+   * -c list if given or the default instrument layout */
+  for ( nchannels=0; nchannels < hdr.nchannels ; nchannels++ )
+    {
+      if ( ( nchancodes > 0 ) ?
+	   get_chan_code (samprate, chancodes[nchannels], chans[nchannels]) != 1 :
+	   get_chan_name (samprate, nchannels+1, chans[nchannels]) != 1 )
+	{
+	  fprintf (stderr, "[%s] Unable to determine channel codes for channel number %d\n",
+		   binfile, nchannels+1);
+	  closeinput (&in);
+	  return -1;
+	}
+    }
+  
+  /* Read and pack the data in chunks of scans if requested, data
+   * records split into subrecords are always streamed unless appending */
+  if ( chunkscans > 0 || (hdr.datalen > NIMS_MAXSUBREC && ! appendmode) )
+    {
+      if ( verbose >= 1 && chunkscans <= 0 )
+	fprintf (stderr, "[%s] Streaming data record of %lld bytes in chunks of %d scans\n",
+		 binfile, (long long) hdr.datalen, STREAM_SCANS);
+      
+      retval = streamchannels (&in, &hdr, &bd, chans, nchannels, msr, job, ctx);
+      
+      closeinput (&in);
+      
+      return retval;
+    }
+  
+  /* Read all data scans, unless they are mapped */
+  if ( in.map )
+    {
+      scans = in.scans;
+    }
+  else
+    {
+      if ( (uint64_t) hdr.datalen > SIZE_MAX ||
+	   ! (idata = (int32_t *) ctx_reserve (&ctx->idata, (size_t) hdr.datalen)) )
+	{
+	  fprintf (stderr, "[%s] Error allocating memory\n", binfile);
+	  closeinput (&in);
+	  return -1;
+	}
+      
+      if ( readscans (&in, &hdr, idata, nscans, &job->stats) != nscans ||
+	   ! read_bin_end (in.ifp, &hdr) )
+	{
+	  fprintf (stderr, "[%s] Error reading input bin file\n", binfile);
+	  closeinput (&in);
+	  return -1;
+	}
+      
+      /* All data has been read, release the input file early */
+      closeinput (&in);
+      scans = idata;
+    }
+  
+  /* Split the scans into contiguous channel arrays, flagging missing
+   * samples, the interleaved scans are no longer needed after this */
+  if ( ! (chandata = (int32_t *) ctx_reserve (&ctx->chandata, sizeof(int32_t) * hdr.nchannels * (size_t) nscans)) ||
+       ! (gapmask = (uint8_t *) ctx_reserve (&ctx->gapmask, nscans)) )
     {
       fprintf (stderr, "[%s] Error allocating memory\n", binfile);
+      closeinput (&in);
       return -1;
     }
-  msr->datasamples = cdata;
-  msr->sampletype = 'i';
   
-  /* Set start time, sample rate and number of samples */
-  starttime = ms_time2hptime (start_time[0], yday, start_time[3],
-			      start_time[4], start_time[5], 0);
-  msr->samprate = samprate;
-    
+  for ( channel=0; channel < hdr.nchannels ; channel++ )
+    bd.chans[channel] = chandata + ((size_t) channel * nscans);
+  bd.gapmask = gapmask;
+  
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  retval = splitscans (&bd, &hdr, scans, 0, nscans, &ctx->tabruns, &ctx->maxtabruns);
+  job->stats.split += elapsedtime (&start);
+  job->stats.missing += bd.missing;
+  
+  closeinput (&in);
+  
+  if ( retval )
+    {
+      fprintf (stderr, "[%s] Error allocating memory\n", binfile);
+      return -1;
+    }
+  
+  if ( chanthreads )
+    {
+      retval = packchannels (&bd, chans, nchannels, msr, job);
+    }
+  else
+    {
+      for ( channel=0; channel < nchannels ; channel++ )
+	if ( packchannel (&bd, channel, chans[channel], msr, job) )
+	  retval = -1;
+    }
+  
+  msr->datasamples = 0;
+  
+  return retval;
+}  /* End of binconvert() */
+
+
+/***************************************************************************
+ * ctx_reserve:
+ *
+ * Make sure a buffer of a conversion context holds at least size
+ * bytes.  A buffer that is too small is replaced by a larger one,
+ * leaving some room for files that are slightly larger, its contents
+ * are not kept.  If huge pages are requested large buffers are mapped
+ * with huge pages, or with transparent huge pages if none are
+ * reserved.
+ *
+ * Returns the buffer on success, and NULL on failure
+ ***************************************************************************/
+static void *
+ctx_reserve (struct ctxbuf *buf, size_t size)
+{
+  void *data = MAP_FAILED;
+  
+  if ( size <= buf->size && buf->data )
+    return buf->data;
+  
+  if ( buf->mapped )
+    munmap (buf->data, buf->size);
+  else if ( buf->data )
+    free (buf->data);
+  
+  buf->data = 0;
+  buf->size = 0;
+  buf->mapped = 0;
+  
+  size += size / 8;
+  
+  if ( hugepages && size >= HUGEPAGE_SIZE )
+    {
+      size = (size + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+      
+#ifdef MAP_HUGETLB
+      data = mmap (NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+      if ( data == MAP_FAILED )
+	{
+	  data = mmap (NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	  
+	  if ( data == MAP_FAILED )
+	    return NULL;
+	  
+#ifdef MADV_HUGEPAGE
+	  madvise (data, size, MADV_HUGEPAGE);
+#endif
+	}
+      
+      buf->mapped = 1;
+    }
+  else if ( ! (data = malloc (size)) )
+    {
+      return NULL;
+    }
+  
+  buf->data = data;
+  buf->size = size;
+  
+  return data;
+}  /* End of ctx_reserve() */
+
+
+/***************************************************************************
+ * ctx_template:
+ *
+ * Prepare the template MSRecord of a conversion context for the next
+ * file.  The record is created with the blockettes on first use, for
+ * later files only the sample rate is updated and the stream state is
+ * reset so records are packed exactly as with a new record.  The
+ * network, station and location codes are set for each file, from
+ * codes if given or the defaults otherwise.
+ *
+ * Returns the template on success, and NULL on failure
+ ***************************************************************************/
+static MSRecord *
+ctx_template (struct convctx *ctx, struct srccodes *codes, double samprate)
+{
+  MSRecord *msr = ctx->template;
+  struct blkt_1000_s Blkt1000;
+  struct blkt_100_s Blkt100;
+  BlktLink *blkt;
+  char *net = network;
+  char *sta = station;
+  char *loc = location;
+  
+  if ( codes )
+    {
+      if ( codes->network )
+	net = codes->network;
+      if ( codes->station )
+	sta = codes->station;
+      if ( codes->location )
+	loc = codes->location;
+    }
+  
+  if ( msr )
+    {
+      /* Restart compression history and sequence numbers */
+      if ( msr->ststate )
+	memset (msr->ststate, 0, sizeof(StreamState));
+      msr->sequence_number = 0;
+      msr->samprate = samprate;
+      
+      for ( blkt = msr->blkts; blkt != 0; blkt = blkt->next )
+	if ( blkt->blkt_type == 100 )
+	  ((struct blkt_100_s *) blkt->blktdata)->samprate = (float) samprate;
+    }
+  else
+    {
+      if ( ! (msr = msr_init (NULL)) )
+	return NULL;
+      
+      msr->sampletype = 'i';
+      msr->samprate = samprate;
+      
+      /* Add blockettes 1000 to MSRecord */
+      memset (&Blkt1000, 0, sizeof(struct blkt_1000_s));
+      msr_addblockette (msr, (char *) &Blkt1000,
+			sizeof(struct blkt_1001_s), 1000, 0);
+      
+      /* Add blockette 100 to template if requested */
+      if ( srateblkt )
+	{
+	  memset (&Blkt100, 0, sizeof(struct blkt_100_s));
+	  Blkt100.samprate = (float) msr->samprate;
+	  msr_addblockette (msr, (char *) &Blkt100,
+			    sizeof(struct blkt_100_s), 100, 0);
+	}
+      
+      ctx->template = msr;
+    }
+  
   /* Set network, station and location */
-  if ( network )
-    ms_strncpclean (msr->network, network, 2);
-  if ( station )
-    ms_strncpclean (msr->station, station, 5);
-  if ( location )
-    ms_strncpclean (msr->location, location, 2);
+  msr->network[0] = msr->station[0] = msr->location[0] = '\0';
+  if ( net )
+    ms_strncpclean (msr->network, net, 2);
+  if ( sta )
+    ms_strncpclean (msr->station, sta, 5);
+  if ( loc )
+    ms_strncpclean (msr->location, loc, 2);
+  
+  return msr;
+}  /* End of ctx_template() */
+
+
+/***************************************************************************
+ * ctx_free:
+ *
+ * Release the buffers and template MSRecord of a conversion context.
+ ***************************************************************************/
+static void
+ctx_free (struct convctx *ctx)
+{
+  struct ctxbuf *bufs[3];
+  int idx;
+  
+  bufs[0] = &ctx->idata;
+  bufs[1] = &ctx->chandata;
+  bufs[2] = &ctx->gapmask;
   
-  /* Add blockettes 1000 to MSRecord */
-  memset (&Blkt1000, 0, sizeof(struct blkt_1000_s));
-  msr_addblockette (msr, (char *) &Blkt1000,
-		    sizeof(struct blkt_1001_s), 1000, 0);
+  for ( idx = 0; idx < 3; idx++ )
+    {
+      if ( bufs[idx]->mapped )
+	munmap (bufs[idx]->data, bufs[idx]->size);
+      else if ( bufs[idx]->data )
+	free (bufs[idx]->data);
+    }
+  
+  if ( ctx->tabruns )
+    free (ctx->tabruns);
+  
+  if ( ctx->template )
+    {
+      ctx->template->datasamples = 0;
+      msr_free (&ctx->template);
+    }
+  
+  memset (ctx, 0, sizeof(struct convctx));
+}  /* End of ctx_free() */
+
+
+/***************************************************************************
+ * openinput:
+ *
+ * Open an input bin file and parse the header.  If the file has been
+ * loaded into memory with loadinput(), or memory mapping of input
+ * files is enabled, the header is parsed from memory and the data
+ * scans are then read in place without copying.  Otherwise the file
+ * is left positioned at the first sample of the data record.
+ *
+ * The data of a record split into subrecords is joined in place in a
+ * loaded file.  A mapped file is read-only, it is opened with stdio
+ * instead.
+ *
+ * A raw NIMS DATA.BIN file is recognized by its content and always
+ * loaded into memory, its samples are decoded into scans of host byte
+ * order integers which are then used like the scans of a mapped bin
+ * file.
+ *
+ * Loading the file is timed as reading, opening the file and parsing
+ * the header as header parsing and decoding raw samples as swapping.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+openinput (char *binfile, NIMSheader *hdr, struct bininput *in,
+	   struct convstats *stats)
+{
+  struct timespec start;
+  size_t dataoffset;
+  int retval;
+  
+  if ( ! in->map && ! mapinput )
+    {
+      if ( (retval = openstdio (binfile, hdr, in, stats)) <= 0 )
+	return retval;
+    }
   
-  /* Add blockette 100 to template if requested */
-  if ( srateblkt )
+  if ( ! in->map )
     {
-      memset (&Blkt100, 0, sizeof(struct blkt_100_s));
-      Blkt100.samprate = (float) msr->samprate;
-      msr_addblockette (msr, (char *) &Blkt100,
-			sizeof(struct blkt_100_s), 100, 0);
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      retval = loadinput (binfile, in);
+      stats->read += elapsedtime (&start);
+      
+      if ( retval )
+	return -1;
     }
   
-  /* Loop over 5 channels */
-  for ( channel=0; channel < 5 ; channel++ )
+  if ( is_raw_file (in->map, in->maplen) )
     {
-      if ( get_chan_name (samprate, channel+1, chan) != 1 )
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      retval = parse_raw_header (in->map, in->maplen, hdr, 1);
+      stats->header += elapsedtime (&start);
+      
+      if ( ! retval )
 	{
-	  fprintf (stderr, "[%s] Unable to determine channel codes for channel number %d",
-		   binfile, channel+1);
-	  break;
+	  fprintf (stderr, "[%s] Error reading input raw NIMS file\n", binfile);
+	  closeinput (in);
+	  return -1;
 	}
       
-      if ( verbose > 1 )
-	fprintf (stderr, "[%s] Reading data for channel %d (%s)\n",
-		 binfile, channel+1, chan);
+      if ( ! (in->decoded = (int32_t *) malloc ((size_t) hdr->datalen)) )
+	{
+	  fprintf (stderr, "[%s] Error allocating memory\n", binfile);
+	  closeinput (in);
+	  return -1;
+	}
       
-      /* Set channel codes */
-      ms_strncpclean (msr->channel, chan, 3);
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      retval = read_raw_scans (in->map, in->maplen, hdr, in->decoded);
+      stats->swap += elapsedtime (&start);
+      
+      if ( ! retval )
+	{
+	  fprintf (stderr, "[%s] Error reading input raw NIMS file\n", binfile);
+	  closeinput (in);
+	  return -1;
+	}
       
-      dataidx = 0;
+      in->scans = in->decoded;
       
-      while ( dataidx < nscans )
+      return 0;
+    }
+  
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  retval = parse_bin_header (in->map, in->maplen, hdr, &dataoffset, 1);
+  stats->header += elapsedtime (&start);
+  
+  if ( ! retval )
+    {
+      fprintf (stderr, "[%s] Error reading input bin file\n", binfile);
+      closeinput (in);
+      return -1;
+    }
+  
+  if ( hdr->nsubrecs > 1 )
+    {
+      if ( in->mapped )
 	{
-	  /* Extract data array for this channel */
-	  for (datacnt=0, startidx=dataidx; dataidx < nscans; dataidx++)
-	    {
-	      if ( idata[(5 * dataidx) + channel] == missingdataflag ||
-		   idata[(5 * dataidx) + channel] >= 2147483647 )
-		{
-		  dataidx++;
-		  break;
-		}
-	      
-	      cdata[datacnt++] = idata[(5 * dataidx) + channel];
-	    }
+	  closeinput (in);
+	  
+	  return ( openstdio (binfile, hdr, in, stats) == 0 ) ? 0 : -1;
+	}
+      
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      join_bin_data (in->map + dataoffset, in->map, dataoffset, hdr);
+      stats->read += elapsedtime (&start);
+    }
+  
+  in->scans = (const int32_t *) (in->map + dataoffset);
+  
+  return 0;
+}  /* End of openinput() */
+
+
+/***************************************************************************
+ * openstdio:
+ *
+ * Open an input file with stdio and, if it is a bin file, read the
+ * header leaving the file positioned at the first data sample.
+ *
+ * Returns 0 on success, 1 if the file is not a bin file, and -1 on
+ * failure
+ ***************************************************************************/
+static int
+openstdio (char *binfile, NIMSheader *hdr, struct bininput *in,
+	   struct convstats *stats)
+{
+  struct timespec start;
+  char lenrecord[4];
+  int retval;
+  
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  
+  if ( (in->ifp = fopen (binfile, "rb")) == NULL )
+    {
+      fprintf (stderr, "Cannot open input file: %s (%s)\n",
+	       binfile, strerror(errno));
+      return -1;
+    }
+  
+  /* Anything not starting like a bin file may be raw NIMS data */
+  if ( fread (lenrecord, 1, 4, in->ifp) == 4 &&
+       is_bin_file (lenrecord, 4) )
+    {
+      rewind (in->ifp);
+      retval = read_bin_header (in->ifp, hdr, 1);
+      stats->header += elapsedtime (&start);
+      
+      if ( ! retval )
+	{
+	  fprintf (stderr, "[%s] Error reading input bin file\n", binfile);
+	  closeinput (in);
+	  return -1;
+	}
+      
+      return 0;
+    }
+  
+  closeinput (in);
+  stats->header += elapsedtime (&start);
+  
+  return 1;
+}  /* End of openstdio() */
+
+
+/***************************************************************************
+ * loadinput:
+ *
+ * Load a complete input bin file into memory.  If memory mapping of
+ * input files is enabled the file is mapped read-only, otherwise it
+ * is read into an allocated buffer.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+loadinput (char *binfile, struct bininput *in)
+{
+  struct stat st;
+  ssize_t nread;
+  size_t length;
+  void *map;
+  int fd;
+  
+  memset (in, 0, sizeof(struct bininput));
+  
+  if ( (fd = open (binfile, O_RDONLY)) < 0 )
+    {
+      fprintf (stderr, "Cannot open input file: %s (%s)\n",
+	       binfile, strerror(errno));
+      return -1;
+    }
+  
+  if ( fstat (fd, &st) || st.st_size <= 0 )
+    {
+      fprintf (stderr, "[%s] Error reading input bin file\n", binfile);
+      close (fd);
+      return -1;
+    }
+  
+  if ( (uint64_t) st.st_size > SIZE_MAX )
+    {
+      fprintf (stderr, "[%s] File too large to load into memory\n", binfile);
+      close (fd);
+      return -1;
+    }
+  
+  if ( mapinput )
+    {
+      map = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      close (fd);
+      
+      if ( map == MAP_FAILED )
+	{
+	  fprintf (stderr, "Cannot map input file: %s (%s)\n",
+		   binfile, strerror(errno));
+	  return -1;
+	}
+      
+      /* The scans are read once from start to end */
+      madvise (map, (size_t) st.st_size, MADV_SEQUENTIAL);
+      
+      in->map = (char *) map;
+      in->maplen = (size_t) st.st_size;
+      in->mapped = 1;
+      
+      return 0;
+    }
+  
+  if ( ! (in->map = (char *) malloc ((size_t) st.st_size)) )
+    {
+      fprintf (stderr, "[%s] Error allocating memory\n", binfile);
+      close (fd);
+      return -1;
+    }
+  
+  for ( length = 0; length < (size_t) st.st_size; length += nread )
+    {
+      if ( (nread = read (fd, in->map + length, (size_t) st.st_size - length)) <= 0 )
+	{
+	  if ( nread < 0 && errno == EINTR )
+	    {
+	      nread = 0;
+	      continue;
+	    }
+	  
+	  fprintf (stderr, "[%s] Error reading input bin file\n", binfile);
+	  close (fd);
+	  closeinput (in);
+	  return -1;
+	}
+    }
+  
+  close (fd);
+  in->maplen = length;
+  
+  return 0;
+}  /* End of loadinput() */
+
+
+/***************************************************************************
+ * closeinput:
+ *
+ * Close an input bin file or release its data in memory, if still
+ * open.
+ ***************************************************************************/
+static void
+closeinput (struct bininput *in)
+{
+  if ( in->ifp )
+    fclose (in->ifp);
+  
+  if ( in->map && in->mapped )
+    munmap (in->map, in->maplen);
+  else if ( in->map )
+    free (in->map);
+  
+  free (in->decoded);
+  
+  in->ifp = 0;
+  in->map = 0;
+  in->scans = 0;
+  in->decoded = 0;
+}  /* End of closeinput() */
+
+
+/***************************************************************************
+ * readscans:
+ *
+ * Read the next nscans scans from the data record of an input file
+ * opened with stdio.  The scans are read in the byte order of the file
+ * and then swapped to host order in a separate pass, so that reading
+ * and swapping are timed separately.
+ *
+ * Returns the number of complete scans read
+ ***************************************************************************/
+static int
+readscans (struct bininput *in, NIMSheader *hdr, int32_t *scans, int nscans,
+	   struct convstats *stats)
+{
+  struct timespec start;
+  int nread;
+  
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  nread = read_bin_data (in->ifp, hdr, scans, nscans);
+  stats->read += elapsedtime (&start);
+  
+  if ( hdr->swapflag && nread > 0 )
+    {
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      swap_bin_data (scans, (size_t) nread * hdr->nchannels);
+      stats->swap += elapsedtime (&start);
+    }
+  
+  return nread;
+}  /* End of readscans() */
+
+
+/***************************************************************************
+ * streamchannels:
+ *
+ * Read the data record of a bin file, positioned at the first sample,
+ * in chunks of scans and pack each channel incrementally.  Chunks are
+ * of -k scans, or of STREAM_SCANS without -k.  If the file is memory
+ * mapped the chunks are de-interleaved directly from the mapping.  Each
+ * channel is packed with its own copy of the template MSRecord so the
+ * Steim compression history and sequence numbers continue across
+ * chunks, only complete records are packed until a segment ends.
+ * Memory use is independent of the size of the file.
+ *
+ * Records of all channels are written in the order they are
+ * completed, so the channels are interleaved in the output.  The
+ * chunk buffers are taken from the conversion context.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+streamchannels (struct bininput *in, NIMSheader *hdr, struct bindata *bd,
+		char chans[][6], int nchannels, MSRecord *template,
+		struct convjob *job, struct convctx *ctx)
+{
+  struct chanstream cs[SCAN_MAXCHANNELS];
+  const int32_t *scans;
+  int32_t *chunk = 0;
+  int32_t *chunkchans = 0;
+  uint8_t *gapmask = 0;
+  int32_t *samples;
+  ScanRun *runs = 0;
+  int maxruns = 1;
+  ScanRun *chanruns;
+  struct timespec start;
+  int nruns;
+  int runidx;
+  int scanidx = 0;
+  int nread;
+  int want;
+  int idx;
+  int count;
+  int channel;
+  int maxscans = ( chunkscans > 0 ) ? chunkscans : STREAM_SCANS;
+  int retval = 0;
+  
+  memset (cs, 0, sizeof(cs));
+  
+  if ( ( ! in->map && ! (chunk = (int32_t *) ctx_reserve (&ctx->idata, sizeof(int32_t) * bd->nchannels * (size_t) maxscans)) ) ||
+       ! (chunkchans = (int32_t *) ctx_reserve (&ctx->chandata, sizeof(int32_t) * bd->nchannels * (size_t) maxscans)) ||
+       ! (gapmask = (uint8_t *) ctx_reserve (&ctx->gapmask, maxscans)) ||
+       ! (runs = (ScanRun *) malloc (sizeof(ScanRun) * maxruns)) )
+    {
+      fprintf (stderr, "[%s] Error allocating memory\n", bd->binfile);
+      return -1;
+    }
+  
+  /* Channel arrays and gap flags of the current chunk */
+  for ( channel=0; channel < bd->nchannels; channel++ )
+    bd->chans[channel] = chunkchans + ((size_t) channel * maxscans);
+  bd->gapmask = gapmask;
+  
+  for ( channel=0; channel < nchannels; channel++ )
+    {
+      if ( ! (cs[channel].msr = msr_duplicate (template, 0)) )
+	{
+	  fprintf (stderr, "[%s] Error allocating memory\n", bd->binfile);
+	  retval = -1;
+	  break;
+	}
+      
+      ms_strncpclean (cs[channel].msr->channel, chans[channel], 3);
+      
+      if ( verbose > 1 )
+	fprintf (stderr, "[%s] Streaming data for channel %d (%s)\n",
+		 bd->binfile, channel+1, chans[channel]);
+    }
+  
+  while ( retval == 0 && scanidx < bd->nscans )
+    {
+      want = ( bd->nscans - scanidx < maxscans ) ? bd->nscans - scanidx : maxscans;
+      
+      if ( in->map )
+	{
+	  scans = in->scans + ((size_t) bd->nchannels * scanidx);
+	  nread = want;
+	}
+      else if ( (nread = readscans (in, hdr, chunk, want, &job->stats)) == want )
+	{
+	  scans = chunk;
+	}
+      else
+	{
+	  fprintf (stderr, "[%s] Error reading input bin file\n", bd->binfile);
+	  retval = -1;
+	  break;
+	}
+      
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      retval = splitscans (bd, hdr, scans, scanidx, nread, &ctx->tabruns, &ctx->maxtabruns);
+      job->stats.split += elapsedtime (&start);
+      job->stats.missing += bd->missing;
+      
+      if ( retval )
+	{
+	  fprintf (stderr, "[%s] Error allocating memory\n", bd->binfile);
+	  break;
+	}
+      
+      for ( channel=0; channel < nchannels; channel++ )
+	{
+	  /* Grow pending sample buffer to hold this chunk */
+	  if ( cs[channel].numsamples + nread > cs[channel].maxsamples )
+	    {
+	      if ( ! (samples = (int32_t *) realloc (cs[channel].samples,
+						     sizeof(int32_t) * (cs[channel].numsamples + nread))) )
+		{
+		  fprintf (stderr, "[%s] Error allocating memory\n", bd->binfile);
+		  retval = -1;
+		  break;
+		}
+	      
+	      cs[channel].samples = samples;
+	      cs[channel].maxsamples = cs[channel].numsamples + nread;
+	    }
+	  
+	  /* Determine runs of samples, a single one if none are missing */
+	  chanruns = runs;
+	  if ( bd->usetable )
+	    {
+	      nruns = bd->ntabruns;
+	      chanruns = bd->tabruns;
+	    }
+	  else if ( bd->missing == 0 )
+	    {
+	      nruns = 1;
+	      runs[0].start = 0;
+	      runs[0].length = nread;
+	    }
+	  else
+	    {
+	      clock_gettime (CLOCK_MONOTONIC, &start);
+	      nruns = scan_gapruns (bd->gapmask, nread, channel, &runs, &maxruns);
+	      job->stats.split += elapsedtime (&start);
+	      
+	      if ( nruns < 0 )
+		{
+		  fprintf (stderr, "[%s] Error allocating memory\n", bd->binfile);
+		  retval = -1;
+		  break;
+		}
+	      
+	      chanruns = runs;
+	    }
+	  
+	  idx = 0;
+	  for ( runidx=0; runidx <= nruns; runidx++ )
+	    {
+	      /* End of segment at missing samples, pack remaining samples */
+	      if ( (runidx < nruns && chanruns[runidx].start > idx) ||
+		   (runidx == nruns && idx < nread) )
+		{
+		  if ( cs[channel].numsamples > 0 &&
+		       packstream (bd, &cs[channel], job, 1) )
+		    retval = -1;
+		}
+	      
+	      if ( runidx == nruns )
+		break;
+	      
+	      idx = chanruns[runidx].start;
+	      while ( idx < chanruns[runidx].start + chanruns[runidx].length )
+		{
+		  count = chanruns[runidx].start + chanruns[runidx].length - idx;
+		  
+		  /* End of segment at a day boundary for an archive */
+		  if ( archive )
+		    {
+		      if ( (cs[channel].numsamples > 0 || cs[channel].segpacked > 0) &&
+			   (hptime_t) (bd->starttime + (((scanidx + idx) / template->samprate) * HPTMODULUS)) >=
+			   cs[channel].segdayend )
+			{
+			  if ( packstream (bd, &cs[channel], job, 1) )
+			    retval = -1;
+			  cs[channel].daysplit = 1;
+			}
+		      
+		      count = dayscans (bd, template->samprate, scanidx + idx, count);
+		    }
+		  
+		  /* Start of segment */
+		  if ( cs[channel].numsamples == 0 && cs[channel].segpacked == 0 )
+		    {
+		      cs[channel].segstartidx = scanidx + idx;
+		      cs[channel].segstarttime = bd->starttime +
+			((cs[channel].segstartidx / template->samprate) * HPTMODULUS);
+		      cs[channel].segdayend = ar_dayend (cs[channel].segstarttime);
+		      
+		      if ( ! cs[channel].daysplit )
+			{
+			  if ( cs[channel].segments++ > 0 )
+			    job->stats.gaps++;
+			  job->stats.segments++;
+			}
+		      cs[channel].daysplit = 0;
+		    }
+		  
+		  memcpy (cs[channel].samples + cs[channel].numsamples,
+			  bd->chans[channel] + idx, sizeof(int32_t) * count);
+		  cs[channel].numsamples += count;
+		  
+		  idx += count;
+		}
+	    }
+	  
+	  /* Pack complete records */
+	  if ( cs[channel].numsamples > 0 &&
+	       packstream (bd, &cs[channel], job, 0) )
+	    retval = -1;
+	}
+      
+      scanidx += nread;
+    }
+  
+  if ( retval == 0 && ! in->map && ! read_bin_end (in->ifp, hdr) )
+    {
+      fprintf (stderr, "[%s] Error reading input bin file\n", bd->binfile);
+      retval = -1;
+    }
+  
+  /* Pack the final segment of each channel */
+  for ( channel=0; channel < nchannels; channel++ )
+    {
+      if ( cs[channel].numsamples > 0 || cs[channel].segpacked > 0 )
+	if ( packstream (bd, &cs[channel], job, 1) )
+	  retval = -1;
+      
+      if ( cs[channel].samples )
+	free (cs[channel].samples);
+      
+      if ( cs[channel].msr )
+	{
+	  cs[channel].msr->datasamples = 0;
+	  msr_free (&cs[channel].msr);
+	}
+    }
+  
+  free (runs);
+  
+  return retval;
+}  /* End of streamchannels() */
+
+
+/***************************************************************************
+ * packstream:
+ *
+ * Pack the pending samples of a streamed channel, keeping any samples
+ * that do not fill a complete record for the next call unless flush
+ * is set, which ends the segment.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+packstream (struct bindata *bd, struct chanstream *cs, struct convjob *job,
+	    flag flush)
+{
+  MSRecord *msr = cs->msr;
+  int64_t packed;
+  int retval = 0;
+  
+  if ( cs->numsamples > 0 )
+    {
+      if ( flush && verbose >= 1 )
+	{
+	  fprintf (stderr, "[%s] %" PRId64 " samps @ %.6f Hz for N: '%s', S: '%s', L: '%s', C: '%s'\n",
+		   bd->binfile, cs->segpacked + cs->numsamples, msr->samprate,
+		   msr->network, msr->station,  msr->location, msr->channel);
+	}
+      
+      /* Set start time of first pending sample and sample counts */
+      msr->starttime = cs->segstarttime;
+      if ( cs->segpacked > 0 )
+	msr->starttime += (hptime_t) (cs->segpacked / msr->samprate * HPTMODULUS + 0.5);
+      msr->datasamples = cs->samples;
+      msr->samplecnt = msr->numsamples = cs->numsamples;
+      
+      packed = job->stats.packedsamples;
+      
+      if ( packmsr (msr, job, &cs->so, flush) )
+	{
+	  fprintf (stderr, "[%s] Error packing Mini-SEED\n", bd->binfile);
+	  retval = -1;
+	  flush = 1;
+	}
+      
+      /* Shift samples not yet packed to the start of the buffer */
+      packed = job->stats.packedsamples - packed;
+      cs->segpacked += packed;
+      cs->numsamples -= packed;
+      if ( cs->numsamples > 0 )
+	memmove (cs->samples, cs->samples + packed,
+		 sizeof(int32_t) * cs->numsamples);
+    }
+  else if ( flush && (cs->so.ofp || cs->so.seg) )
+    {
+      /* Close output of a segment ending on a record boundary */
+      if ( cs->so.ofp )
+	releaseoutput (cs->so.ofp, &job->stats);
+      cs->so.ofp = 0;
+      cs->so.seg = 0;
+    }
+  
+  if ( flush )
+    {
+      cs->numsamples = 0;
+      cs->segpacked = 0;
+    }
+  
+  return retval;
+}  /* End of packstream() */
+
+
+/***************************************************************************
+ * splitscans:
+ *
+ * Split a window of scans, starting at scan index startscan of the
+ * file, into the channel arrays of the bin data and determine how the
+ * data is segmented.  If the gap table is used the runs of valid
+ * scans are built from the table into tabruns and set as the runs of
+ * all channels.  The number of missing samples is always counted and
+ * must match the gaps of the table, in verify mode the positions of
+ * all missing samples are compared as well.  On a mismatch the table
+ * is no longer used for the file and the data values are scanned.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+splitscans (struct bindata *bd, NIMSheader *hdr, const int32_t *scans,
+	    int startscan, int nscans, ScanRun **tabruns, int *maxtabruns)
+{
+  int nruns;
+  int runidx;
+  int tablemissing;
+  int match;
+  
+  bd->tabruns = 0;
+  bd->ntabruns = 0;
+  
+  if ( ! bd->usetable )
+    {
+      bd->missing = scan_deinterleave (scans, nscans, bd->nchannels, bd->swapflag,
+				       bd->chans, bd->missingdataflag, bd->gapmask);
+      return 0;
+    }
+  
+  if ( (nruns = tableruns (hdr, startscan, nscans, tabruns, maxtabruns)) < 0 )
+    return -1;
+  
+  tablemissing = nscans;
+  for ( runidx=0; runidx < nruns; runidx++ )
+    tablemissing -= (*tabruns)[runidx].length;
+  
+  /* Missing sample flags are only needed to verify the table */
+  bd->missing = scan_deinterleave (scans, nscans, bd->nchannels, bd->swapflag,
+				   bd->chans, bd->missingdataflag,
+				   ( gapmode == GAPS_VERIFY ) ? bd->gapmask : NULL);
+  
+  match = ( bd->missing == tablemissing * bd->nchannels );
+  
+  if ( match && gapmode == GAPS_VERIFY && bd->missing > 0 )
+    if ( (match = checkruns (bd, nscans, bd->nchannels, *tabruns, nruns)) < 0 )
+      return -1;
+  
+  if ( ! match )
+    {
+      fprintf (stderr, "[%s] Gap table does not match missing data at scan %d, scanning data values\n",
+	       bd->binfile, startscan + 1);
+      
+      bd->usetable = 0;
+      
+      if ( gapmode != GAPS_VERIFY )
+	bd->missing = scan_deinterleave (scans, nscans, bd->nchannels, bd->swapflag,
+					 bd->chans, bd->missingdataflag, bd->gapmask);
+      
+      return 0;
+    }
+  
+  bd->tabruns = *tabruns;
+  bd->ntabruns = nruns;
+  
+  return 0;
+}  /* End of splitscans() */
+
+
+/***************************************************************************
+ * tableruns:
+ *
+ * Build the runs of valid scans in a window of nscans scans starting
+ * at scan index startscan from the gap table of the header, which
+ * must have been checked with check_bin_gaps().  Run starts are
+ * relative to the window.  The runs array is grown as needed.
+ *
+ * Returns the number of runs on success, and -1 on failure
+ ***************************************************************************/
+static int
+tableruns (NIMSheader *hdr, int startscan, int nscans, ScanRun **runs,
+	   int *maxruns)
+{
+  ScanRun *newruns;
+  int endscan = startscan + nscans;
+  int scanidx = startscan;
+  int gapstart;
+  int gapend;
+  int gapidx;
+  int nruns = 0;
+  
+  for ( gapidx=0; gapidx <= hdr->ngaps && scanidx < endscan; gapidx++ )
+    {
+      /* Table entries start at scan 1, the last run ends at the window end */
+      if ( gapidx < hdr->ngaps )
+	{
+	  gapstart = hdr->gaps[gapidx].start - 1;
+	  gapend = gapstart + hdr->gaps[gapidx].length;
+	  
+	  if ( gapend <= scanidx )
+	    continue;
+	  if ( gapstart > endscan )
+	    gapstart = endscan;
+	}
+      else
+	{
+	  gapstart = gapend = endscan;
+	}
+      
+      if ( gapstart > scanidx )
+	{
+	  if ( nruns >= *maxruns )
+	    {
+	      if ( ! (newruns = (ScanRun *) realloc (*runs, sizeof(ScanRun) *
+						     ((*maxruns) ? *maxruns * 2 : 64))) )
+		return -1;
+	      
+	      *runs = newruns;
+	      *maxruns = (*maxruns) ? *maxruns * 2 : 64;
+	    }
+	  
+	  (*runs)[nruns].start = scanidx - startscan;
+	  (*runs)[nruns].length = gapstart - scanidx;
+	  nruns++;
+	}
+      
+      scanidx = gapend;
+    }
+  
+  return nruns;
+}  /* End of tableruns() */
+
+
+/***************************************************************************
+ * checkruns:
+ *
+ * Compare runs of valid scans with the missing sample flags of each
+ * channel in the bin data.
+ *
+ * Returns 1 if the runs match the flags of all channels, 0 if not and
+ * -1 on failure
+ ***************************************************************************/
+static int
+checkruns (struct bindata *bd, int nscans, int nchannels, ScanRun *runs,
+	   int nruns)
+{
+  ScanRun *chanruns = 0;
+  int maxchanruns = 0;
+  int nchanruns;
+  int channel;
+  int match = 1;
+  
+  for ( channel=0; channel < nchannels && match; channel++ )
+    {
+      if ( (nchanruns = scan_gapruns (bd->gapmask, nscans, channel,
+				      &chanruns, &maxchanruns)) < 0 )
+	{
+	  match = -1;
+	  break;
+	}
+      
+      match = ( nchanruns == nruns &&
+		( nruns == 0 || ! memcmp (chanruns, runs, sizeof(ScanRun) * nruns) ) );
+    }
+  
+  if ( chanruns )
+    free (chanruns);
+  
+  return match;
+}  /* End of checkruns() */
+
+
+/***************************************************************************
+ * dayscans:
+ *
+ * Determine how many of count scans starting at scan index startscan
+ * of the file fall on the same day as the first, using the same scan
+ * times as for the start of records.
+ *
+ * Returns the number of scans, at least 1
+ ***************************************************************************/
+static int
+dayscans (struct bindata *bd, double samprate, int startscan, int count)
+{
+  hptime_t dayend;
+  int64_t scans;
+  
+  dayend = ar_dayend ((hptime_t) (bd->starttime + ((startscan / samprate) * HPTMODULUS)));
+  
+  /* Estimate, then adjust for rounding of the scan times */
+  scans = (int64_t) ((double) (dayend - bd->starttime) / HPTMODULUS * samprate) - startscan;
+  if ( scans > count )
+    scans = count;
+  if ( scans < 1 )
+    scans = 1;
+  
+  while ( scans > 1 &&
+	  (hptime_t) (bd->starttime + (((startscan + scans - 1) / samprate) * HPTMODULUS)) >= dayend )
+    scans--;
+  
+  while ( scans < count &&
+	  (hptime_t) (bd->starttime + (((startscan + scans) / samprate) * HPTMODULUS)) < dayend )
+    scans++;
+  
+  return (int) scans;
+}  /* End of dayscans() */
+
+
+/***************************************************************************
+ * packchannel:
+ *
+ * Pack the samples of a single channel, splitting the data into
+ * segments at samples flagged as missing data.  Each segment is
+ * packed directly from the channel array using the specified
+ * MSRecord.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+packchannel (struct bindata *bd, int channel, char *chan, MSRecord *msr,
+	     struct convjob *job)
+{
+  ScanRun onerun;
+  ScanRun *runs = 0;
+  struct timespec start;
+  int maxruns = 0;
+  int nruns;
+  int runidx;
+  int scanidx;
+  int count;
+  int retval = 0;
+  
+  if ( verbose > 1 )
+    fprintf (stderr, "[%s] Reading data for channel %d (%s)\n",
+	     bd->binfile, channel+1, chan);
+  
+  /* Set channel codes */
+  ms_strncpclean (msr->channel, chan, 3);
+  
+  /* Determine segments, a single one if no samples are missing */
+  if ( bd->usetable )
+    {
+      nruns = bd->ntabruns;
+      runs = bd->tabruns;
+    }
+  else if ( bd->missing == 0 )
+    {
+      onerun.start = 0;
+      onerun.length = bd->nscans;
+      nruns = ( bd->nscans > 0 ) ? 1 : 0;
+      runs = &onerun;
+    }
+  else
+    {
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      nruns = scan_gapruns (bd->gapmask, bd->nscans, channel, &runs, &maxruns);
+      job->stats.split += elapsedtime (&start);
+      
+      if ( nruns < 0 )
+	{
+	  fprintf (stderr, "[%s] Error allocating memory\n", bd->binfile);
+	  return -1;
+	}
+    }
+  
+  job->stats.segments += nruns;
+  if ( nruns > 1 )
+    job->stats.gaps += nruns - 1;
+  
+  for ( runidx=0; runidx < nruns; runidx++ )
+    {
+      if ( verbose >= 1 )
+	{
+	  fprintf (stderr, "[%s] %d samps @ %.6f Hz for N: '%s', S: '%s', L: '%s', C: '%s'\n",
+		   bd->binfile, runs[runidx].length, msr->samprate,
+		   msr->network, msr->station,  msr->location, msr->channel);
+	}
+      
+      /* Pack the segment, split at day boundaries for an archive */
+      for ( scanidx = runs[runidx].start;
+	    retval == 0 && scanidx < runs[runidx].start + runs[runidx].length;
+	    scanidx += count )
+	{
+	  count = runs[runidx].start + runs[runidx].length - scanidx;
+	  if ( archive )
+	    count = dayscans (bd, msr->samprate, scanidx, count);
+	  
+	  if ( appendstate )
+	    {
+	      /* Continue the last record of the channel if contiguous */
+	      if ( packappend (bd, channel, scanidx, count, msr, job) )
+		{
+		  fprintf (stderr, "[%s] Error packing Mini-SEED\n", bd->binfile);
+		  retval = -1;
+		}
+	      continue;
+	    }
+	  
+	  /* Set start time, sample counts and segment samples */
+	  msr->starttime = bd->starttime + ((scanidx / msr->samprate) * HPTMODULUS);
+	  msr->samplecnt = msr->numsamples = count;
+	  msr->datasamples = bd->chans[channel] + scanidx;
+	  
+	  /* Pack data into records */
+	  if ( packmsr (msr, job, NULL, 1) )
+	    {
+	      fprintf (stderr, "[%s] Error packing Mini-SEED\n", bd->binfile);
+	      retval = -1;
+	    }
+	}
+      
+      if ( retval )
+	break;
+    }
+  
+  if ( runs && runs != &onerun && ! bd->usetable )
+    free (runs);
+  
+  return retval;
+}  /* End of packchannel() */
+
+
+/***************************************************************************
+ * packappend:
+ *
+ * Pack count scans of a channel starting at scanidx when appending to
+ * the output file.  Each channel has its own record sequence numbers,
+ * continuing from the last record of the channel.
+ *
+ * If the samples follow the last record of the channel in time and
+ * the record has the same length and encoding, its samples are packed
+ * again followed by the new samples, keeping the Steim compression
+ * history of the record.  The first packed record replaces the last
+ * record in the output file, so a partially filled record is filled
+ * up instead of starting a new segment.  Only enough new samples to
+ * complete the record are copied, the rest are packed in place.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+packappend (struct bindata *bd, int channel, int scanidx, int count,
+	    MSRecord *msr, struct convjob *job)
+{
+  struct segout so;
+  MSRecord *tail = 0;
+  AppendChannel *ac;
+  hptime_t starttime;
+  hptime_t expected;
+  hptime_t tolerance;
+  int32_t *samples = 0;
+  int32_t lastsample;
+  int64_t packedsamples;
+  char srcname[50];
+  int reclen;
+  int chunk;
+  int unpacked;
+  
+  memset (&so, 0, sizeof(struct segout));
+  
+  starttime = bd->starttime + ((scanidx / msr->samprate) * HPTMODULUS);
+  reclen = ( packreclen > 0 ) ? packreclen : 4096;
+  
+  if ( ! (ac = ap_channel (appendstate, msr_srcname (msr, srcname, 0))) )
+    {
+      fprintf (stderr, "Error allocating memory\n");
+      return -1;
+    }
+  
+  so.append = ac;
+  
+  if ( ! msr->ststate &&
+       ! (msr->ststate = (StreamState *) calloc (1, sizeof(StreamState))) )
+    {
+      fprintf (stderr, "Error allocating memory\n");
+      return -1;
+    }
+  
+  /* A new segment starts without compression history */
+  memset (msr->ststate, 0, sizeof(StreamState));
+  msr->sequence_number = 1;
+  
+  if ( (tail = ap_unpack (ac)) )
+    {
+      msr->sequence_number = tail->sequence_number + 1;
+      
+      expected = msr_endtime (tail) + (hptime_t) (HPTMODULUS / msr->samprate + 0.5);
+      tolerance = (hptime_t) (0.5 * HPTMODULUS / msr->samprate);
+      
+      if ( tail->reclen == reclen && tail->encoding == encoding &&
+	   tail->byteorder == (( byteorder >= 0 ) ? byteorder : 1) &&
+	   tail->sampletype == 'i' && tail->numsamples > 0 &&
+	   tail->samprate > 0.0 && MS_ISRATETOLERABLE (tail->samprate, msr->samprate) &&
+	   starttime >= expected - tolerance && starttime <= expected + tolerance )
+	{
+	  /* Samples that may be needed to complete the record */
+	  chunk = ( count > 2 * reclen ) ? 2 * reclen + 1 : count;
+	  
+	  if ( ! (samples = (int32_t *) malloc (sizeof(int32_t) * (tail->numsamples + chunk))) )
+	    {
+	      fprintf (stderr, "Error allocating memory\n");
+	      msr_free (&tail);
+	      return -1;
+	    }
+	  
+	  memcpy (samples, tail->datasamples, sizeof(int32_t) * tail->numsamples);
+	  memcpy (samples + tail->numsamples, bd->chans[channel] + scanidx,
+		  sizeof(int32_t) * chunk);
+	  
+	  if ( ap_history (tail, &lastsample) == 0 )
+	    {
+	      msr->ststate->lastintsample = lastsample;
+	      msr->ststate->comphistory = 1;
+	    }
+	  
+	  msr->sequence_number = tail->sequence_number;
+	  msr->starttime = tail->starttime;
+	  msr->samplecnt = msr->numsamples = tail->numsamples + chunk;
+	  msr->datasamples = samples;
+	  so.replace = 1;
+	  
+	  /* At most a few records are packed, the samples of the last
+	   * incomplete one are packed again from the channel array */
+	  packedsamples = job->stats.packedsamples;
+	  
+	  if ( packmsr (msr, job, &so, ( chunk == count )) )
+	    {
+	      free (samples);
+	      msr_free (&tail);
+	      return -1;
+	    }
+	  
+	  unpacked = msr->numsamples - (int) (job->stats.packedsamples - packedsamples);
+	  
+	  scanidx += chunk - unpacked;
+	  count -= chunk - unpacked;
+	  starttime = msr->starttime;
+	  
+	  /* The samples of the rewritten record were packed before */
+	  job->stats.packedsamples -= tail->numsamples;
+	  
+	  msr->datasamples = 0;
+	  free (samples);
+	}
+      
+      msr_free (&tail);
+    }
+  
+  if ( count <= 0 )
+    return 0;
+  
+  msr->starttime = starttime;
+  msr->samplecnt = msr->numsamples = count;
+  msr->datasamples = bd->chans[channel] + scanidx;
+  
+  return packmsr (msr, job, &so, 1);
+}  /* End of packappend() */
+
+
+/***************************************************************************
+ * packchannels:
+ *
+ * Pack all channels concurrently, one thread per channel.  Each
+ * channel is packed with its own copy of the template MSRecord (and
+ * therefore its own StreamState) into buffered segments.  When all
+ * channels are done the segments are merged into the job in channel
+ * order.
+ *
+ * As each channel has its own stream state, record sequence numbers
+ * start at 1 for every channel instead of continuing from the
+ * previous channel as in a serial conversion.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+packchannels (struct bindata *bd, char chans[][6], int nchannels,
+	      MSRecord *template, struct convjob *job)
+{
+  struct chanpack cp[SCAN_MAXCHANNELS];
+  int retval = 0;
+  int channel;
+  int idx;
+  
+  memset (cp, 0, sizeof(cp));
+  
+  for ( channel=0; channel < nchannels; channel++ )
+    {
+      cp[channel].bd = bd;
+      cp[channel].channel = channel;
+      cp[channel].chan = chans[channel];
+      cp[channel].job.binfile = bd->binfile;
+      cp[channel].job.buffered = 1;
+      cp[channel].job.discard = job->discard;
+      cp[channel].retval = -1;
+      
+      if ( ! (cp[channel].msr = msr_duplicate (template, 0)) )
+	{
+	  fprintf (stderr, "[%s] Error allocating memory for channel %d\n",
+		   bd->binfile, channel+1);
+	  continue;
+	}
+      
+      if ( pthread_create (&cp[channel].thread, NULL, chanworker, &cp[channel]) )
+	{
+	  /* Pack in this thread if a new one cannot be started */
+	  chanworker (&cp[channel]);
+	}
+      else
+	{
+	  cp[channel].started = 1;
+	}
+    }
+  
+  /* Wait for all channels and merge segments in channel order */
+  for ( channel=0; channel < nchannels; channel++ )
+    {
+      if ( cp[channel].started )
+	pthread_join (cp[channel].thread, NULL);
+      
+      if ( cp[channel].retval )
+	retval = -1;
+      
+      if ( job->buffered )
+	{
+	  if ( cp[channel].job.segs )
+	    {
+	      if ( job->lastseg )
+		job->lastseg->next = cp[channel].job.segs;
+	      else
+		job->segs = cp[channel].job.segs;
+	      job->lastseg = cp[channel].job.lastseg;
+	    }
+	}
+      else if ( writesegs (&cp[channel].job) )
+	{
+	  retval = -1;
+	}
+      
+      for ( idx = 0; idx < cp[channel].job.noutputs; idx++ )
+	if ( addoutput (job, cp[channel].job.outputs[idx]) )
+	  retval = -1;
+      freeoutputs (&cp[channel].job);
+      
+      addstats (&job->stats, &cp[channel].job.stats);
+      
+      if ( cp[channel].msr )
+	{
+	  cp[channel].msr->datasamples = 0;
+	  msr_free (&cp[channel].msr);
+	}
+    }
+  
+  return retval;
+}  /* End of packchannels() */
+
+
+/***************************************************************************
+ * chanworker:
+ *
+ * Thread routine for packchannels(), packs a single channel.
+ ***************************************************************************/
+static void *
+chanworker (void *arg)
+{
+  struct chanpack *cp = (struct chanpack *) arg;
+  
+  cp->retval = packchannel (cp->bd, cp->channel, cp->chan, cp->msr,
+			    &cp->job);
+  
+  return NULL;
+}  /* End of chanworker() */
+
+
+/***************************************************************************
+ * convertpool:
+ *
+ * Convert all input files using a pool of worker threads.  Each
+ * worker converts one file at a time with its own MSRecord and
+ * buffers, collecting the packed records in memory.  Output is
+ * written in input file order so that it is identical to a serial
+ * conversion, a worker waits for all preceding files to be written
+ * before writing its own.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+convertpool (int nworkers)
+{
+  struct workpool pool;
+  pthread_t *threads;
+  int started;
+  int idx;
+  
+  if ( ! (threads = (pthread_t *) malloc (sizeof(pthread_t) * nworkers)) )
+    {
+      fprintf (stderr, "Error allocating memory\n");
+      return -1;
+    }
+  
+  pthread_mutex_init (&pool.lock, NULL);
+  pthread_cond_init (&pool.committed, NULL);
+  pool.nextfile = filelist;
+  pool.nextindex = 0;
+  pool.commitindex = 0;
+  
+  if ( verbose )
+    fprintf (stderr, "Converting with %d worker threads\n", nworkers);
+  
+  for ( started = 0; started < nworkers; started++ )
+    {
+      if ( pthread_create (&threads[started], NULL, poolworker, &pool) )
+	{
+	  fprintf (stderr, "Error creating worker thread: %s\n", strerror(errno));
+	  break;
+	}
+    }
+  
+  for ( idx = 0; idx < started; idx++ )
+    pthread_join (threads[idx], NULL);
+  
+  pthread_cond_destroy (&pool.committed);
+  pthread_mutex_destroy (&pool.lock);
+  free (threads);
+  
+  return ( started > 0 ) ? 0 : -1;
+}  /* End of convertpool() */
+
+
+/***************************************************************************
+ * poolworker:
+ *
+ * Worker thread routine for convertpool(), converts input files from
+ * the shared list until it is exhausted.
+ ***************************************************************************/
+static void *
+poolworker (void *arg)
+{
+  struct workpool *pool = (struct workpool *) arg;
+  struct listnode *flp;
+  struct convjob job;
+  struct convctx ctx;
+  int status;
+  int index;
+  
+  memset (&ctx, 0, sizeof(struct convctx));
+  
+  for (;;)
+    {
+      /* Take the next input file from the list */
+      pthread_mutex_lock (&pool->lock);
+      flp = pool->nextfile;
+      index = pool->nextindex;
+      if ( flp )
+	{
+	  pool->nextfile = flp->next;
+	  pool->nextindex++;
+	}
+      pthread_mutex_unlock (&pool->lock);
+      
+      if ( ! flp )
+	break;
+      
+      if ( verbose )
+	fprintf (stderr, "Reading %s\n", flp->data);
+      
+      memset (&job, 0, sizeof(struct convjob));
+      job.codes = flp->codes;
+      job.buffered = 1;
+      status = binconvert (flp->data, &job, NULL, &ctx);
+      
+      /* Wait for the output of all preceding files to be written */
+      pthread_mutex_lock (&pool->lock);
+      while ( pool->commitindex != index )
+	pthread_cond_wait (&pool->committed, &pool->lock);
+      pthread_mutex_unlock (&pool->lock);
+      
+      if ( writesegs (&job) )
+	status = -1;
+      
+      pthread_mutex_lock (&pool->lock);
+      reportfile (&job, status);
+      pool->commitindex++;
+      pthread_cond_broadcast (&pool->committed);
+      pthread_mutex_unlock (&pool->lock);
+    }
+  
+  ctx_free (&ctx);
+  
+  return NULL;
+}  /* End of poolworker() */
+
+
+/***************************************************************************
+ * convertpipeline:
+ *
+ * Convert the input files in a three stage pipeline: a reader thread
+ * loads the next files into memory, the calling thread packs them and
+ * a writer thread writes the output of packed files.  The stages are
+ * connected by queues holding up to depth files, so reading, packing
+ * and writing of different files overlap while memory use is bounded.
+ *
+ * Output is written in input file order and is identical to a serial
+ * conversion.  The depth of the queues and the time each stage waited
+ * on them are reported at the end.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+convertpipeline (int depth)
+{
+  struct pipeline stages;
+  struct pipeitem *item;
+  struct convctx ctx;
+  pthread_t reader;
+  pthread_t writer;
+  
+  if ( queue_init (&stages.readq, depth) )
+    {
+      fprintf (stderr, "Error allocating memory\n");
+      return -1;
+    }
+  
+  if ( queue_init (&stages.writeq, depth) )
+    {
+      fprintf (stderr, "Error allocating memory\n");
+      queue_free (&stages.readq);
+      return -1;
+    }
+  
+  if ( pthread_create (&reader, NULL, pipereader, &stages) )
+    {
+      fprintf (stderr, "Error creating reader thread: %s\n", strerror(errno));
+      queue_free (&stages.readq);
+      queue_free (&stages.writeq);
+      return -1;
+    }
+  
+  if ( pthread_create (&writer, NULL, pipewriter, &stages) )
+    {
+      fprintf (stderr, "Error creating writer thread: %s\n", strerror(errno));
+      queue_close (&stages.writeq);
+      
+      /* Discard loaded files until the reader is done */
+      while ( (item = (struct pipeitem *) queue_get (&stages.readq)) )
+	{
+	  closeinput (&item->in);
+	  free (item);
+	}
+      
+      pthread_join (reader, NULL);
+      queue_free (&stages.readq);
+      queue_free (&stages.writeq);
+      return -1;
+    }
+  
+  /* Pack each loaded file into buffered segments */
+  memset (&ctx, 0, sizeof(struct convctx));
+  
+  while ( (item = (struct pipeitem *) queue_get (&stages.readq)) )
+    {
+      if ( verbose )
+	fprintf (stderr, "Reading %s\n", item->binfile);
+      
+      item->job.buffered = 1;
+      
+      if ( item->status == 0 )
+	item->status = binconvert (item->binfile, &item->job, &item->in, &ctx);
+      
+      queue_put (&stages.writeq, item);
+    }
+  
+  ctx_free (&ctx);
+  queue_close (&stages.writeq);
+  
+  pthread_join (reader, NULL);
+  pthread_join (writer, NULL);
+  
+  if ( verbose )
+    {
+      queue_report (&stages.readq, "Read", "reader", "packer");
+      queue_report (&stages.writeq, "Write", "packer", "writer");
+    }
+  
+  queue_free (&stages.readq);
+  queue_free (&stages.writeq);
+  
+  return 0;
+}  /* End of convertpipeline() */
+
+
+/***************************************************************************
+ * pipereader:
+ *
+ * Reader thread routine for convertpipeline(), loads each input file
+ * into memory and queues it for packing.  Files with data records
+ * split into subrecords are queued unloaded and streamed by the packer.
+ ***************************************************************************/
+static void *
+pipereader (void *arg)
+{
+  struct pipeline *stages = (struct pipeline *) arg;
+  struct pipeitem *item;
+  struct listnode *flp;
+  struct timespec start;
+  struct stat st;
+  
+  for ( flp = filelist; flp != 0; flp = flp->next )
+    {
+      if ( ! (item = (struct pipeitem *) calloc (1, sizeof(struct pipeitem))) )
+	{
+	  fprintf (stderr, "Error allocating memory\n");
+	  break;
+	}
+      
+      item->binfile = item->job.binfile = flp->data;
+      item->job.codes = flp->codes;
+      
+      /* Files too large for a single data record are left for the
+       * packer to stream instead of being loaded completely */
+      if ( ! mapinput && stat (flp->data, &st) == 0 && st.st_size > NIMS_MAXSUBREC )
+	{
+	  queue_put (&stages->readq, item);
+	  continue;
+	}
+      
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      item->status = loadinput (flp->data, &item->in);
+      item->job.stats.read += elapsedtime (&start);
+      
+      queue_put (&stages->readq, item);
+    }
+  
+  queue_close (&stages->readq);
+  
+  return NULL;
+}  /* End of pipereader() */
+
+
+/***************************************************************************
+ * pipewriter:
+ *
+ * Writer thread routine for convertpipeline(), writes the output
+ * segments of each packed file in the order they are queued.
+ ***************************************************************************/
+static void *
+pipewriter (void *arg)
+{
+  struct pipeline *stages = (struct pipeline *) arg;
+  struct pipeitem *item;
+  
+  while ( (item = (struct pipeitem *) queue_get (&stages->writeq)) )
+    {
+      if ( writesegs (&item->job) )
+	item->status = -1;
+      
+      reportfile (&item->job, item->status);
+      
+      free (item);
+    }
+  
+  return NULL;
+}  /* End of pipewriter() */
+
+
+/***************************************************************************
+ * queue_init:
+ *
+ * Initialize a bounded queue holding up to size items.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+queue_init (struct stagequeue *q, int size)
+{
+  memset (q, 0, sizeof(struct stagequeue));
+  
+  if ( ! (q->items = (void **) malloc (sizeof(void *) * size)) )
+    return -1;
+  
+  q->size = size;
+  pthread_mutex_init (&q->lock, NULL);
+  pthread_cond_init (&q->notempty, NULL);
+  pthread_cond_init (&q->notfull, NULL);
+  
+  return 0;
+}  /* End of queue_init() */
+
+
+/***************************************************************************
+ * queue_put:
+ *
+ * Add an item to the end of a queue, waiting while the queue is full.
+ ***************************************************************************/
+static void
+queue_put (struct stagequeue *q, void *item)
+{
+  struct timespec start;
+  
+  pthread_mutex_lock (&q->lock);
+  
+  if ( q->count == q->size )
+    {
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      while ( q->count == q->size )
+	pthread_cond_wait (&q->notfull, &q->lock);
+      q->putstall += elapsedtime (&start);
+    }
+  
+  q->items[(q->head + q->count) % q->size] = item;
+  q->count++;
+  
+  q->puts++;
+  q->depthsum += q->count;
+  if ( q->count > q->maxdepth )
+    q->maxdepth = q->count;
+  
+  pthread_cond_signal (&q->notempty);
+  pthread_mutex_unlock (&q->lock);
+}  /* End of queue_put() */
+
+
+/***************************************************************************
+ * queue_get:
+ *
+ * Remove the item at the front of a queue, waiting while the queue is
+ * empty.
+ *
+ * Returns the item, or NULL if the queue is empty and closed
+ ***************************************************************************/
+static void *
+queue_get (struct stagequeue *q)
+{
+  struct timespec start;
+  void *item = NULL;
+  
+  pthread_mutex_lock (&q->lock);
+  
+  if ( q->count == 0 && ! q->closed )
+    {
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      while ( q->count == 0 && ! q->closed )
+	pthread_cond_wait (&q->notempty, &q->lock);
+      q->getstall += elapsedtime (&start);
+    }
+  
+  if ( q->count > 0 )
+    {
+      item = q->items[q->head];
+      q->head = (q->head + 1) % q->size;
+      q->count--;
+      
+      pthread_cond_signal (&q->notfull);
+    }
+  
+  pthread_mutex_unlock (&q->lock);
+  
+  return item;
+}  /* End of queue_get() */
+
+
+/***************************************************************************
+ * queue_close:
+ *
+ * Mark a queue as closed, no more items will be added.
+ ***************************************************************************/
+static void
+queue_close (struct stagequeue *q)
+{
+  pthread_mutex_lock (&q->lock);
+  q->closed = 1;
+  pthread_cond_broadcast (&q->notempty);
+  pthread_mutex_unlock (&q->lock);
+}  /* End of queue_close() */
+
+
+/***************************************************************************
+ * queue_report:
+ *
+ * Report the depth of a queue and the time its producer and consumer
+ * stages waited on it.
+ ***************************************************************************/
+static void
+queue_report (struct stagequeue *q, const char *name,
+	      const char *producer, const char *consumer)
+{
+  fprintf (stderr, "%s queue: depth max %d, mean %.2f of %d, "
+	   "%s stalled %.3f s, %s stalled %.3f s\n",
+	   name, q->maxdepth,
+	   ( q->puts > 0 ) ? (double) q->depthsum / q->puts : 0.0, q->size,
+	   producer, q->putstall, consumer, q->getstall);
+}  /* End of queue_report() */
+
+
+/***************************************************************************
+ * queue_free:
+ *
+ * Release the resources of a queue.
+ ***************************************************************************/
+static void
+queue_free (struct stagequeue *q)
+{
+  pthread_cond_destroy (&q->notfull);
+  pthread_cond_destroy (&q->notempty);
+  pthread_mutex_destroy (&q->lock);
+  free (q->items);
+}  /* End of queue_free() */
+
+
+/***************************************************************************
+ * elapsedtime:
+ *
+ * Returns the seconds elapsed since the specified monotonic time
+ ***************************************************************************/
+static double
+elapsedtime (struct timespec *start)
+{
+  struct timespec now;
+  
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}  /* End of elapsedtime() */
+
+
+/***************************************************************************
+ * addstats:
+ *
+ * Add the counters and stage times of stats to total.
+ ***************************************************************************/
+static void
+addstats (struct convstats *total, struct convstats *stats)
+{
+  total->files += stats->files;
+  total->failed += stats->failed;
+  total->databytes += stats->databytes;
+  total->scans += stats->scans;
+  total->missing += stats->missing;
+  total->segments += stats->segments;
+  total->gaps += stats->gaps;
+  total->packedsamples += stats->packedsamples;
+  total->packedrecords += stats->packedrecords;
+  total->outbytes += stats->outbytes;
+  total->header += stats->header;
+  total->read += stats->read;
+  total->swap += stats->swap;
+  total->split += stats->split;
+  total->pack += stats->pack;
+  total->write += stats->write;
+}  /* End of addstats() */
+
+
+/***************************************************************************
+ * reportfile:
+ *
+ * Add the statistics of a converted file to the totals and write them
+ * to the statistics file if requested.  Must be called for each file
+ * in input order and not concurrently.
+ ***************************************************************************/
+static void
+reportfile (struct convjob *job, int status)
+{
+  char **newdeferred;
+  int idx;
+  
+  job->stats.files = 1;
+  job->stats.failed = ( status ) ? 1 : 0;
+  
+  /* Record converted files in the manifest, deferring files written
+   * to the shared output file or the archive until it is closed.
+   * Archive day files are appended to and not recorded as outputs, so
+   * they do not cause unchanged files to be converted again. */
+  if ( manifest && ! status &&
+       ! mf_complete (manifest, job->binfile, job->stats.packedrecords,
+		      job->stats.packedsamples, job->outputs,
+		      ( archive ) ? 0 : job->noutputs) )
+    {
+      for ( idx = 0; idx < job->noutputs; idx++ )
+	if ( outfp && ! strcmp (job->outputs[idx], outfpname) )
+	  break;
+      
+      if ( archive || idx < job->noutputs )
+	{
+	  if ( ndeferred >= maxdeferred )
+	    {
+	      maxdeferred = ( maxdeferred ) ? maxdeferred * 2 : 64;
+	      
+	      if ( ! (newdeferred = (char **) realloc (deferred, sizeof(char *) * maxdeferred)) )
+		{
+		  fprintf (stderr, "Error allocating memory\n");
+		  exit (1);
+		}
+	      
+	      deferred = newdeferred;
+	    }
+	  
+	  deferred[ndeferred++] = job->binfile;
+	}
+      else if ( mf_commit (manifest, job->binfile) )
+	{
+	  fprintf (stderr, "Error writing manifest %s: %s\n",
+		   manifestfile, strerror(errno));
+	}
+    }
+  
+  freeoutputs (job);
+  
+  if ( statsfp )
+    {
+      fprintf (statsfp, "%s    {\"file\": ", ( totals.files ) ? ",\n" : "");
+      printjsonstring (job->binfile);
+      fprintf (statsfp, ", \"status\": \"%s\",\n     ", ( status ) ? "failed" : "ok");
+      printstats (&job->stats);
+      fprintf (statsfp, "}");
+    }
+  
+  addstats (&totals, &job->stats);
+}  /* End of reportfile() */
+
+
+/***************************************************************************
+ * openstats:
+ *
+ * Open the statistics file and start the JSON summary of the run.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+openstats (void)
+{
+  if ( ! (statsfp = fopen (statsfile, "w")) )
+    {
+      fprintf (stderr, "Error opening statistics file %s: %s\n",
+	       statsfile, strerror(errno));
+      return -1;
+    }
+  
+  fprintf (statsfp, "{\"program\": \"%s\", \"version\": \"%s\",\n", PACKAGE, VERSION);
+  fprintf (statsfp, " \"recordlength\": %d, \"encoding\": %d, \"kernel\": \"%s\",\n",
+	   ( packreclen > 0 ) ? packreclen : 4096, encoding, scan_kernelname ());
+  fprintf (statsfp, " \"files\": [\n");
+  
+  return 0;
+}  /* End of openstats() */
+
+
+/***************************************************************************
+ * closestats:
+ *
+ * Finish the JSON summary with the totals of the run, which took
+ * elapsed seconds, and close the statistics file.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+closestats (double elapsed)
+{
+  fprintf (statsfp, "%s ],\n \"totals\": {\"files\": %" PRId64 ", \"failed\": %" PRId64 ",\n     ",
+	   ( totals.files ) ? "\n" : "", totals.files, totals.failed);
+  printstats (&totals);
+  fprintf (statsfp, ",\n     \"elapsed\": %.6f, \"writecalls\": %" PRId64 "}\n}\n",
+	   elapsed, writecalls);
+  
+  if ( fclose (statsfp) )
+    {
+      fprintf (stderr, "Error writing statistics file %s: %s\n",
+	       statsfile, strerror(errno));
+      statsfp = 0;
+      return -1;
+    }
+  
+  statsfp = 0;
+  
+  return 0;
+}  /* End of closestats() */
+
+
+/***************************************************************************
+ * commitdeferred:
+ *
+ * Record the files written to the shared output file in the manifest
+ * if commit is set, after the file has been closed, and clear the
+ * list of deferred files.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+commitdeferred (flag commit)
+{
+  int retval = 0;
+  int idx;
+  
+  for ( idx = 0; manifest && commit && idx < ndeferred; idx++ )
+    {
+      if ( mf_commit (manifest, deferred[idx]) )
+	{
+	  fprintf (stderr, "Error writing manifest %s: %s\n",
+		   manifestfile, strerror(errno));
+	  retval = -1;
+	  break;
+	}
+    }
+  
+  ndeferred = 0;
+  
+  return retval;
+}  /* End of commitdeferred() */
+
+
+/***************************************************************************
+ * closemanifest:
+ *
+ * Record the files written to the shared output file in the manifest
+ * if commit is set, and close the manifest.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+closemanifest (flag commit)
+{
+  int retval = 0;
+  
+  if ( commitdeferred (commit) )
+    retval = -1;
+  
+  if ( mf_close (manifest) )
+    {
+      fprintf (stderr, "Error writing manifest %s: %s\n",
+	       manifestfile, strerror(errno));
+      retval = -1;
+    }
+  
+  if ( deferred )
+    free (deferred);
+  
+  manifest = 0;
+  deferred = 0;
+  ndeferred = maxdeferred = 0;
+  
+  return retval;
+}  /* End of closemanifest() */
+
+
+/***************************************************************************
+ * printstats:
+ *
+ * Print the counters and stage times of stats as JSON members to the
+ * statistics file.
+ ***************************************************************************/
+static void
+printstats (struct convstats *stats)
+{
+  fprintf (statsfp, "\"databytes\": %" PRId64 ", \"scans\": %" PRId64 ", "
+	   "\"missing\": %" PRId64 ", \"segments\": %" PRId64 ", \"gaps\": %" PRId64 ",\n     "
+	   "\"samples\": %" PRId64 ", \"records\": %" PRId64 ", \"outbytes\": %" PRId64 ",\n     ",
+	   stats->databytes, stats->scans, stats->missing, stats->segments,
+	   stats->gaps, stats->packedsamples, stats->packedrecords,
+	   stats->outbytes);
+  fprintf (statsfp, "\"seconds\": {\"header\": %.6f, \"read\": %.6f, \"swap\": %.6f, "
+	   "\"deinterleave\": %.6f, \"encode\": %.6f, \"write\": %.6f}",
+	   stats->header, stats->read, stats->swap, stats->split,
+	   stats->pack, stats->write);
+}  /* End of printstats() */
+
+
+/***************************************************************************
+ * printjsonstring:
+ *
+ * Print a string as a quoted JSON string to the statistics file.
+ ***************************************************************************/
+static void
+printjsonstring (const char *string)
+{
+  const unsigned char *cp;
+  
+  fputc ('"', statsfp);
+  
+  for ( cp = (const unsigned char *) string; *cp; cp++ )
+    {
+      if ( *cp == '"' || *cp == '\\' )
+	fprintf (statsfp, "\\%c", *cp);
+      else if ( *cp < 0x20 )
+	fprintf (statsfp, "\\u%04x", *cp);
+      else
+	fputc (*cp, statsfp);
+    }
+  
+  fputc ('"', statsfp);
+}  /* End of printjsonstring() */
+
+
+/***************************************************************************
+ * sweepconvert:
+ *
+ * Convert all input files with every combination of the supported
+ * record lengths and encodings, discarding the packed records, and
+ * print the output size, compression ratio relative to 32-bit samples
+ * and the packing rate in MB of samples per second for each.  Files
+ * are converted serially.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+sweepconvert (void)
+{
+  static const int reclens[] = { 512, 1024, 2048, 4096, 8192 };
+  static const int encodings[] = { 3, 10, 11 };
+  struct sweepresult {
+    int reclen;
+    int encoding;
+    int64_t samples;
+    int64_t records;
+    double packtime;
+  } results[5 * 3];
+  struct sweepresult *result;
+  struct listnode *flp;
+  struct convjob job;
+  struct convctx ctx;
+  int64_t bytes;
+  int nresults = 0;
+  int ridx;
+  int eidx;
+  
+  memset (&ctx, 0, sizeof(struct convctx));
+  
+  for ( ridx = 0; ridx < 5; ridx++ )
+    {
+      for ( eidx = 0; eidx < 3; eidx++ )
+	{
+	  result = &results[nresults++];
+	  memset (result, 0, sizeof(struct sweepresult));
+	  result->reclen = packreclen = reclens[ridx];
+	  result->encoding = encoding = encodings[eidx];
 	  
-	  if ( datacnt > 0 )
+	  for ( flp = filelist; flp != 0; flp = flp->next )
 	    {
-	      if ( verbose >= 1 )
-		{
-		  fprintf (stderr, "[%s] %d samps @ %.6f Hz for N: '%s', S: '%s', L: '%s', C: '%s'\n",
-			   binfile, datacnt, msr->samprate,
-			   msr->network, msr->station,  msr->location, msr->channel);
-		}
-	      
-	      /* Set start time and sample counts */
-	      msr->starttime = starttime + ((startidx / msr->samprate) * HPTMODULUS);
-	      msr->samplecnt = msr->numsamples = datacnt;
+	      memset (&job, 0, sizeof(struct convjob));
+	      job.codes = flp->codes;
+	      job.discard = 1;
 	      
-	      /* Pack data into records */
-	      if ( packmsr (msr) )
+	      if ( binconvert (flp->data, &job, NULL, &ctx) )
 		{
-		  fprintf (stderr, "[%s] Error packing Mini-SEED\n", binfile);
-		  break;
+		  ctx_free (&ctx);
+		  return -1;
 		}
+	      
+	      result->samples += job.stats.packedsamples;
+	      result->records += job.stats.packedrecords;
+	      result->packtime += job.stats.pack;
 	    }
 	}
     }
   
-  fclose (ifp);
+  ctx_free (&ctx);
   
-  if ( idata )
-    free (idata);
+  printf ("Reclen Encoding    Records          Bytes   Ratio      MB/s\n");
   
-  if ( cdata )
-    free (cdata);
-  
-  msr->datasamples = 0;
-  if ( msr )
-    msr_free (&msr);
+  for ( ridx = 0; ridx < nresults; ridx++ )
+    {
+      result = &results[ridx];
+      bytes = result->records * result->reclen;
+      
+      printf ("%6d %8d %10" PRId64 " %14" PRId64 " %7.3f %9.1f\n",
+	      result->reclen, result->encoding, result->records, bytes,
+	      ( bytes > 0 ) ? (double) result->samples * 4 / bytes : 0.0,
+	      ( result->packtime > 0 ) ? result->samples * 4 / result->packtime / 1e6 : 0.0);
+    }
   
   return 0;
-}  /* End of binconvert() */
+}  /* End of sweepconvert() */
 
 
 /***************************************************************************
@@ -411,6 +3439,10 @@ parameter_proc (int argcount, char **argvec)
 	{
 	  chanfiles = 1;
 	}
+      else if (strcmp (argvec[optind], "-P") == 0)
+	{
+	  chanthreads = 1;
+	}
       else if (strcmp (argvec[optind], "-n") == 0)
 	{
 	  network = getoptval(argcount, argvec, optind++);
@@ -426,6 +3458,15 @@ parameter_proc (int argcount, char **argvec)
       else if (strcmp (argvec[optind], "-r") == 0)
 	{
 	  packreclen = strtoul (getoptval(argcount, argvec, optind++), NULL, 10);
+	  
+	  /* A power of 2 from 256 to 8192 bytes */
+	  if ( packreclen < 256 || packreclen > 8192 ||
+	       (packreclen & (packreclen - 1)) != 0 )
+	    {
+	      fprintf (stderr, "Record length must be a power of 2 from 256 to 8192: %d\n",
+		       packreclen);
+	      exit (1);
+	    }
 	}
       else if (strcmp (argvec[optind], "-e") == 0)
 	{
@@ -434,11 +3475,125 @@ parameter_proc (int argcount, char **argvec)
       else if (strcmp (argvec[optind], "-b") == 0)
 	{
 	  byteorder = strtoul (getoptval(argcount, argvec, optind++), NULL, 10);
+	  
+	  if ( byteorder != 0 && byteorder != 1 )
+	    {
+	      fprintf (stderr, "Byte order must be 0 (LSBF) or 1 (MSBF): %d\n", byteorder);
+	      exit (1);
+	    }
 	}
       else if (strcmp (argvec[optind], "-o") == 0)
 	{
 	  outfile = getoptval(argcount, argvec, optind++);
 	}
+      else if (strcmp (argvec[optind], "-a") == 0)
+	{
+	  appendmode = 1;
+	}
+      else if (strcmp (argvec[optind], "-B") == 0)
+	{
+	  outbufsize = strtoul (getoptval(argcount, argvec, optind++), NULL, 10);
+	}
+      else if (strcmp (argvec[optind], "-D") == 0)
+	{
+	  outflags |= RW_DIRECT;
+	}
+      else if (strcmp (argvec[optind], "-U") == 0)
+	{
+	  outflags |= RW_DONTNEED;
+	}
+      else if (strcmp (argvec[optind], "-m") == 0)
+	{
+	  mapinput = 1;
+	}
+      else if (strcmp (argvec[optind], "-H") == 0)
+	{
+	  hugepages = 1;
+	}
+      else if (strcmp (argvec[optind], "-c") == 0)
+	{
+	  char *code = strtok (getoptval(argcount, argvec, optind++), ",");
+	  
+	  for ( nchancodes = 0; code; code = strtok (NULL, ",") )
+	    {
+	      if ( strlen (code) != 2 || nchancodes >= NIMS_MAXCHANNELS )
+		{
+		  fprintf (stderr, "Channel codes must be 1 to %d instrument and orientation codes\n",
+			   NIMS_MAXCHANNELS);
+		  exit (1);
+		}
+	      
+	      chancodes[nchancodes++] = code;
+	    }
+	  
+	  if ( nchancodes == 0 )
+	    {
+	      fprintf (stderr, "No channel codes specified\n");
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argvec[optind], "-g") == 0)
+	{
+	  char *mode = getoptval(argcount, argvec, optind++);
+	  
+	  if ( strcmp (mode, "table") == 0 )
+	    gapmode = GAPS_TABLE;
+	  else if ( strcmp (mode, "verify") == 0 )
+	    gapmode = GAPS_VERIFY;
+	  else if ( strcmp (mode, "scan") == 0 )
+	    gapmode = GAPS_SCAN;
+	  else
+	    {
+	      fprintf (stderr, "Unknown gap mode: %s\n", mode);
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argvec[optind], "-k") == 0)
+	{
+	  chunkscans = strtoul (getoptval(argcount, argvec, optind++), NULL, 10);
+	}
+      else if (strcmp (argvec[optind], "-j") == 0)
+	{
+	  workers = strtoul (getoptval(argcount, argvec, optind++), NULL, 10);
+	}
+      else if (strcmp (argvec[optind], "--sweep") == 0)
+	{
+	  sweep = 1;
+	}
+      else if (strcmp (argvec[optind], "--inventory") == 0)
+	{
+	  char *format = getoptval(argcount, argvec, optind++);
+	  
+	  if ( strcmp (format, "csv") == 0 )
+	    inventory = IV_CSV;
+	  else if ( strcmp (format, "json") == 0 )
+	    inventory = IV_JSON;
+	  else
+	    {
+	      fprintf (stderr, "Unknown inventory format: %s\n", format);
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argvec[optind], "--stats") == 0)
+	{
+	  statsfile = getoptval(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-Q") == 0)
+	{
+	  pipedepth = strtoul (getoptval(argcount, argvec, optind++), NULL, 10);
+	}
+      else if (strcmp (argvec[optind], "-M") == 0)
+	{
+	  manifestfile = getoptval(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "-A") == 0)
+	{
+	  archivedir = getoptval(argcount, argvec, optind++);
+	}
+      else if (strcmp (argvec[optind], "--maxopen") == 0)
+	{
+	  maxopen = strtoul (getoptval(argcount, argvec, optind++), NULL, 10);
+	}
       else if (strncmp (argvec[optind], "-", 1) == 0 &&
 	       strlen (argvec[optind]) > 1 )
 	{
@@ -464,6 +3619,71 @@ parameter_proc (int argcount, char **argvec)
   if ( verbose )
     fprintf (stderr, "%s version: %s\n", PACKAGE, VERSION);
   
+  /* The pipeline has a single stage of each kind */
+  if ( pipedepth > 0 && workers != 1 )
+    {
+      fprintf (stderr, "Option -Q cannot be combined with -j\n");
+      exit (1);
+    }
+  
+  /* The reader stage loads complete files, which would defeat -k */
+  if ( pipedepth > 0 && chunkscans > 0 )
+    {
+      fprintf (stderr, "Option -Q cannot be combined with -k\n");
+      exit (1);
+    }
+  
+  /* Workers keep the packed records of a file until its turn to be
+   * written, which would defeat -k */
+  if ( workers != 1 && chunkscans > 0 )
+    {
+      fprintf (stderr, "Option -j cannot be combined with -k\n");
+      exit (1);
+    }
+  
+  /* The single output file would be overwritten with skipped files missing */
+  if ( manifestfile && outfile )
+    {
+      fprintf (stderr, "Option -M cannot be combined with -o\n");
+      exit (1);
+    }
+  
+  if ( archivedir && outfile )
+    {
+      fprintf (stderr, "Option -A cannot be combined with -o\n");
+      exit (1);
+    }
+  
+  /* Records are rewritten in place, only serially packed channels
+   * can continue from the previous file */
+  if ( appendmode )
+    {
+      if ( ! outfile || strcmp (outfile, "-") == 0 )
+	{
+	  fprintf (stderr, "Option -a requires an output file specified with -o\n");
+	  exit (1);
+	}
+      
+      if ( workers != 1 || pipedepth > 0 || chanthreads || chunkscans > 0 )
+	{
+	  fprintf (stderr, "Option -a cannot be combined with -j, -Q, -P or -k\n");
+	  exit (1);
+	}
+    }
+  
+  if ( maxopen <= 0 )
+    {
+      fprintf (stderr, "Invalid number of open archive files: %d\n", maxopen);
+      exit (1);
+    }
+  
+  /* Use all online processors for a worker count of 0 */
+  if ( workers <= 0 )
+    {
+      long nprocs = sysconf (_SC_NPROCESSORS_ONLN);
+      workers = ( nprocs > 0 ) ? (int) nprocs : 1;
+    }
+  
   /* Sanity check encoding */
   if ( encoding != 3 && encoding != 10 && encoding != 11 )
     {
@@ -552,12 +3772,112 @@ getoptval (int argcount, char **argvec, int argopt)
 }  /* End of getoptval() */
 
 
+/***************************************************************************
+ * selectinputs:
+ *
+ * Open the manifest and remove input files from the file list that
+ * are unchanged since their conversion was recorded, preparing
+ * manifest entries for all other files.  An unchanged file is still
+ * converted if one of its output files is also an output of a file
+ * that is converted, as it would be overwritten.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+selectinputs (void)
+{
+  struct listnode *prevln, *ln, *nextln;
+  ManifestEntry **skipped = 0;
+  ManifestEntry *entry;
+  flag changed;
+  int nfiles = 0;
+  int idx;
+  
+  if ( ! (manifest = mf_open (manifestfile)) )
+    {
+      fprintf (stderr, "Error opening manifest %s: %s\n",
+	       manifestfile, strerror(errno));
+      return -1;
+    }
+  
+  for ( ln = filelist; ln != 0; ln = ln->next )
+    nfiles++;
+  
+  if ( ! (skipped = (ManifestEntry **) calloc (nfiles + 1, sizeof(ManifestEntry *))) )
+    {
+      fprintf (stderr, "Error allocating memory\n");
+      return -1;
+    }
+  
+  for ( idx = 0, ln = filelist; ln != 0; idx++, ln = ln->next )
+    {
+      if ( (entry = mf_lookup (manifest, ln->data)) && mf_unchanged (entry) )
+	skipped[idx] = entry;
+      else
+	mf_prepare (manifest, ln->data);
+    }
+  
+  /* Convert unchanged files sharing output with converted files */
+  do
+    {
+      changed = 0;
+      
+      for ( idx = 0; idx < nfiles; idx++ )
+	{
+	  if ( skipped[idx] && mf_overlaps (manifest, skipped[idx]) )
+	    {
+	      mf_prepare (manifest, skipped[idx]->path);
+	      skipped[idx] = 0;
+	      changed = 1;
+	    }
+	}
+    }
+  while ( changed );
+  
+  /* Remove the unchanged files from the list */
+  prevln = 0;
+  ln = filelist;
+  for ( idx = 0; ln != 0; idx++, ln = nextln )
+    {
+      nextln = ln->next;
+      
+      if ( ! skipped[idx] )
+	{
+	  prevln = ln;
+	  continue;
+	}
+      
+      if ( verbose )
+	fprintf (stderr, "Skipping unchanged %s\n", ln->data);
+      
+      if ( prevln )
+	prevln->next = nextln;
+      else
+	filelist = nextln;
+      
+      if ( ln->key )
+	free (ln->key);
+      if ( ln->codes )
+	freecodes (ln->codes);
+      free (ln->data);
+      free (ln);
+    }
+  
+  free (skipped);
+  
+  return 0;
+}  /* End of selectinputs() */
+
+
 /***************************************************************************
  * readlistfile:
  *
  * Read a list of files from a file and add them to the filelist for
  * input data.  The filename is expected to be the last
- * space-separated field on the line.
+ * space-separated field on the line.  Lines with four fields specify
+ * the network, station and location codes for the file as:
+ *
+ *   NET STA LOC filename
  *
  * Returns the number of file names parsed from the list or -1 on error.
  ***************************************************************************/
@@ -569,7 +3889,11 @@ readlistfile (char *listfile)
   char *ptr;
   int   filecnt = 0;
   
+  struct listnode *ln;
+  struct listnode *lastln = 0;
+  struct srccodes *codes;
   char  filename[1024];
+  char *fieldptr[4];
   char *lastfield = 0;
   int   fields = 0;
   int   wspace;
@@ -599,6 +3923,7 @@ readlistfile (char *listfile)
        * and track last field */
       fields = 0;
       wspace = 0;
+      lastfield = 0;
       ptr = line;
       while ( *ptr )
 	{
@@ -611,12 +3936,17 @@ readlistfile (char *listfile)
 	    {
 	      if ( wspace || ptr == line )
 		{
+		  if ( fields < 4 )
+		    fieldptr[fields] = ptr;
 		  fields++; lastfield = ptr;
 		}
 	      wspace = 0;
 	    }
 	  else
 	    {
+	      /* Terminate fields for the codes */
+	      if ( ! wspace && fields < 4 )
+		*ptr = '\0';
 	      wspace = 1;
 	    }
 	  
@@ -627,24 +3957,50 @@ readlistfile (char *listfile)
       if ( ! lastfield )
 	continue;
       
-      if ( fields >= 1 && fields <= 3 )
+      if ( fields >= 1 && fields <= 4 )
 	{
+	  codes = 0;
+	  if ( fields == 4 &&
+	       ! (codes = parsecodes (fieldptr[0], fieldptr[1], fieldptr[2])) )
+	    {
+	      fprintf (stderr, "Error parsing codes for %s in list file %s\n",
+		       lastfield, listfile);
+	      continue;
+	    }
+	  
 	  fields = sscanf (lastfield, "%s", filename);
 	  
 	  if ( fields != 1 )
 	    {
 	      fprintf (stderr, "Error parsing file name from: %s\n", line);
+	      if ( codes )
+		freecodes (codes);
 	      continue;
 	    }
 	  
 	  if ( verbose > 1 )
-	    fprintf (stderr, "Adding '%s' to input file list\n", filename);
+	    {
+	      if ( codes )
+		fprintf (stderr, "Adding '%s' to input file list as %s_%s_%s\n",
+			 filename, codes->network, codes->station, codes->location);
+	      else
+		fprintf (stderr, "Adding '%s' to input file list\n", filename);
+	    }
 	  
-	  addnode (&filelist, NULL, filename);
+	  /* Append after the last node added instead of searching
+	   * the end of the list for each file of a long list */
+	  if ( (ln = addnode (( lastln ) ? &lastln : &filelist, NULL, filename)) )
+	    {
+	      ln->codes = codes;
+	      lastln = ln;
+	    }
 	  filecnt++;
 	  
 	  continue;
 	}
+      
+      fprintf (stderr, "Skipping line with %d fields in list file %s\n",
+	       fields, listfile);
     }
   
   fclose (fp);
@@ -653,12 +4009,70 @@ readlistfile (char *listfile)
 }  /* End readlistfile() */
 
 
+/***************************************************************************
+ * parsecodes:
+ *
+ * Create the SEED codes of a list file entry.  A location of "--"
+ * specifies a blank location code.  The network and station codes are
+ * limited to 2 and 5 characters and the location code to 2.
+ *
+ * Returns the new codes on success, and NULL on failure
+ ***************************************************************************/
+static struct srccodes *
+parsecodes (char *net, char *sta, char *loc)
+{
+  struct srccodes *codes;
+  
+  if ( strlen (net) > 2 || strlen (sta) > 5 || strlen (loc) > 2 )
+    return NULL;
+  
+  if ( ! strcmp (loc, "--") )
+    loc = "";
+  
+  if ( ! (codes = (struct srccodes *) calloc (1, sizeof(struct srccodes))) )
+    return NULL;
+  
+  codes->network = strdup (net);
+  codes->station = strdup (sta);
+  codes->location = strdup (loc);
+  
+  if ( ! codes->network || ! codes->station || ! codes->location )
+    {
+      freecodes (codes);
+      return NULL;
+    }
+  
+  return codes;
+}  /* End of parsecodes() */
+
+
+/***************************************************************************
+ * freecodes:
+ *
+ * Free SEED codes of a list file entry.
+ ***************************************************************************/
+static void
+freecodes (struct srccodes *codes)
+{
+  if ( codes->network )
+    free (codes->network);
+  if ( codes->station )
+    free (codes->station);
+  if ( codes->location )
+    free (codes->location);
+  
+  free (codes);
+}  /* End of freecodes() */
+
+
 /***************************************************************************
  * addnode:
  *
  * Add node to the specified list.
+ *
+ * Returns the new node, or NULL on failure
  ***************************************************************************/
-static void
+static struct listnode *
 addnode (struct listnode **listroot, char *key, char *data)
 {
   struct listnode *lastlp, *newlp;
@@ -666,7 +4080,7 @@ addnode (struct listnode **listroot, char *key, char *data)
   if ( data == NULL )
     {
       fprintf (stderr, "addnode(): No file name specified\n");
-      return;
+      return NULL;
     }
   
   lastlp = *listroot;
@@ -691,23 +4105,171 @@ addnode (struct listnode **listroot, char *key, char *data)
   else
     lastlp->next = newlp;
   
+  return newlp;
 }  /* End of addnode() */
 
 
+/***************************************************************************
+ * inventoryscan:
+ *
+ * Read the headers of all input files with a pool of worker threads
+ * and print the catalog to standard output, all other output is sent
+ * to stderr.
+ *
+ * Returns 0 on success, and 1 on failure
+ ***************************************************************************/
+static int
+inventoryscan (void)
+{
+  struct listnode *flp;
+  struct timespec start;
+  InvEntry *entries;
+  FILE *catfp;
+  int catfd;
+  int count = 0;
+  int failed;
+  int idx;
+  
+  for ( flp = filelist; flp != 0; flp = flp->next )
+    count++;
+  
+  if ( ! (entries = (InvEntry *) calloc (count, sizeof(InvEntry))) )
+    {
+      fprintf (stderr, "Error allocating memory\n");
+      return 1;
+    }
+  
+  for ( flp = filelist, idx = 0; flp != 0; flp = flp->next, idx++ )
+    entries[idx].path = flp->data;
+  
+  /* Keep the messages of the readers out of the catalog */
+  fflush (stdout);
+  
+  if ( (catfd = dup (STDOUT_FILENO)) < 0 ||
+       dup2 (STDERR_FILENO, STDOUT_FILENO) < 0 ||
+       ! (catfp = fdopen (catfd, "w")) )
+    {
+      fprintf (stderr, "Error redirecting standard output: %s\n", strerror(errno));
+      free (entries);
+      return 1;
+    }
+  
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  
+  if ( (failed = iv_scan (entries, count, workers)) < 0 )
+    {
+      fprintf (stderr, "Error creating worker thread: %s\n", strerror(errno));
+      fclose (catfp);
+      free (entries);
+      return 1;
+    }
+  
+  if ( verbose )
+    fprintf (stderr, "Read headers of %d files in %.3f seconds with %d workers, %d failed\n",
+	     count, elapsedtime (&start), workers, failed);
+  
+  if ( iv_print (catfp, entries, count, inventory) | fclose (catfp) )
+    {
+      fprintf (stderr, "Error writing inventory: %s\n", strerror(errno));
+      failed = -1;
+    }
+  
+  iv_free (entries, count);
+  free (entries);
+  
+  return ( failed < 0 ) ? 1 : 0;
+}  /* End of inventoryscan() */
+
+
 /***************************************************************************
  * record_handler:
- * Saves passed records to the output file.
+ * Saves passed records to the output file of the segment.  When
+ * appending, the first record replaces the last record of the channel
+ * if requested and each record is kept as the last of the channel.
  ***************************************************************************/
 static void
-record_handler (char *record, int reclen, void *vofp)
+record_handler (char *record, int reclen, void *vso)
 {
-  if ( fwrite(record, reclen, 1, (FILE *)vofp) != 1 )
+  struct segout *so = (struct segout *) vso;
+  struct timespec start;
+  off_t offset;
+  int status;
+  
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  
+  offset = so->ofp->offset + (off_t) so->ofp->buflen;
+  
+  if ( so->replace )
+    {
+      offset = so->append->offset;
+      status = rw_pwrite (so->ofp, record, reclen, offset);
+      
+      /* The rewritten record does not add to the output */
+      so->job->stats.packedrecords--;
+      so->job->stats.outbytes -= reclen;
+      appendstate->continued++;
+      so->replace = 0;
+    }
+  else
+    {
+      status = rw_write (so->ofp, record, reclen);
+    }
+  
+  if ( status )
+    {
+      fprintf (stderr, "Error writing to output file: %s\n", strerror(errno));
+    }
+  else if ( so->append && ap_update (so->append, record, reclen, offset) )
     {
-      fprintf (stderr, "Error writing to output file\n");
+      fprintf (stderr, "Error allocating memory\n");
     }
+  
+  so->job->stats.write += elapsedtime (&start);
 }  /* End of record_handler() */
 
 
+/***************************************************************************
+ * discard_handler:
+ * Discards passed records, they are only counted.
+ ***************************************************************************/
+static void
+discard_handler (char *record, int reclen, void *handlerdata)
+{
+}  /* End of discard_handler() */
+
+
+/***************************************************************************
+ * segbuf_handler:
+ * Appends passed records to the segment buffer.
+ ***************************************************************************/
+static void
+segbuf_handler (char *record, int reclen, void *vseg)
+{
+  struct segbuf *seg = (struct segbuf *) vseg;
+  size_t newsize;
+  char *newrecords;
+  
+  if ( seg->recsize + reclen > seg->maxrecsize )
+    {
+      newsize = ( seg->maxrecsize ) ? seg->maxrecsize * 2 : 16 * (size_t) reclen;
+      while ( newsize < seg->recsize + reclen )
+	newsize *= 2;
+      
+      if ( ! (newrecords = (char *) realloc (seg->records, newsize)) )
+	{
+	  fprintf (stderr, "Error allocating memory for output records\n");
+	  return;
+	}
+      
+      seg->records = newrecords;
+      seg->maxrecsize = newsize;
+    }
+  
+  memcpy (seg->records + seg->recsize, record, reclen);
+  seg->recsize += reclen;
+}  /* End of segbuf_handler() */
+
+
 /***************************************************************************
  * usage:
  * Print the usage message and exit.
@@ -725,6 +4287,15 @@ usage (void)
 	   " -v             Be more verbose, multiple flags can be used\n"
 	   " -S             Include SEED blockette 100 for very irrational sample rates\n"
 	   " -C             Create a separate output file for each channel segment\n"
+	   " -P             Pack the channels of each file concurrently\n"
+	   " -k scans       Stream input data in chunks of scans with bounded memory,\n"
+	   "                  cannot be combined with -j or -Q\n"
+	   " -m             Memory map input files and read data scans in place\n"
+	   " -H             Use huge pages for conversion buffers\n"
+	   " -g mode        Locate missing data using the header gap table or by\n"
+	   "                  scanning values: table (default), verify or scan\n"
+	   " -c codes       Instrument and orientation codes of the channels of each\n"
+	   "                  scan, default: FN,FE,FZ,QN,QE then Q1,Q2,KI\n"
 	   " -n network     Specify the SEED network code (currently %s)\n"
 	   " -s station     Specify the SEED station code, default is blank\n"
 	   " -l location    Specify the SEED location code, default is blank\n"
@@ -733,6 +4304,24 @@ usage (void)
 	   " -b byteorder   Specify byte order for packing, MSBF: 1 (default), LSBF: 0\n"
 	   "\n"
 	   " -o outfile     Specify output file, default is %s.STA.yyyy-mm-ddTHH:MM:SS\n"
+	   "                  '-' writes to standard output\n"
+	   " -a             Append to the output file, continuing its channels\n"
+	   " -j workers     Convert files concurrently with a pool of worker threads,\n"
+	   "                  0 uses all processors, default: 1\n"
+	   " --sweep        Pack with all record lengths and encodings and report\n"
+	   "                  output size, compression ratio and MB/s\n"
+	   " --inventory fmt\n"
+	   "                  Print the header information of the input files as csv\n"
+	   "                  or json without converting them, using -j workers\n"
+	   " -Q depth       Read, pack and write files in a pipeline with queues\n"
+	   "                  of depth files, cannot be combined with -j or -k\n"
+	   " --stats file   Write stage times and counters of each file as JSON\n"
+	   " -M manifest    Skip files unchanged since recorded in the manifest file\n"
+	   " -A archive     Write records to SDS day files in the archive directory\n"
+	   " --maxopen n    Keep at most n archive files open, default: %d\n"
+	   " -B bytes       Specify output buffer size, default: 8388608\n"
+	   " -D             Write output files with direct I/O (O_DIRECT)\n"
+	   " -U             Release written output from the page cache\n"
 	   "\n"
 	   " file(s)        File(s) of input data\n"
 	   "                  If a file is prefixed with an '@' it is assumed to contain\n"
@@ -742,5 +4331,5 @@ usage (void)
            " 3  : 32-bit integers\n"
            " 10 : Steim 1 compression 32-bit integers\n"
            " 11 : Steim 2 compression 32-bit integers (default)\n"
-	   "\n", network, network);
+	   "\n", network, network, AR_MAXOPEN);
 }  /* End of usage() */
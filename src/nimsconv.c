@@ -0,0 +1,340 @@
+/***************************************************************************
+ * nimsconv.c
+ *
+ * Conversion of nimsread bin data to an MSTraceList in memory, for
+ * programs using the bin reader as a library instead of running
+ * mt2mseed.  Raw NIMS DATA.BIN streams are recognized and decoded
+ * with read_raw_scans() first.
+ *
+ * The header is parsed with parse_bin_header() and the scans are split
+ * into channels with scan_deinterleave() and scan_gapruns(), the same
+ * code used by mt2mseed.  Each run of samples without missing values
+ * is added to the trace list as a segment, the trace list merges
+ * contiguous runs of the same channel.  The traces can be packed into
+ * records with mst_pack().
+ *
+ * The routines keep no state between calls and may be used by several
+ * threads concurrently, each with its own trace list.  Errors and
+ * warnings are logged with ms_log(), which can be redirected with
+ * ms_loginit(), and nothing is printed to standard output.
+ ***************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nimsconv.h"
+#include "readNIMSraw.h"
+#include "scankern.h"
+
+static int addchannel (MSTraceList *mstl, MSRecord *msr, const int32_t *samples,
+		       const uint8_t *gapmask, int nscans, int channel,
+		       int missing, hptime_t starttime, ScanRun **runs,
+		       int *maxruns);
+
+
+/***************************************************************************
+ * nims_readbuffer:
+ *
+ * Convert a complete bin file or raw NIMS stream held in buf to traces
+ * in an MSTraceList, using the specified network, station and location
+ * codes, which may be NULL for blank codes.  The buffer is not
+ * modified and does not need to be aligned.
+ *
+ * If *ppmstl is NULL a new MSTraceList is allocated, otherwise the
+ * traces are added to the existing list.  The caller must free the
+ * list with mstl_free().  If hdr is not NULL the parsed header is
+ * returned in it.
+ *
+ * Returns the number of samples added on success, and -1 on failure
+ ***************************************************************************/
+int
+nims_readbuffer (const char *buf, size_t buflen, const char *network,
+		 const char *station, const char *location,
+		 MSTraceList **ppmstl, NIMSheader *hdr)
+{
+  NIMSheader header;
+  MSRecord *msr = 0;
+  ScanRun *runs = 0;
+  int32_t *chandata = 0;
+  int32_t *chans[SCAN_MAXCHANNELS];
+  uint8_t *gapmask = 0;
+  int32_t *decoded = 0;
+  const int32_t *scans;
+  char chan[6];
+  size_t dataoffset;
+  hptime_t starttime;
+  float samprate;
+  int maxruns = 0;
+  int raw;
+  int missing;
+  int channel;
+  int nscans;
+  int yday;
+  int count;
+  int total = 0;
+
+  if ( ! buf || ! ppmstl )
+    return -1;
+
+  if ( ! hdr )
+    hdr = &header;
+
+  raw = is_raw_file (buf, buflen);
+
+  if ( raw )
+    {
+      if ( ! parse_raw_header (buf, buflen, hdr, 0) )
+	{
+	  ms_log (2, "nims_readbuffer(): Cannot locate raw NIMS data blocks\n");
+	  return -1;
+	}
+      
+      dataoffset = 0;
+    }
+  else if ( ! parse_bin_header (buf, buflen, hdr, &dataoffset, 0) )
+    {
+      ms_log (2, "nims_readbuffer(): Cannot parse bin file header\n");
+      return -1;
+    }
+
+  nscans = hdr->nscans;
+  samprate = 1 / hdr->dt;
+
+  if ( samprate <= 0.0 )
+    {
+      ms_log (2, "nims_readbuffer(): Invalid sampling time: %g\n", hdr->dt);
+      return -1;
+    }
+
+  if ( nscans < 0 || hdr->nchannels <= 0 )
+    {
+      ms_log (2, "nims_readbuffer(): Unexpected data array size (%lld bytes) for %d scans\n",
+	      (long long) hdr->datalen, nscans);
+      return -1;
+    }
+
+  if ( ms_md2doy (hdr->start_time[0], hdr->start_time[1],
+		  hdr->start_time[2], &yday) )
+    {
+      ms_log (2, "nims_readbuffer(): Invalid start date: %d-%02d-%02d\n",
+	      hdr->start_time[0], hdr->start_time[1], hdr->start_time[2]);
+      return -1;
+    }
+
+  starttime = ms_time2hptime (hdr->start_time[0], yday, hdr->start_time[3],
+			      hdr->start_time[4], hdr->start_time[5], 0);
+
+  if ( ! *ppmstl && ! (*ppmstl = mstl_init (NULL)) )
+    {
+      ms_log (2, "nims_readbuffer(): Cannot allocate trace list\n");
+      return -1;
+    }
+
+  if ( nscans == 0 )
+    return 0;
+
+  /* Split the scans into channel arrays, byte swapping as needed */
+  if ( ! (chandata = (int32_t *) malloc (sizeof(int32_t) * hdr->nchannels * (size_t) nscans)) ||
+       ! (gapmask = (uint8_t *) malloc ((size_t) nscans)) ||
+       ! (msr = msr_init (NULL)) )
+    {
+      ms_log (2, "nims_readbuffer(): Cannot allocate memory\n");
+      free (chandata);
+      free (gapmask);
+      return -1;
+    }
+
+  for ( channel=0; channel < hdr->nchannels; channel++ )
+    chans[channel] = chandata + ((size_t) channel * nscans);
+
+  scans = (const int32_t *) (buf + dataoffset);
+
+  /* Raw samples are decoded to scans in host byte order first */
+  if ( raw )
+    {
+      if ( ! (decoded = (int32_t *) malloc ((size_t) hdr->datalen)) ||
+	   ! read_raw_scans (buf, buflen, hdr, decoded) )
+	{
+	  ms_log (2, "nims_readbuffer(): Cannot decode raw NIMS data\n");
+	  msr_free (&msr);
+	  free (decoded);
+	  free (chandata);
+	  free (gapmask);
+	  return -1;
+	}
+
+      scans = decoded;
+    }
+  /* The data of a split record is joined in a copy, the buffer is constant */
+  else if ( hdr->nsubrecs > 1 )
+    {
+      if ( ! (decoded = (int32_t *) malloc ((size_t) hdr->datalen)) )
+	{
+	  ms_log (2, "nims_readbuffer(): Cannot allocate memory\n");
+	  msr_free (&msr);
+	  free (chandata);
+	  free (gapmask);
+	  return -1;
+	}
+
+      join_bin_data ((char *) decoded, buf, dataoffset, hdr);
+      scans = decoded;
+    }
+
+  missing = scan_deinterleave (scans, nscans, hdr->nchannels, hdr->swapflag,
+			       chans, hdr->missingdataflag, gapmask);
+  free (decoded);
+
+  /* Template record for the segments, samples are not copied */
+  ms_strncpclean (msr->network, ( network ) ? network : "", 2);
+  ms_strncpclean (msr->station, ( station ) ? station : "", 5);
+  ms_strncpclean (msr->location, ( location ) ? location : "", 2);
+  msr->dataquality = 'D';
+  msr->sampletype = 'i';
+  msr->samprate = samprate;
+
+  for ( channel=0; channel < hdr->nchannels; channel++ )
+    {
+      if ( get_chan_name (samprate, channel+1, chan) != 1 )
+	{
+	  ms_log (2, "nims_readbuffer(): Cannot determine channel code for %.6f Hz\n",
+		  samprate);
+	  total = -1;
+	  break;
+	}
+
+      ms_strncpclean (msr->channel, chan, 3);
+
+      if ( (count = addchannel (*ppmstl, msr, chans[channel], gapmask, nscans,
+				channel, missing, starttime, &runs, &maxruns)) < 0 )
+	{
+	  total = -1;
+	  break;
+	}
+
+      total += count;
+    }
+
+  msr->datasamples = 0;
+  msr_free (&msr);
+  free (runs);
+  free (chandata);
+  free (gapmask);
+
+  return total;
+}  /* End of nims_readbuffer() */
+
+
+/***************************************************************************
+ * nims_readfile:
+ *
+ * Convert the bin file at path to traces in an MSTraceList with
+ * nims_readbuffer().  The file is memory mapped for the conversion.
+ *
+ * Returns the number of samples added on success, and -1 on failure
+ ***************************************************************************/
+int
+nims_readfile (const char *path, const char *network, const char *station,
+	       const char *location, MSTraceList **ppmstl, NIMSheader *hdr)
+{
+  struct stat st;
+  void *map;
+  int retval;
+  int fd;
+
+  if ( (fd = open (path, O_RDONLY)) < 0 )
+    {
+      ms_log (2, "Cannot open input file: %s (%s)\n", path, strerror(errno));
+      return -1;
+    }
+
+  if ( fstat (fd, &st) || st.st_size <= 0 || (uint64_t) st.st_size > SIZE_MAX )
+    {
+      ms_log (2, "[%s] Error reading input file\n", path);
+      close (fd);
+      return -1;
+    }
+
+  map = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+
+  if ( map == MAP_FAILED )
+    {
+      ms_log (2, "Cannot map input file: %s (%s)\n", path, strerror(errno));
+      return -1;
+    }
+
+  madvise (map, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+  if ( (retval = nims_readbuffer ((const char *) map, (size_t) st.st_size,
+				  network, station, location, ppmstl, hdr)) < 0 )
+    ms_log (2, "[%s] Error reading input file\n", path);
+
+  munmap (map, (size_t) st.st_size);
+
+  return retval;
+}  /* End of nims_readfile() */
+
+
+/***************************************************************************
+ * addchannel:
+ *
+ * Add the runs of samples without missing values of a channel to the
+ * trace list, using msr as the template for each segment.  If no
+ * samples of any channel are missing the channel is added as a single
+ * run without scanning the gap mask.
+ *
+ * Returns the number of samples added on success, and -1 on failure
+ ***************************************************************************/
+static int
+addchannel (MSTraceList *mstl, MSRecord *msr, const int32_t *samples,
+	    const uint8_t *gapmask, int nscans, int channel, int missing,
+	    hptime_t starttime, ScanRun **runs, int *maxruns)
+{
+  ScanRun onerun;
+  ScanRun *chanruns = &onerun;
+  int nruns = 1;
+  int runidx;
+  int total = 0;
+
+  onerun.start = 0;
+  onerun.length = nscans;
+
+  if ( missing )
+    {
+      if ( (nruns = scan_gapruns (gapmask, nscans, channel, runs, maxruns)) < 0 )
+	{
+	  ms_log (2, "nims_readbuffer(): Cannot allocate memory\n");
+	  return -1;
+	}
+
+      chanruns = *runs;
+    }
+
+  for ( runidx=0; runidx < nruns; runidx++ )
+    {
+      msr->starttime = starttime + ((chanruns[runidx].start / msr->samprate) * HPTMODULUS);
+      msr->samplecnt = msr->numsamples = chanruns[runidx].length;
+      msr->datasamples = (void *) (samples + chanruns[runidx].start);
+
+      if ( ! mstl_addmsr (mstl, msr, 0, 1, -1.0, -1.0) )
+	{
+	  ms_log (2, "nims_readbuffer(): Cannot add segment of %s_%s_%s_%s\n",
+		  msr->network, msr->station, msr->location, msr->channel);
+	  return -1;
+	}
+
+      total += chanruns[runidx].length;
+    }
+
+  return total;
+}  /* End of addchannel() */
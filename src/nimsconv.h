@@ -0,0 +1,24 @@
+#ifndef NIMSCONV_H
+#define NIMSCONV_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <libmseed.h>
+
+#include "readNIMSbin.h"
+
+int nims_readbuffer (const char *buf, size_t buflen, const char *network,
+		     const char *station, const char *location,
+		     MSTraceList **ppmstl, NIMSheader *hdr);
+int nims_readfile (const char *path, const char *network,
+		   const char *station, const char *location,
+		   MSTraceList **ppmstl, NIMSheader *hdr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NIMSCONV_H */
@@ -15,20 +15,31 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 
 #include <libmseed.h>
 
+#include "readNIMSbin.h"
+#include "scankern.h"
+
+/* Instrument and orientation codes of the channels of a scan, scans of
+ * fewer channels use the first ones */
+const char *nims_chancodes[NIMS_MAXCHANNELS] = {
+	"FN", "FE", "FZ", "QN", "QE", "Q1", "Q2", "KI"
+};
+
+static int get_bin_length (const char *buf, int32_t *rl, int *swapflag);
+static int parse_bin_record (const char *buf, size_t buflen, NIMSheader *hdr,
+			     size_t *dataoffset, int verbose);
+static int set_bin_subrecord (NIMSheader *hdr, int32_t marker);
+static void set_bin_channels (NIMSheader *hdr);
+static int next_bin_subrecord (FILE *f, NIMSheader *hdr);
+
 /* ======================================================================= */
-int get_chan_name (float freq, int chan_index, char *chan_name)
+static int get_band_code (float freq, char *band_code)
 {
-	//  1 HZ example:
-	//	char chan_name[5][4]={{"LFN\0"},
-	//	                {"LFE\0"},
-	//	                {"LFZ\0"},
-	//	                {"LQN\0"},
-	//	                {"LQE\0"}
-	//	               };
-	
+	/* Determines the SEED band code for a sampling rate. */
+
 	char BandCode;
 
 	if (10 <= freq && freq < 80) {
@@ -54,204 +65,631 @@ int get_chan_name (float freq, int chan_index, char *chan_name)
 		return 0;
 	}
 
+	*band_code = BandCode;
+	return 1;
+}
+
+/* ======================================================================= */
+int get_chan_name (float freq, int chan_index, char *chan_name)
+{
+	//  1 HZ example:
+	//	char chan_name[5][4]={{"LFN\0"},
+	//	                {"LFE\0"},
+	//	                {"LFZ\0"},
+	//	                {"LQN\0"},
+	//	                {"LQE\0"}
+	//	               };
+	//  Scans of 7 channels add two electric dipoles (LQ1, LQ2) and
+	//  scans of 8 channels a temperature channel (LKI).
+	
+	if (chan_index < 1 || chan_index > NIMS_MAXCHANNELS) {
+		printf("We only know channel names for the first %d channels\n", NIMS_MAXCHANNELS);
+		return 0;		
+	}
+
+	return get_chan_code(freq, nims_chancodes[chan_index-1], chan_name);
+}
+
+/* ======================================================================= */
+int get_chan_code (float freq, const char *code, char *chan_name)
+{
+	/* Builds the channel name from the band code of the sampling rate
+	 * and the instrument and orientation codes in code, such as "FN". */
+
+	char BandCode;
+
+	if (strlen(code) != 2) {
+		printf("Channel code %s is not an instrument and orientation code\n", code);
+		return 0;
+	}
+
+	if ( ! get_band_code(freq, &BandCode) )
+		return 0;
+
 	/* adding a "\0" to stop the string. I use pointer to access the array. 
 	 the string will be the while array if the "\0" is not there.
 	*/
-	if (chan_index == 1) {
-		sprintf(chan_name,"%cFN",BandCode);
-	} else if (chan_index == 2) {
-		sprintf(chan_name,"%cFE",BandCode);
-	} else if (chan_index == 3) {
-		sprintf(chan_name,"%cFZ",BandCode);
-	} else if (chan_index == 4) {
-		sprintf(chan_name,"%cQN",BandCode);
-	} else if (chan_index == 5) {
-		sprintf(chan_name,"%cQE",BandCode);
-	} else {
-		printf("We only know channel names for the first five channels");
-		return 0;		
-	}
+	sprintf(chan_name,"%c%s",BandCode,code);
 
 	return 1;
 }
 
 /* ======================================================================= */
-int read_bin_file (FILE *f, float *s_rate, int *nscans, int *start_time, 
-		   int32_t **data, int *missingdataflag)
+int read_bin_header (FILE *f, NIMSheader *hdr, int verbose)
 {
-	/* Reads from the Fortran binary nimsread output *.bin file.
+	/* Reads the header record from the Fortran binary nimsread output
+	 * *.bin file and the length marker of the following data record,
+	 * leaving the file positioned at the first data sample.
 	 * Note that both Fortran and Matlab programs that write those files
 	 * use 32-bit floating point and integers, irrespective of the platform
 	 * on which the file was written. Therefore, instead of using
 	 * sizeof(long int) for 32-bit platforms and sizeof(int) for 64-bit,
-	 * use 4 for the length of an integer record in all fread statements */
-
-	/* pointers and record length indicators */
-    int32_t *itmp;
-	int32_t rl, padded_rl, j1, j2;
-	/* meta data from header */
-	float lat, lon, decl, dt, elev;
-	//int start_time[6];
-	int32_t clock_zero[6];
-	int32_t gaptyp, ngaps, nskip;
-	int32_t *gaps;
-	int swapflag = 0;
+	 * use 4 for the length of an integer record in all fread statements.
+	 * Once its length is known the record is read in a single fread
+	 * and parsed from memory with parse_bin_record(). The header
+	 * information is only printed if verbose is set.
+	 * A data record split into subrecords is walked to its end to
+	 * determine its length, then the file is positioned back. */
+
+	char buf[4 + NIMS_MAXHEADER + 8];
+	NIMSheader walk;
+	size_t dataoffset;
+	int64_t datalen;
+	off_t pos;
+	int32_t rl;
+	int swapflag;
+
+	/* read the header length record */
+	if (fread(buf, 4, 1, f) != 1) {
+		ms_log(2, "cannot read the header length record in read_bin_file\n");
+		return 0;
+	}
+
+	/* an invalid length is reported by parse_bin_record() */
+	if ( ! get_bin_length(buf, &rl, &swapflag) )
+		return parse_bin_record(buf, 4, hdr, &dataoffset, verbose);
+
+	/* read the header, its end marker and the data length record */
+	if (fread(buf + 4, 1, (size_t) rl + 8, f) != (size_t) rl + 8) {
+		ms_log(2, "cannot read the header record in read_bin_file\n");
+		return 0;
+	}
+
+	if ( ! parse_bin_record(buf, 4 + (size_t) rl + 8, hdr, &dataoffset, verbose) )
+		return 0;
+
+	if ( hdr->subcont ) {
+		walk = *hdr;
+		if ( (pos = ftello(f)) < 0 ||
+		     (datalen = skip_bin_data(f, &walk)) < 0 ||
+		     fseeko(f, pos, SEEK_SET) ) {
+			ms_log(2, "cannot read the data subrecords in read_bin_file\n");
+			return 0;
+		}
+		hdr->datalen = datalen;
+		hdr->nsubrecs = walk.subrecno + 1;
+		if ( verbose ) printf("Data record of %lld bytes in %d subrecords\n",
+				      (long long) datalen, hdr->nsubrecs);
+	}
+	set_bin_channels(hdr);
+
+	return 1;
+}
+
+/* ======================================================================= */
+static int get_bin_length (const char *buf, int32_t *rl, int *swapflag)
+{
+	/* Determines the header length from the first record marker and if
+	 * byte swapping is needed: the number of gaps implied by the length
+	 * must be reasonable (0 to 100) unless the header is padded. Returns
+	 * 0 if the length is invalid in both byte orders, the swapped
+	 * length is returned in rl. */
+
+	int32_t padded_rl = 5108; /* (256*5-3)*4 */
+	int32_t ngaps;
+
+	memcpy(rl, buf, 4);
+	*swapflag = 0;
+	ngaps = (*rl/4 - 21)/3;
+
+	if (( ngaps < 0 || ngaps > 100 ) && (*rl != padded_rl)) {
+	  ms_gswap4a (rl);
+
+	  ngaps = (*rl/4 - 21)/3;
+
+	  if (( ngaps < 0 || ngaps > 100 ) && (*rl != padded_rl))
+	    return 0;
+
+	  *swapflag = 1;
+	}
+
+	return 1;
+}
+
+/* ======================================================================= */
+static int get_bin_values (const char *buf, size_t buflen, size_t *pos,
+			   void *values, int count, int swapflag)
+{
+	/* Copies the next count 32-bit values from a buffer at *pos,
+	 * swapping as needed, and advances *pos. Returns 0 if the buffer
+	 * is too short. */
+
+	int32_t *ivalues = (int32_t *) values;
 	int idx;
-	/* main data block */
-	//long int *data;
-	
+
+	if ( count < 0 || (size_t) count > (buflen - *pos) / 4 )
+		return 0;
+
+	memcpy(values, buf + *pos, 4 * (size_t) count);
+	if ( swapflag ) { for ( idx=0; idx < count; idx++) { ms_gswap4a(ivalues+idx); } }
+	*pos += 4 * (size_t) count;
+
+	return 1;
+}
+
+/* ======================================================================= */
+static int parse_bin_record (const char *buf, size_t buflen, NIMSheader *hdr,
+			     size_t *dataoffset, int verbose)
+{
+	/* Parses the header record and the length marker of the data
+	 * record from a buffer holding at least the start of a nimsread
+	 * *.bin file. On success the offset of the first data sample in
+	 * the buffer is returned in dataoffset. The header information is
+	 * only printed if verbose is set, errors are always printed. */
+
+	size_t pos;
+	float location[5];
+	int32_t values[4];
+	int32_t rl, j1, j2;
+	int32_t ngaps, nskip;
+	int swapflag = 0;
+
+	memset (hdr, 0, sizeof(NIMSheader));
+
 	/* read the header length record */
-	if (fread(&rl, 4, 1, f) != 1) {
-		printf("ERROR reading the header length record in read_bin_file\n");
+	if ( buflen < 4 ) {
+		ms_log(2, "cannot read the header length record in read_bin_file\n");
 		return 0;
 	}
-	
+	pos = 4;
+
 	/* Check if byte swapping is needed */
-	padded_rl = 5108; /* (256*5-3)*4 */
-	ngaps = (rl/4 - 21)/3;
-	
-	if (( ngaps < 0 || ngaps > 100 ) && (rl != padded_rl)) {
-	  ms_gswap4a (&rl);
-	  
+	if ( ! get_bin_length(buf, &rl, &swapflag) ) {
 	  ngaps = (rl/4 - 21)/3;
-	  
-	  if (( ngaps < 0 || ngaps > 100 ) && (rl != padded_rl)) {
-	    printf("ERROR header length invalid: %d or number of gaps %d > 100\n", rl, ngaps);
-	    return 0;
-	  }
-	  
-	  printf("Byte swapping needed\n");
-	  swapflag = 1;
+	  ms_log(2, "header length invalid: %d or number of gaps %d > 100\n", rl, ngaps);
+	  return 0;
 	}
-	
+	if ( verbose && swapflag ) printf("Byte swapping needed\n");
+
+	hdr->swapflag = swapflag;
 	j1 = rl;
-	
+
 	/* read the lat, lon, decl, dt, elev */
-	if (fread(&lat, sizeof(float), 1, f) != 1) {
-		printf("ERROR reading the latitude in read_bin_file\n");
+	if ( ! get_bin_values(buf, buflen, &pos, location, 5, swapflag) ) {
+		ms_log(2, "cannot read the site location in read_bin_file\n");
 		return 0;
 	}
-	if ( swapflag )  ms_gswap4a (&lat);
-	if (fread(&lon, sizeof(float), 1, f) != 1) {
-		printf("ERROR reading the longitude in read_bin_file\n");
-		return 0;
+	hdr->lat = location[0];
+	hdr->lon = location[1];
+	hdr->decl = location[2];
+	hdr->dt = location[3];
+	hdr->elev = location[4];
+	if ( verbose ) {
+		printf("Sampling rate: %.3f Hz\n",1/hdr->dt);
+		printf("Site location: (%.3f, %.3f, %.3f)\n",hdr->lat,hdr->lon,hdr->elev);
 	}
-	if ( swapflag )  ms_gswap4a (&lon);
-	if (fread(&decl, sizeof(float), 1, f) != 1) {
-		printf("ERROR reading the declination in read_bin_file\n");
+
+	/* read the start time and clock zero time */
+	if ( ! get_bin_values(buf, buflen, &pos, hdr->start_time, 6, swapflag) ||
+	     ! get_bin_values(buf, buflen, &pos, hdr->clock_zero, 6, swapflag) ) {
+		ms_log(2, "cannot read the start time in read_bin_file\n");
 		return 0;
 	}
-	if ( swapflag )  ms_gswap4a (&decl);
-	if (fread(&dt, sizeof(float), 1, f) != 1) {
-		printf("ERROR reading the sampling time in read_bin_file\n");
+	if ( verbose ) {
+		printf("Time series start time: %d-%02d-%02d %d:%d:%d\n",
+				hdr->start_time[0],hdr->start_time[1],hdr->start_time[2],
+				hdr->start_time[3],hdr->start_time[4],hdr->start_time[5]);
+	}
+
+	/* read the number of data scans and gap information */
+	if ( ! get_bin_values(buf, buflen, &pos, values, 4, swapflag) ) {
+		ms_log(2, "cannot read the number of data scans in read_bin_file\n");
 		return 0;
 	}
-	if ( swapflag )  ms_gswap4a (&dt);
-	if (fread(&elev, sizeof(float), 1, f) != 1) {
-		printf("ERROR reading the elevation in read_bin_file\n");
+	hdr->nscans = values[0];
+	hdr->gaptyp = values[1];
+	hdr->missingdataflag = values[2];
+	ngaps = values[3];
+	if (verbose && hdr->gaptyp != 2005) {
+		ms_log(1, "WARNING: the gap type in the file is %d, but we are assuming the gaps are filled\n",hdr->gaptyp);
+	}
+	if ( verbose ) printf("The number of gaps in the bin file is %d\n",ngaps);
+	if ( ngaps < 0 || ngaps > NIMS_MAXGAPS || 21 + 3*ngaps > rl/4 ) {
+		ms_log(2, "number of gaps %d does not fit the header length %d\n", ngaps, rl);
 		return 0;
 	}
-	if ( swapflag )  ms_gswap4a (&elev);
-	printf("Sampling rate: %.3f Hz\n",1/dt);
-	printf("Site location: (%.3f, %.3f, %.3f)\n",lat,lon,elev);
+	hdr->ngaps = ngaps;
 
-	/* read the start time and clock zero time */
-	if (fread(start_time, 4, 6, f) != 6) {
-		printf("ERROR reading the start time in read_bin_file\n");
+	/* read the gap table, skipping the padding of the header if any */
+	if ( ! get_bin_values(buf, buflen, &pos, hdr->gaps, 3*ngaps, swapflag) ) {
+		ms_log(2, "cannot read the gap information in read_bin_file\n");
 		return 0;
 	}
-	if ( swapflag ) { for ( idx=0; idx < 6; idx++) { ms_gswap4a(start_time+idx); } }
-	if (fread(clock_zero, 4, 6, f) != 6) {
-		printf("ERROR reading the clock zero time in read_bin_file\n");
+	nskip = 1 + rl/4 - 22 - 3*ngaps;
+	if ( (size_t) nskip > (buflen - pos) / 4 ) {
+		ms_log(2, "cannot read the padding of the header in read_bin_file\n");
 		return 0;
 	}
-	if ( swapflag ) { for ( idx=0; idx < 6; idx++) { ms_gswap4a(clock_zero+idx); } }
-	printf("Time series start time: %d-%02d-%02d %d:%d:%d\n",
-			start_time[0],start_time[1],start_time[2],start_time[3],start_time[4],start_time[5]);
-
-	/* read the number of data scans and gap information */
-	if (fread(nscans, 4, 1, f) != 1) {
-		printf("ERROR reading the number of data scans in read_bin_file\n");
+	pos += 4 * (size_t) nskip;
+	if ( ! get_bin_values(buf, buflen, &pos, &j2, 1, swapflag) ) {
+		ms_log(2, "cannot read the end of header record in read_bin_file\n");
 		return 0;
 	}
-	if ( swapflag )  ms_gswap4a (nscans);
-	if (fread(&gaptyp, 4, 1, f) != 1) {
-		printf("ERROR reading the gap type in read_bin_file\n");
+	if ( j1 != j2 ) {
+		ms_log(2, "cannot read the end of header record marker in read_bin_file\n");
 		return 0;
 	}
-	if ( swapflag )  ms_gswap4a (&gaptyp);
-	if (gaptyp != 2005) {
-		printf("WARNING - the gap type in the file is %d, but we are assuming the gaps are filled\n",gaptyp);		
-	}
-	if (fread(missingdataflag, 4, 1, f) != 1) {
-		printf("ERROR reading the missing data flag in read_bin_file\n");
+
+	/* read the data length record, of the first subrecord if split */
+	if ( ! get_bin_values(buf, buflen, &pos, &rl, 1, swapflag) ) {
+		ms_log(2, "cannot read the data length record in read_bin_file\n");
 		return 0;
 	}
-	if ( swapflag )  ms_gswap4a (missingdataflag);
-	if (fread(&ngaps, 4, 1, f) != 1) {
-		printf("ERROR reading the number of gaps in read_bin_file\n");
+	if ( ! set_bin_subrecord(hdr, rl) ) {
+		ms_log(2, "data length record invalid: %d\n", rl);
 		return 0;
 	}
-	if ( swapflag )  ms_gswap4a (&ngaps);
-	printf("The number of gaps in the bin file is %d\n",ngaps);
+	hdr->datalen = hdr->sublen;
+	hdr->nsubrecs = 1;
+	*dataoffset = pos;
 
-	if ( ! (gaps = (int32_t *) malloc(3*ngaps*4)) ) {
-	        printf("ERROR allocating memory\n");
+	return 1;
+}
+
+/* ======================================================================= */
+int parse_bin_header (const char *buf, size_t buflen, NIMSheader *hdr,
+		      size_t *dataoffset, int verbose)
+{
+	/* Parses the header record from a buffer holding a complete
+	 * nimsread *.bin file, such as a memory mapped file, and checks
+	 * the record markers of the data record following it. On success
+	 * the offset of the first data sample in the buffer is returned in
+	 * dataoffset; the samples are left in the byte order of the file.
+	 * The header information is only printed if verbose is set,
+	 * errors are always printed.
+	 * If the data record is split into subrecords the samples are not
+	 * contiguous in the buffer, they are joined with join_bin_data(). */
+
+	NIMSheader first;
+	size_t pos;
+	int32_t rl, j2;
+
+	if ( ! parse_bin_record(buf, buflen, hdr, dataoffset, verbose) )
 		return 0;
+
+	/* check the markers of all subrecords and the end of data marker */
+	first = *hdr;
+	pos = *dataoffset;
+	for (;;) {
+		rl = hdr->sublen;
+		if ( (size_t) rl > buflen - pos ) {
+			ms_log(2, "cannot read the data in read_bin_file\n");
+			return 0;
+		}
+		pos += rl;
+		if ( ! get_bin_values(buf, buflen, &pos, &j2, 1, hdr->swapflag) ) {
+			ms_log(2, "cannot read the end of data record in read_bin_file\n");
+			return 0;
+		}
+		if ( j2 != (( hdr->subrecno ) ? -rl : rl) ) {
+			ms_log(2, "cannot read the end of data record marker in read_bin_file\n");
+			return 0;
+		}
+		if ( ! hdr->subcont )
+			break;
+		if ( ! get_bin_values(buf, buflen, &pos, &rl, 1, hdr->swapflag) ||
+		     ! set_bin_subrecord(hdr, rl) ) {
+			ms_log(2, "cannot read the data subrecords in read_bin_file\n");
+			return 0;
+		}
+		hdr->subrecno++;
+		first.datalen += hdr->sublen;
+		first.nsubrecs++;
 	}
-	if (fread(gaps, 4, 3*ngaps, f) != 3*ngaps) {
-		printf("ERROR reading the gap information in read_bin_file\n");
+	*hdr = first;
+
+	if ( hdr->datalen % 4 ) {
+		ms_log(2, "cannot read the data in read_bin_file\n");
 		return 0;
 	}
-	if ( swapflag ) { for ( idx=0; idx < 3*ngaps; idx++) { ms_gswap4a(gaps+idx); } }
+	if ( verbose && hdr->nsubrecs > 1 )
+		printf("Data record of %lld bytes in %d subrecords\n",
+		       (long long) hdr->datalen, hdr->nsubrecs);
+	set_bin_channels(hdr);
 
-	/* read the padding of the header if any */
-	nskip = 1 + rl/4 - 22 - 3*ngaps;
-	if ( ! (itmp = (int *) malloc(nskip*4)) ) {
-	        printf("ERROR allocating memory\n");
+	return 1;
+}
+
+/* ======================================================================= */
+void join_bin_data (char *dest, const char *buf, size_t dataoffset,
+		    NIMSheader *hdr)
+{
+	/* Copies the data of all subrecords of a buffer checked by
+	 * parse_bin_header() to dest, dropping the record markers between
+	 * them. dest may be buf + dataoffset to join the data in place. */
+
+	size_t pos = dataoffset;
+	int64_t done = 0;
+	int32_t rl = hdr->sublen;
+	int idx;
+
+	for ( idx=0; idx < hdr->nsubrecs; idx++ ) {
+		if ( idx > 0 ) {
+			memcpy(&rl, buf + pos + 4, 4);
+			if ( hdr->swapflag ) ms_gswap4a(&rl);
+			if ( rl < 0 ) rl = -rl;
+			pos += 8;
+		}
+		memmove(dest + done, buf + pos, (size_t) rl);
+		done += rl;
+		pos += rl;
+	}
+}
+
+/* ======================================================================= */
+static void set_bin_channels (NIMSheader *hdr)
+{
+	/* Determines the number of channels of a scan from the length of
+	 * the data record, as the header only gives the number of scans.
+	 * It is 0 if the data is not a whole number of scans of at most
+	 * NIMS_MAXCHANNELS channels, a file without scans has 5 channels. */
+
+	int64_t scanlen;
+
+	hdr->nchannels = 0;
+	if ( hdr->nscans <= 0 ) {
+		if ( hdr->nscans == 0 && hdr->datalen == 0 ) hdr->nchannels = 5;
+		return;
+	}
+	scanlen = hdr->datalen / hdr->nscans;
+	if ( hdr->datalen % hdr->nscans || scanlen % 4 ||
+	     scanlen < 4 || scanlen > 4 * NIMS_MAXCHANNELS )
+		return;
+
+	hdr->nchannels = (int32_t) (scanlen / 4);
+}
+
+/* ======================================================================= */
+static int set_bin_subrecord (NIMSheader *hdr, int32_t marker)
+{
+	/* Sets the current data subrecord from its leading record marker,
+	 * which gfortran makes negative if the record is continued in
+	 * another subrecord. Returns 0 if the marker is invalid. */
+
+	if ( marker == INT32_MIN )
 		return 0;
+
+	hdr->subcont = ( marker < 0 );
+	hdr->sublen = ( marker < 0 ) ? -marker : marker;
+	hdr->subleft = hdr->sublen;
+
+	return 1;
+}
+
+/* ======================================================================= */
+static int next_bin_subrecord (FILE *f, NIMSheader *hdr)
+{
+	/* Reads the trailing record marker of the current data subrecord,
+	 * which must have been read completely, and the leading marker of
+	 * the next one. The trailing marker is negative for all but the
+	 * first subrecord. */
+
+	int32_t markers[2];
+
+	if (fread(markers, 4, 2, f) != 2) {
+		ms_log(2, "cannot read the data subrecords in read_bin_file\n");
+		return 0;
+	}
+	if ( hdr->swapflag ) { ms_gswap4a(&markers[0]); ms_gswap4a(&markers[1]); }
+	if ( markers[0] != (( hdr->subrecno ) ? -hdr->sublen : hdr->sublen) ||
+	     ! set_bin_subrecord(hdr, markers[1]) ) {
+		ms_log(2, "cannot read the data subrecord markers in read_bin_file\n");
+		return 0;
+	}
+	hdr->subrecno++;
+
+	return 1;
+}
+
+/* ======================================================================= */
+int read_bin_scans (FILE *f, NIMSheader *hdr, int32_t *data, int nscans)
+{
+	/* Reads the next nscans scans from the data record of the file
+	 * positioned by read_bin_header(), swapping to host byte order as
+	 * needed. Returns the number of complete scans read. */
+
+	int nread;
+
+	nread = read_bin_data(f, hdr, data, nscans);
+	if ( hdr->swapflag ) swap_bin_data (data, (size_t) nread * hdr->nchannels);
+
+	return nread;
+}
+
+/* ======================================================================= */
+int read_bin_data (FILE *f, NIMSheader *hdr, int32_t *data, int nscans)
+{
+	/* Reads the next nscans scans like read_bin_scans(),
+	 * leaving the samples in the byte order of the file. The scans may
+	 * continue in the next subrecord of a split data record, even
+	 * within a sample. Returns the number of complete scans read. */
+
+	char *dest = (char *) data;
+	size_t scanlen = (size_t) hdr->nchannels * 4;
+	size_t want = (size_t) nscans * scanlen;
+	size_t done = 0;
+	size_t count;
+	size_t nread;
+
+	while ( done < want ) {
+		if ( hdr->subleft == 0 ) {
+			if ( ! hdr->subcont || ! next_bin_subrecord(f, hdr) )
+				break;
+			continue;
+		}
+		count = want - done;
+		if ( count > (size_t) hdr->subleft ) count = (size_t) hdr->subleft;
+		nread = fread(dest + done, 1, count, f);
+		hdr->subleft -= (int32_t) nread;
+		done += nread;
+		if ( nread != count )
+			break;
 	}
-	if (fread(itmp, 4, nskip, f) != nskip) {
-		printf("ERROR reading the padding of the header in read_bin_file\n");
+
+	return ( scanlen ) ? (int) (done / scanlen) : 0;
+}
+
+/* ======================================================================= */
+void swap_bin_data (int32_t *data, size_t count)
+{
+	/* Swaps the byte order of count 32-bit samples in place with the
+	 * vectorized kernel of scankern.c. */
+
+	scan_swap32 (data, count);
+}
+
+/* ======================================================================= */
+int is_bin_file (const char *buf, size_t buflen)
+{
+	/* Returns 1 if the buffer starts with a header length record of a
+	 * bin file in either byte order, using the same check as
+	 * read_bin_header(), and 0 otherwise. */
+
+	int32_t rl;
+	int swapflag;
+
+	if (buflen < 4)
+		return 0;
+
+	return get_bin_length(buf, &rl, &swapflag);
+}
+
+/* ======================================================================= */
+int read_bin_end (FILE *f, NIMSheader *hdr)
+{
+	/* Reads and checks the end of data record marker, the file must be
+	 * positioned at the end of the data of the last subrecord. */
+
+	int32_t j2;
+
+	if ( hdr->subleft != 0 || hdr->subcont ) {
+		ms_log(2, "data left before the end of data record in read_bin_file\n");
 		return 0;
 	}
 	if (fread(&j2, 4, 1, f) != 1) {
-		printf("ERROR reading the end of header record in read_bin_file\n");
+		ms_log(2, "cannot read the end of data record in read_bin_file\n");
 		return 0;
 	}
-	if ( swapflag )  ms_gswap4a (&j2);
-	if ( j1 != j2 ) {
-		printf("ERROR reading the end of header record marker in read_bin_file\n");
+	if ( hdr->swapflag )  ms_gswap4a (&j2);
+	if ( j2 != (( hdr->subrecno ) ? -hdr->sublen : hdr->sublen) ) {
+		ms_log(2, "cannot read the end of data record marker in read_bin_file\n");
 		return 0;
 	}
 
-	/* read the data length record and the data */
-	if (fread(&rl, 4, 1, f) != 1) {
-		printf("ERROR reading the data length record in read_bin_file\n");
-		return 0;
+	return 1;
+}
+
+/* ======================================================================= */
+int64_t skip_bin_data (FILE *f, NIMSheader *hdr)
+{
+	/* Seeks over the rest of the data record, of all subrecords, and
+	 * checks the end of data marker. Returns the number of data bytes
+	 * skipped, or -1 on errors. */
+
+	int64_t skipped = 0;
+
+	for (;;) {
+		if ( fseeko(f, (off_t) hdr->subleft, SEEK_CUR) ) {
+			ms_log(2, "cannot seek over the data in read_bin_file\n");
+			return -1;
+		}
+		skipped += hdr->subleft;
+		hdr->subleft = 0;
+		if ( ! hdr->subcont )
+			break;
+		if ( ! next_bin_subrecord(f, hdr) )
+			return -1;
 	}
-	if ( swapflag )  ms_gswap4a (&rl);
-	j1 = rl;
-	if ( ! (*data = (int32_t *) malloc(rl)) ) {
-	        printf("ERROR allocating memory\n");
+	if ( ! read_bin_end(f, hdr) )
+		return -1;
+
+	return skipped;
+}
+
+/* ======================================================================= */
+int64_t read_bin_file (FILE *f, float *s_rate, int *nscans, int *start_time, 
+		       int32_t **data, int *missingdataflag)
+{
+	/* Reads the header and the complete data record from the Fortran
+	 * binary nimsread output *.bin file. Returns the length of the data
+	 * in bytes, or 0 on errors. */
+
+	NIMSheader hdr;
+	int64_t rl;
+	int idx;
+
+	if ( ! read_bin_header (f, &hdr, 1) )
 		return 0;
-	}
-	if (fread(*data, 4, rl/4, f) != rl/4) {
-	        printf("ERROR reading the data in read_bin_file\n");
+
+	*nscans = hdr.nscans;
+	*missingdataflag = hdr.missingdataflag;
+	for ( idx=0; idx < 6; idx++) { start_time[idx] = hdr.start_time[idx]; }
+
+	/* read the data */
+	rl = hdr.datalen;
+	if ( hdr.nchannels == 0 ) {
+	        ms_log(2, "data length %lld does not fit %d scans\n", (long long) rl, hdr.nscans);
 		return 0;
 	}
-	if ( swapflag ) { for ( idx=0; idx < rl/4; idx++) { ms_gswap4a((*data)+idx); } }
-	if (fread(&j2, 4, 1, f) != 1) {
-		printf("ERROR reading the end of data record in read_bin_file\n");
+	if ( (uint64_t) rl > SIZE_MAX ||
+	     ! (*data = (int32_t *) malloc((size_t) rl)) ) {
+	        ms_log(2, "cannot allocate memory\n");
 		return 0;
 	}
-	if ( swapflag )  ms_gswap4a (&j2);
-	if ( j1 != j2 ) {
-		printf("ERROR reading the end of data record marker in read_bin_file\n");
+	if ( read_bin_scans (f, &hdr, *data, hdr.nscans) != hdr.nscans ) {
+	        ms_log(2, "cannot read the data in read_bin_file\n");
 		return 0;
 	}
+	if ( ! read_bin_end (f, &hdr) )
+		return 0;
 
-	*s_rate = 1/dt;
+	*s_rate = 1/hdr.dt;
 	
 	return rl;
 }
+
+/* ======================================================================= */
+int check_bin_gaps (NIMSheader *hdr)
+{
+	/* Checks if the gap table of the header can be trusted to locate
+	 * the missing scans: the gaps must be filled (gap type 2005), and
+	 * the entries must be within the data scans, in increasing order
+	 * and must not overlap. Returns 1 if the table is usable. */
+
+	int32_t nextscan = 1;
+	int idx;
+
+	if ( hdr->gaptyp != 2005 )
+		return 0;
+
+	for ( idx=0; idx < hdr->ngaps; idx++ ) {
+		if ( hdr->gaps[idx].start < nextscan ||
+		     hdr->gaps[idx].length < 1 ||
+		     hdr->gaps[idx].length > hdr->nscans - hdr->gaps[idx].start + 1 )
+			return 0;
+
+		nextscan = hdr->gaps[idx].start + hdr->gaps[idx].length;
+	}
+
+	return 1;
+}
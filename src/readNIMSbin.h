@@ -8,9 +8,64 @@ extern "C" {
 #include <stdio.h>
 #include <libmseed.h>
 
+/* Maximum number of gaps in a header, limited by the padded header length */
+#define NIMS_MAXGAPS 418
+
+/* Length of the padded header record, the longest header accepted */
+#define NIMS_MAXHEADER 5108
+
+/* Maximum number of channels in a data scan */
+#define NIMS_MAXCHANNELS 8
+
+/* Longest Fortran record or subrecord, longer data records are split
+ * into subrecords by gfortran */
+#define NIMS_MAXSUBREC 2147483639
+
+/* Entry of the gap table in a bin file header */
+typedef struct NIMSgap_s {
+	int32_t start;               /* Scan number of first missing scan, starting at 1 */
+	int32_t length;              /* Number of missing scans */
+	int32_t value;               /* Third value of the entry, not used */
+} NIMSgap;
+
+/* Header information from a nimsread bin file */
+typedef struct NIMSheader_s {
+	float lat, lon, decl, dt, elev;  /* Site location, declination and sampling time */
+	int32_t start_time[6];       /* Start time: year, month, day, hour, min, sec */
+	int32_t clock_zero[6];       /* Clock zero time */
+	int32_t nscans;              /* Number of data scans */
+	int32_t nchannels;           /* Channels of a scan, 0 if the data length does not fit */
+	int32_t gaptyp;              /* Gap type, 2005 for filled gaps */
+	int32_t missingdataflag;     /* Value of missing (gap) samples */
+	int32_t ngaps;               /* Number of gaps in the gap table */
+	NIMSgap gaps[NIMS_MAXGAPS];  /* Gap table */
+	int64_t datalen;             /* Length of the data in bytes, of all subrecords */
+	int32_t nsubrecs;            /* Number of subrecords of the data record */
+	int32_t subrecno;            /* Index of the current data subrecord */
+	int32_t sublen;              /* Length of the current data subrecord */
+	int32_t subleft;             /* Bytes not yet read of the current subrecord */
+	int subcont;                 /* Current subrecord is continued by another */
+	int swapflag;                /* Byte swapping needed for this file */
+} NIMSheader;
+
+extern const char *nims_chancodes[NIMS_MAXCHANNELS];
+
 int get_chan_name (float freq, int chan_index, char *chan_name);
-int read_bin_file (FILE *f, float *s_rate, int *nscans, int *start_time,
-		   int32_t **data, int *missingdataflag);
+int get_chan_code (float freq, const char *code, char *chan_name);
+int read_bin_header (FILE *f, NIMSheader *hdr, int verbose);
+int parse_bin_header (const char *buf, size_t buflen, NIMSheader *hdr,
+		      size_t *dataoffset, int verbose);
+int read_bin_scans (FILE *f, NIMSheader *hdr, int32_t *data, int nscans);
+int read_bin_data (FILE *f, NIMSheader *hdr, int32_t *data, int nscans);
+int read_bin_end (FILE *f, NIMSheader *hdr);
+int64_t skip_bin_data (FILE *f, NIMSheader *hdr);
+void join_bin_data (char *dest, const char *buf, size_t dataoffset,
+		    NIMSheader *hdr);
+void swap_bin_data (int32_t *data, size_t count);
+int is_bin_file (const char *buf, size_t buflen);
+int check_bin_gaps (NIMSheader *hdr);
+int64_t read_bin_file (FILE *f, float *s_rate, int *nscans, int *start_time,
+		       int32_t **data, int *missingdataflag);
 
 #ifdef __cplusplus
 }
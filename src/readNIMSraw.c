@@ -0,0 +1,479 @@
+/***************************************************************************
+ * readNIMSraw.c
+ *
+ * Functions to read the magnetotelluric channel data directly from the
+ * raw DATA.BIN stream recorded by a NIMS logger, without converting it
+ * to a bin file with nimsread first.
+ *
+ * The stream starts with a text header followed by fixed length data
+ * blocks, one per second.  Each block of 131 bytes holds:
+ *
+ *   byte 0       start of block, 0x01
+ *   byte 1       block type, 0x83
+ *   byte 2       status
+ *   byte 3       next character of the GPS receiver NMEA stream
+ *   bytes 4-10   box temperature and other status, not used
+ *   bytes 11-130 8 scans of the 5 channels (Hx, Hy, Hz, Ex, Ey) at
+ *                8 Hz, each sample a big endian 24-bit integer
+ *
+ * The time of the blocks is derived from the $GPRMC sentences of the
+ * GPS stream: a sentence gives the time of the block holding its
+ * leading '$'.  Blocks missing from the stream are detected from the
+ * resynchronization on the next block and filled with missing values
+ * in the same way nimsread fills gaps.  Whole blocks lost without
+ * breaking the framing only show as a step of the clock at the next
+ * time stamp; the blocks since the previous stamp, whose time is then
+ * uncertain, are dropped and also filled with missing values.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmseed.h>
+
+#include "readNIMSraw.h"
+#include "scankern.h"
+
+/* Block header markers */
+#define NIMS_BLOCKSOH  0x01
+#define NIMS_BLOCKTYPE 0x83
+
+/* Maximum length of an NMEA sentence */
+#define NIMS_MAXNMEA 82
+
+/* Range of the stream searched for the first blocks to detect a raw file */
+#define NIMS_SNIFFLEN 65536
+
+/* Maximum change of the clock correction accepted from a GPS time stamp */
+#define NIMS_MAXSTEP 86400
+
+/* Correction of blocks dropped for an uncertain time */
+#define NIMS_UNTIMED INT64_MIN
+
+/* A data block located in the stream */
+typedef struct RawBlock_s {
+	size_t offset;               /* Offset of the block in the buffer */
+	int64_t second;              /* Time of the block in seconds */
+} RawBlock;
+
+/* Blocks of a stream and the site location from the GPS stream */
+typedef struct RawStream_s {
+	RawBlock *blocks;
+	int nblocks;
+	int nstamps;                 /* Number of GPS time stamps used */
+	float lat, lon;
+} RawStream;
+
+static int is_block (const unsigned char *buf, size_t buflen, size_t pos,
+		     int resync);
+static size_t find_block (const unsigned char *buf, size_t buflen, size_t pos);
+static int parse_gprmc (const char *sentence, int64_t *second,
+			float *lat, float *lon);
+static int locate_blocks (const char *buf, size_t buflen, RawStream *rs,
+			  int verbose);
+
+/* ======================================================================= */
+int is_raw_file (const char *buf, size_t buflen)
+{
+	/* Returns 1 if the buffer holds a raw NIMS stream: the first bytes
+	 * are not the header length record of a bin file in either byte
+	 * order, and two consecutive data blocks are found near the start. */
+
+	size_t limit;
+
+	if (buflen < 4 || is_bin_file(buf, buflen))
+		return 0;
+
+	limit = (buflen < NIMS_SNIFFLEN) ? buflen : NIMS_SNIFFLEN;
+
+	return (find_block((const unsigned char *) buf, limit, 0) < limit);
+}
+
+/* ======================================================================= */
+int parse_raw_header (const char *buf, size_t buflen, NIMSheader *hdr,
+		      int verbose)
+{
+	/* Locates the data blocks of a raw NIMS stream held in a buffer and
+	 * fills the header as nimsread would for the bin file of the
+	 * stream: the start time is that of the first block, missing
+	 * blocks are entered in the gap table. The samples are decoded
+	 * with read_raw_scans(). Returns 1 on success and 0 on failure. */
+
+	RawStream rs;
+	BTime btime;
+	int64_t nscans;
+	int64_t missing;
+	int idx;
+
+	memset (hdr, 0, sizeof(NIMSheader));
+
+	if ( ! locate_blocks(buf, buflen, &rs, verbose) )
+		return 0;
+
+	nscans = (rs.blocks[rs.nblocks-1].second - rs.blocks[0].second + 1) * NIMS_BLOCKSCANS;
+
+	if (nscans > 2147483647) {
+		ms_log(2, "raw data of %lld scans too long for a single conversion\n",
+		          (long long) nscans);
+		free(rs.blocks);
+		return 0;
+	}
+
+	hdr->lat = rs.lat;
+	hdr->lon = rs.lon;
+	hdr->dt = 1.0 / NIMS_BLOCKSCANS;
+	hdr->nscans = (int32_t) nscans;
+	hdr->gaptyp = 2005;
+	hdr->missingdataflag = NIMS_RAWMISSING;
+	hdr->datalen = nscans * SCAN_CHANNELS * 4;
+	hdr->nsubrecs = 1;
+	hdr->nchannels = SCAN_CHANNELS;
+	hdr->swapflag = 0;
+
+	ms_hptime2btime((hptime_t) rs.blocks[0].second * HPTMODULUS, &btime);
+	hdr->start_time[0] = btime.year;
+	ms_doy2md(btime.year, btime.day, &hdr->start_time[1], &hdr->start_time[2]);
+	hdr->start_time[3] = btime.hour;
+	hdr->start_time[4] = btime.min;
+	hdr->start_time[5] = btime.sec;
+	memcpy(hdr->clock_zero, hdr->start_time, sizeof(hdr->clock_zero));
+
+	/* enter the missing blocks in the gap table */
+	missing = 0;
+	for (idx = 1; idx < rs.nblocks; idx++) {
+		int64_t skipped = rs.blocks[idx].second - rs.blocks[idx-1].second - 1;
+
+		if (skipped <= 0)
+			continue;
+
+		if (hdr->ngaps < NIMS_MAXGAPS) {
+			hdr->gaps[hdr->ngaps].start = (int32_t)
+				((rs.blocks[idx-1].second - rs.blocks[0].second + 1) * NIMS_BLOCKSCANS + 1);
+			hdr->gaps[hdr->ngaps].length = (int32_t) (skipped * NIMS_BLOCKSCANS);
+		}
+		hdr->ngaps++;
+		missing += skipped;
+	}
+
+	/* like nimsread, too many gaps to list are only flagged in the data */
+	if (hdr->ngaps > NIMS_MAXGAPS) {
+		hdr->gaptyp = 0;
+		hdr->ngaps = 0;
+	}
+
+	if (verbose) {
+		printf("Raw NIMS data: %d blocks, %lld missing, %d GPS time stamps\n",
+		       rs.nblocks, (long long) missing, rs.nstamps);
+		printf("Sampling rate: %.3f Hz\n",1/hdr->dt);
+		printf("Site location: (%.3f, %.3f, %.3f)\n",hdr->lat,hdr->lon,hdr->elev);
+		printf("Time series start time: %d-%02d-%02d %d:%d:%d\n",
+				hdr->start_time[0],hdr->start_time[1],hdr->start_time[2],
+				hdr->start_time[3],hdr->start_time[4],hdr->start_time[5]);
+		printf("The number of gaps in the raw data is %d\n",hdr->ngaps);
+	}
+
+	free(rs.blocks);
+
+	return 1;
+}
+
+/* ======================================================================= */
+int read_raw_scans (const char *buf, size_t buflen, NIMSheader *hdr,
+		    int32_t *scans)
+{
+	/* Decodes the samples of a raw NIMS stream into hdr->nscans scans
+	 * of 32-bit integers in host byte order, filling missing blocks
+	 * with the missing data flag. The header must have been filled by
+	 * parse_raw_header() for the same buffer. Returns 1 on success and
+	 * 0 on failure. */
+
+	RawStream rs;
+	int64_t scan, next;
+	size_t idx;
+	int block;
+
+	/* the warnings were reported when parsing the header */
+	if ( ! locate_blocks(buf, buflen, &rs, -1) )
+		return 0;
+
+	if ((rs.blocks[rs.nblocks-1].second - rs.blocks[0].second + 1) * NIMS_BLOCKSCANS != hdr->nscans) {
+		ms_log(2, "raw data does not match the header of %d scans\n", hdr->nscans);
+		free(rs.blocks);
+		return 0;
+	}
+
+	next = 0;
+	for (block = 0; block < rs.nblocks; block++) {
+		scan = (rs.blocks[block].second - rs.blocks[0].second) * NIMS_BLOCKSCANS;
+
+		for (idx = (size_t) next * SCAN_CHANNELS; idx < (size_t) scan * SCAN_CHANNELS; idx++)
+			scans[idx] = hdr->missingdataflag;
+
+		scan_unpack24((const uint8_t *) buf + rs.blocks[block].offset + NIMS_BLOCKHDR,
+			      scans + (size_t) scan * SCAN_CHANNELS,
+			      NIMS_BLOCKSCANS * SCAN_CHANNELS);
+		next = scan + NIMS_BLOCKSCANS;
+	}
+
+	free(rs.blocks);
+
+	return 1;
+}
+
+/* ======================================================================= */
+static int is_block (const unsigned char *buf, size_t buflen, size_t pos,
+		     int resync)
+{
+	/* Returns 1 if a complete block starts at pos. When resynchronizing
+	 * the block must also be followed by the end of the buffer or the
+	 * start of another block, to avoid synchronizing on sample bytes. */
+
+	if (pos + NIMS_BLOCKLEN > buflen)
+		return 0;
+	if (buf[pos] != NIMS_BLOCKSOH || buf[pos+1] != NIMS_BLOCKTYPE)
+		return 0;
+	if ( ! resync || pos + NIMS_BLOCKLEN + 2 > buflen)
+		return 1;
+
+	return (buf[pos+NIMS_BLOCKLEN] == NIMS_BLOCKSOH &&
+		buf[pos+NIMS_BLOCKLEN+1] == NIMS_BLOCKTYPE);
+}
+
+/* ======================================================================= */
+static size_t find_block (const unsigned char *buf, size_t buflen, size_t pos)
+{
+	/* Returns the offset of the next block at or after pos, or buflen
+	 * if there is none. */
+
+	const unsigned char *soh;
+
+	while (pos + NIMS_BLOCKLEN <= buflen) {
+		if ( ! (soh = memchr(buf + pos, NIMS_BLOCKSOH, buflen - NIMS_BLOCKLEN + 1 - pos)) )
+			break;
+		pos = soh - buf;
+		if (is_block(buf, buflen, pos, 1))
+			return pos;
+		pos++;
+	}
+
+	return buflen;
+}
+
+/* ======================================================================= */
+static int parse_gprmc (const char *sentence, int64_t *second,
+			float *lat, float *lon)
+{
+	/* Parses a complete $GPRMC (or other talker) sentence including its
+	 * checksum. Returns 1 and the time in seconds and the location if
+	 * the sentence is valid and the receiver has a fix, 0 otherwise. */
+
+	char fields[13][16];
+	const char *cp;
+	unsigned int checksum = 0;
+	unsigned int expected;
+	int nfields = 0;
+	int len = 0;
+	int hour, min, sec, day, month, year, yday;
+	double value;
+
+	if (sentence[0] != '$' || strncmp(sentence + 3, "RMC,", 4))
+		return 0;
+
+	for (cp = sentence + 1; *cp && *cp != '*'; cp++)
+		checksum ^= (unsigned char) *cp;
+	if (*cp != '*' || sscanf(cp + 1, "%2x", &expected) != 1 || expected != checksum)
+		return 0;
+
+	/* split the fields after the sentence type */
+	memset(fields, 0, sizeof(fields));
+	for (cp = sentence + 7; *cp != '*' && nfields < 13; cp++) {
+		if (*cp == ',') {
+			nfields++;
+			len = 0;
+		} else if (len < 15) {
+			fields[nfields][len++] = *cp;
+		}
+	}
+	nfields++;
+
+	/* time, status, lat, N/S, lon, E/W, speed, course, date */
+	if (nfields < 9 || fields[1][0] != 'A')
+		return 0;
+	if (sscanf(fields[0], "%2d%2d%2d", &hour, &min, &sec) != 3 ||
+	    sscanf(fields[8], "%2d%2d%2d", &day, &month, &year) != 3)
+		return 0;
+
+	year += (year < 80) ? 2000 : 1900;
+	if (hour > 23 || min > 59 || sec > 60 || ms_md2doy(year, month, day, &yday))
+		return 0;
+
+	*second = ms_time2hptime(year, yday, hour, min, sec, 0) / HPTMODULUS;
+
+	value = atof(fields[2]);
+	*lat = (float) ((int) (value / 100) + (value - 100 * (int) (value / 100)) / 60);
+	if (fields[3][0] == 'S')
+		*lat = -*lat;
+	value = atof(fields[4]);
+	*lon = (float) ((int) (value / 100) + (value - 100 * (int) (value / 100)) / 60);
+	if (fields[5][0] == 'W')
+		*lon = -*lon;
+
+	return 1;
+}
+
+/* ======================================================================= */
+static int locate_blocks (const char *buf, size_t buflen, RawStream *rs,
+			  int verbose)
+{
+	/* Locates the data blocks of a raw stream and assigns each a time
+	 * in seconds. The blocks are first numbered by their position in
+	 * the stream, counting the blocks lost at each resynchronization
+	 * from the skipped bytes. Each GPS time stamp then gives the clock
+	 * correction for its block and the following blocks, the blocks
+	 * before the first stamp use the first correction. A stamp whose
+	 * correction differs from the previous one by more than a day is
+	 * ignored. When a stamp changes the correction, blocks were lost
+	 * or inserted somewhere since the previous stamp, and the blocks in
+	 * between are dropped rather than misdated. Blocks at or before the
+	 * time of the previous block are dropped. Clock steps are reported
+	 * unless verbose is negative. Returns 1 on success and 0 on failure;
+	 * on success the caller frees rs->blocks. */
+
+	const unsigned char *ubuf = (const unsigned char *) buf;
+	char sentence[NIMS_MAXNMEA + 1];
+	int sentlen = -1;
+	int sentblock = 0;
+	int stampblock = 0;
+	int64_t stamp;
+	int64_t correction = 0;
+	int64_t *corrections;
+	int havecorrection = 0;
+	size_t pos, expected;
+	int maxblocks;
+	int count = 0;
+	int idx;
+	char gps;
+
+	memset(rs, 0, sizeof(RawStream));
+
+	maxblocks = (int) (buflen / NIMS_BLOCKLEN);
+	if ((size_t) maxblocks != buflen / NIMS_BLOCKLEN) {
+		ms_log(2, "raw data too long\n");
+		return 0;
+	}
+
+	pos = find_block(ubuf, buflen, 0);
+	if (pos == buflen) {
+		ms_log(2, "no data blocks found in raw data\n");
+		return 0;
+	}
+
+	if ( ! (rs->blocks = (RawBlock *) malloc(sizeof(RawBlock) * (maxblocks + 1))) ||
+	     ! (corrections = (int64_t *) malloc(sizeof(int64_t) * (maxblocks + 1))) ) {
+		ms_log(2, "cannot allocate memory\n");
+		free(rs->blocks);
+		rs->blocks = 0;
+		return 0;
+	}
+
+	if (verbose > 0 && pos > 0)
+		printf("Skipped %lld bytes of raw data header\n", (long long) pos);
+
+	/* number the blocks and collect the GPS stream */
+	expected = pos;
+	while (pos < buflen) {
+		RawBlock *block = &rs->blocks[count];
+
+		block->offset = pos;
+		block->second = (count) ? rs->blocks[count-1].second + 1 : 0;
+
+		if (pos != expected) {
+			block->second += (pos - expected + NIMS_BLOCKLEN/2) / NIMS_BLOCKLEN;
+			if (verbose > 0)
+				printf("Skipped %lld bytes of corrupt raw data at offset %lld\n",
+				       (long long) (pos - expected), (long long) expected);
+			sentlen = -1;
+		}
+
+		gps = (char) ubuf[pos + 3];
+		if (gps == '$') {
+			sentence[0] = gps;
+			sentlen = 1;
+			sentblock = count;
+		} else if (sentlen > 0) {
+			if (gps == '\r' || gps == '\n' || sentlen == NIMS_MAXNMEA) {
+				sentence[sentlen] = '\0';
+				if (parse_gprmc(sentence, &stamp, &rs->lat, &rs->lon)) {
+					stamp -= rs->blocks[sentblock].second;
+					if ( ! havecorrection ||
+					     (stamp - correction <= NIMS_MAXSTEP && correction - stamp <= NIMS_MAXSTEP)) {
+						if ( ! havecorrection) {
+							for (idx = 0; idx < sentblock; idx++)
+								corrections[idx] = stamp;
+						} else if (stamp != correction && stampblock + 1 < sentblock) {
+							if (verbose >= 0)
+								ms_log(1, "WARNING: clock step of %lld seconds at GPS time stamp of block %d, dropping blocks %d to %d of uncertain time\n",
+								          (long long) (stamp - correction), sentblock, stampblock + 1, sentblock - 1);
+							for (idx = stampblock + 1; idx < sentblock; idx++)
+								corrections[idx] = NIMS_UNTIMED;
+						} else if (stamp != correction && verbose >= 0) {
+							ms_log(1, "WARNING: clock step of %lld seconds at GPS time stamp of block %d\n",
+							          (long long) (stamp - correction), sentblock);
+						}
+						for (idx = sentblock; idx < count; idx++)
+							corrections[idx] = stamp;
+						correction = stamp;
+						stampblock = sentblock;
+						havecorrection = 1;
+						rs->nstamps++;
+					} else if (verbose >= 0) {
+						ms_log(1, "WARNING: ignoring GPS time stamp of block %d, clock step of %lld seconds\n",
+						          sentblock, (long long) (stamp - correction));
+					}
+				}
+				sentlen = -1;
+			} else {
+				sentence[sentlen++] = gps;
+			}
+		}
+
+		corrections[count] = correction;
+		count++;
+
+		expected = pos + NIMS_BLOCKLEN;
+		pos = (is_block(ubuf, buflen, expected, 0)) ? expected : find_block(ubuf, buflen, expected);
+	}
+
+	if ( ! havecorrection) {
+		ms_log(2, "no valid GPS time stamps found in raw data\n");
+		free(corrections);
+		free(rs->blocks);
+		rs->blocks = 0;
+		return 0;
+	}
+
+	/* apply the corrections and drop blocks out of time order */
+	rs->nblocks = 0;
+	for (idx = 0; idx < count; idx++) {
+		RawBlock block = rs->blocks[idx];
+
+		if (corrections[idx] == NIMS_UNTIMED)
+			continue;
+
+		block.second += corrections[idx];
+
+		if (rs->nblocks > 0 && block.second <= rs->blocks[rs->nblocks-1].second) {
+			if (verbose > 0)
+				ms_log(1, "WARNING: dropping raw data block at offset %lld, overlapping previous data\n",
+				          (long long) block.offset);
+			continue;
+		}
+
+		rs->blocks[rs->nblocks++] = block;
+	}
+
+	free(corrections);
+
+	return 1;
+}
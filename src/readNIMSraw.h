@@ -0,0 +1,32 @@
+#ifndef READNIMSRAW_H
+#define READNIMSRAW_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "readNIMSbin.h"
+
+/* Length of a data block written by a NIMS logger */
+#define NIMS_BLOCKLEN 131
+
+/* Bytes of the block header preceding the samples */
+#define NIMS_BLOCKHDR 11
+
+/* Number of 5-channel scans in a block, one second at 8 Hz */
+#define NIMS_BLOCKSCANS 8
+
+/* Value of the samples of missing blocks */
+#define NIMS_RAWMISSING 2147483647
+
+int is_raw_file (const char *buf, size_t buflen);
+int parse_raw_header (const char *buf, size_t buflen, NIMSheader *hdr,
+		      int verbose);
+int read_raw_scans (const char *buf, size_t buflen, NIMSheader *hdr,
+		    int32_t *scans);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* READNIMSRAW_H */
@@ -0,0 +1,418 @@
+/***************************************************************************
+ * recwriter.c
+ *
+ * A simple buffered writer for output files of packed records.
+ *
+ * Records are collected in a large, aligned buffer that is written
+ * with a single write() when full, data that does not fit the buffer
+ * is written together with the buffer contents using writev().  This
+ * avoids the per-record locking and copying of stdio.
+ *
+ * Optionally the file is written with O_DIRECT, bypassing the page
+ * cache, or written data is released from the page cache with
+ * posix_fadvise(POSIX_FADV_DONTNEED), useful when archiving large
+ * volumes that will not be read again soon.
+ *
+ * A writer can also be created for an open descriptor such as
+ * standard output, for a pipe the pipe buffer is enlarged to reduce
+ * the number of times the writer blocks on a slow reader.
+ ***************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+
+#include "recwriter.h"
+
+static int writeall (RecWriter *rw, struct iovec *iov, int iovcnt);
+static int writebuffer (RecWriter *rw, size_t length);
+
+
+/***************************************************************************
+ * rw_open:
+ *
+ * Create (or truncate) the output file path and allocate a writer
+ * with an output buffer of bufsize bytes, rounded up to a multiple of
+ * RW_ALIGN.  If direct I/O is requested but not supported for the
+ * file the writer falls back to normal writes.  With RW_APPEND an
+ * existing file is appended to instead, direct I/O is not used as the
+ * end of the file may not be aligned.  RW_UPDATE also writes at the
+ * end of an existing file, but without O_APPEND so data already
+ * written can be replaced with rw_pwrite().
+ *
+ * Returns a new RecWriter on success, and NULL on failure with errno
+ * set.
+ ***************************************************************************/
+RecWriter *
+rw_open (const char *path, size_t bufsize, int flags)
+{
+  RecWriter *rw;
+  int oflags = O_WRONLY | O_CREAT | O_TRUNC;
+  off_t origin = 0;
+  int errsave;
+  int fd = -1;
+
+  if ( flags & RW_APPEND )
+    {
+      oflags = O_WRONLY | O_CREAT | O_APPEND;
+      flags &= ~RW_DIRECT;
+    }
+  else if ( flags & RW_UPDATE )
+    {
+      oflags = O_WRONLY | O_CREAT;
+      flags &= ~RW_DIRECT;
+    }
+
+#ifdef O_DIRECT
+  if ( flags & RW_DIRECT )
+    {
+      if ( (fd = open (path, oflags | O_DIRECT, 0666)) < 0 && errno == EINVAL )
+	flags &= ~RW_DIRECT;
+    }
+#else
+  flags &= ~RW_DIRECT;
+#endif
+
+  if ( ! (flags & RW_DIRECT) )
+    fd = open (path, oflags, 0666);
+
+  if ( fd < 0 )
+    return NULL;
+
+  if ( ( (flags & (RW_APPEND | RW_UPDATE)) && (origin = lseek (fd, 0, SEEK_END)) < 0 ) ||
+       ! (rw = rw_fdopen (fd, bufsize, flags)) )
+    {
+      errsave = errno;
+      close (fd);
+      errno = errsave;
+      return NULL;
+    }
+
+  rw->offset = rw->released = rw->origin = origin;
+
+  return rw;
+}  /* End of rw_open() */
+
+
+/***************************************************************************
+ * rw_fdopen:
+ *
+ * Allocate a writer for the open descriptor fd with an output buffer
+ * of bufsize bytes, rounded up to a multiple of RW_ALIGN.  Direct I/O
+ * is only used if the descriptor was opened with O_DIRECT.  If fd is
+ * a pipe its buffer is enlarged to up to RW_PIPESIZE bytes, as far as
+ * permitted.  The descriptor is closed by rw_close().
+ *
+ * Returns a new RecWriter on success, and NULL on failure with errno
+ * set.
+ ***************************************************************************/
+RecWriter *
+rw_fdopen (int fd, size_t bufsize, int flags)
+{
+  RecWriter *rw;
+  void *buffer = 0;
+  struct stat st;
+
+  bufsize = ( bufsize < RW_ALIGN ) ? RW_ALIGN :
+    (bufsize + RW_ALIGN - 1) / RW_ALIGN * RW_ALIGN;
+
+  if ( ! (rw = (RecWriter *) calloc (1, sizeof(RecWriter))) )
+    return NULL;
+
+  if ( (errno = posix_memalign (&buffer, RW_ALIGN, bufsize)) )
+    {
+      free (rw);
+      return NULL;
+    }
+
+#ifdef O_DIRECT
+  if ( ! (fcntl (fd, F_GETFL) & O_DIRECT) )
+    flags &= ~RW_DIRECT;
+#endif
+
+  if ( fstat (fd, &st) == 0 && S_ISFIFO (st.st_mode) )
+    {
+      /* Page cache advice does not apply to pipes */
+      flags &= ~RW_DONTNEED;
+
+#ifdef F_SETPIPE_SZ
+      /* Failure only leaves the default size */
+      fcntl (fd, F_SETPIPE_SZ, (int) (( bufsize < RW_PIPESIZE ) ? bufsize : RW_PIPESIZE));
+#endif
+    }
+
+  rw->fd = fd;
+  rw->flags = flags;
+  rw->buffer = (char *) buffer;
+  rw->bufsize = bufsize;
+
+  return rw;
+}  /* End of rw_fdopen() */
+
+
+/***************************************************************************
+ * rw_write:
+ *
+ * Write length bytes of data to the writer.  Data is copied into the
+ * buffer, which is written when full.  Unless writing with direct
+ * I/O, data that does not fit the remaining buffer is written
+ * directly along with the buffer contents in a single writev().
+ *
+ * Returns 0 on success, and -1 on failure with errno set.
+ ***************************************************************************/
+int
+rw_write (RecWriter *rw, const char *data, size_t length)
+{
+  struct iovec iov[2];
+  size_t count;
+
+  if ( ! (rw->flags & RW_DIRECT) && rw->buflen + length > rw->bufsize )
+    {
+      iov[0].iov_base = rw->buffer;
+      iov[0].iov_len = rw->buflen;
+      iov[1].iov_base = (void *) data;
+      iov[1].iov_len = length;
+
+      if ( writeall (rw, iov, 2) )
+	return -1;
+
+      rw->buflen = 0;
+      return 0;
+    }
+
+  while ( length > 0 )
+    {
+      count = rw->bufsize - rw->buflen;
+      if ( count > length )
+	count = length;
+
+      memcpy (rw->buffer + rw->buflen, data, count);
+      rw->buflen += count;
+      data += count;
+      length -= count;
+
+      if ( rw->buflen == rw->bufsize && writebuffer (rw, rw->buflen) )
+	return -1;
+    }
+
+  return 0;
+}  /* End of rw_write() */
+
+
+/***************************************************************************
+ * rw_pwrite:
+ *
+ * Replace length bytes of data previously written at offset, which
+ * may still be in the buffer.  The data must not extend beyond the
+ * data written so far.  Not supported with direct I/O or RW_APPEND.
+ *
+ * Returns 0 on success, and -1 on failure with errno set.
+ ***************************************************************************/
+int
+rw_pwrite (RecWriter *rw, const char *data, size_t length, off_t offset)
+{
+  ssize_t written;
+  size_t count;
+
+  if ( (rw->flags & (RW_DIRECT | RW_APPEND)) || offset < 0 ||
+       offset + (off_t) length > rw->offset + (off_t) rw->buflen )
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  /* Part of the data already written to the file */
+  while ( length > 0 && offset < rw->offset )
+    {
+      count = ( offset + (off_t) length > rw->offset ) ?
+	(size_t) (rw->offset - offset) : length;
+
+      written = pwrite (rw->fd, data, count, offset);
+      rw->writecalls++;
+
+      if ( written < 0 )
+	{
+	  if ( errno == EINTR )
+	    continue;
+	  return -1;
+	}
+
+      data += written;
+      length -= written;
+      offset += written;
+    }
+
+  /* Part of the data still in the buffer */
+  if ( length > 0 )
+    memcpy (rw->buffer + (offset - rw->offset), data, length);
+
+  return 0;
+}  /* End of rw_pwrite() */
+
+
+/***************************************************************************
+ * rw_flush:
+ *
+ * Write all buffered data.  With direct I/O a final partial block is
+ * written after switching the file to normal writes, so this should
+ * only be called when no more data will be written.
+ *
+ * Returns 0 on success, and -1 on failure with errno set.
+ ***************************************************************************/
+int
+rw_flush (RecWriter *rw)
+{
+  size_t aligned;
+
+  if ( rw->flags & RW_DIRECT )
+    {
+      aligned = rw->buflen / RW_ALIGN * RW_ALIGN;
+
+      if ( aligned > 0 && writebuffer (rw, aligned) )
+	return -1;
+
+      if ( rw->buflen > 0 )
+	{
+#ifdef O_DIRECT
+	  if ( fcntl (rw->fd, F_SETFL, fcntl (rw->fd, F_GETFL) & ~O_DIRECT) )
+	    return -1;
+#endif
+	  rw->flags &= ~RW_DIRECT;
+	}
+    }
+
+  if ( rw->buflen > 0 )
+    return writebuffer (rw, rw->buflen);
+
+  return 0;
+}  /* End of rw_flush() */
+
+
+/***************************************************************************
+ * rw_close:
+ *
+ * Flush and close the writer and free it.
+ *
+ * Returns 0 on success, and -1 if any data could not be written.
+ ***************************************************************************/
+int
+rw_close (RecWriter *rw)
+{
+  int retval = 0;
+
+  if ( ! rw )
+    return 0;
+
+  if ( rw_flush (rw) )
+    retval = -1;
+
+  if ( close (rw->fd) )
+    retval = -1;
+
+  free (rw->buffer);
+  free (rw);
+
+  return retval;
+}  /* End of rw_close() */
+
+
+/***************************************************************************
+ * writebuffer:
+ *
+ * Write the first length bytes of the buffer and move any remaining
+ * bytes to the start.
+ *
+ * Returns 0 on success, and -1 on failure.
+ ***************************************************************************/
+static int
+writebuffer (RecWriter *rw, size_t length)
+{
+  struct iovec iov;
+
+  iov.iov_base = rw->buffer;
+  iov.iov_len = length;
+
+  if ( writeall (rw, &iov, 1) )
+    return -1;
+
+  rw->buflen -= length;
+  if ( rw->buflen > 0 )
+    memmove (rw->buffer, rw->buffer + length, rw->buflen);
+
+  return 0;
+}  /* End of writebuffer() */
+
+
+/***************************************************************************
+ * writeall:
+ *
+ * Write the complete data of the I/O vectors, continuing after partial
+ * writes, and release written data from the page cache if requested.
+ * Each write system call is counted.  The vectors are modified.
+ *
+ * Returns 0 on success, and -1 on failure.
+ ***************************************************************************/
+static int
+writeall (RecWriter *rw, struct iovec *iov, int iovcnt)
+{
+  off_t start = rw->offset;
+  ssize_t written;
+
+  while ( iovcnt > 0 )
+    {
+      if ( iov->iov_len == 0 )
+	{
+	  iov++;
+	  iovcnt--;
+	  continue;
+	}
+
+      written = ( iovcnt == 1 ) ? write (rw->fd, iov->iov_base, iov->iov_len) :
+	writev (rw->fd, iov, iovcnt);
+      rw->writecalls++;
+
+      if ( written < 0 )
+	{
+	  if ( errno == EINTR )
+	    continue;
+	  return -1;
+	}
+
+      rw->offset += written;
+
+      while ( iovcnt > 0 && (size_t) written >= iov->iov_len )
+	{
+	  written -= iov->iov_len;
+	  iov++;
+	  iovcnt--;
+	}
+
+      if ( iovcnt > 0 )
+	{
+	  iov->iov_base = (char *) iov->iov_base + written;
+	  iov->iov_len -= written;
+	}
+    }
+
+#ifdef POSIX_FADV_DONTNEED
+  /* Dirty pages are only released once written back, which the
+   * advice starts.  The data of the previous call is advised again,
+   * by now it should have been written back and is released. */
+  if ( rw->flags & RW_DONTNEED )
+    {
+      posix_fadvise (rw->fd, rw->released, rw->offset - rw->released,
+		     POSIX_FADV_DONTNEED);
+      rw->released = start;
+    }
+#endif
+
+  return 0;
+}  /* End of writeall() */
@@ -0,0 +1,51 @@
+#ifndef RECWRITER_H
+#define RECWRITER_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Default size of the output buffer */
+#define RW_BUFSIZE (8 * 1024 * 1024)
+
+/* Alignment of the output buffer and of direct I/O writes */
+#define RW_ALIGN 4096
+
+/* Maximum pipe buffer size requested for pipe output */
+#define RW_PIPESIZE (1024 * 1024)
+
+/* Writer flags */
+#define RW_DIRECT   0x01       /* Write with O_DIRECT, bypassing the page cache */
+#define RW_DONTNEED 0x02       /* Release written data from the page cache */
+#define RW_APPEND   0x04       /* Append to an existing file */
+#define RW_UPDATE   0x08       /* Write at the end of an existing file, allowing rw_pwrite() */
+
+/* A buffered output file written with write() and writev() */
+typedef struct RecWriter_s {
+  int fd;
+  int flags;
+  char *buffer;                /* Aligned output buffer */
+  size_t bufsize;
+  size_t buflen;               /* Bytes in the buffer */
+  off_t offset;                /* File offset of the buffer */
+  off_t origin;                /* File offset when opened */
+  off_t released;              /* Offset of data not yet released */
+  int64_t writecalls;          /* Number of write system calls */
+} RecWriter;
+
+RecWriter *rw_open (const char *path, size_t bufsize, int flags);
+RecWriter *rw_fdopen (int fd, size_t bufsize, int flags);
+int rw_write (RecWriter *rw, const char *data, size_t length);
+int rw_pwrite (RecWriter *rw, const char *data, size_t length, off_t offset);
+int rw_flush (RecWriter *rw);
+int rw_close (RecWriter *rw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RECWRITER_H */
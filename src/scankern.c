@@ -0,0 +1,1061 @@
+/***************************************************************************
+ * scankern.c
+ *
+ * Kernels for processing the arrays of interleaved, multi-channel data
+ * scans read from bin files.
+ *
+ * Vectorized versions are provided for x86 processors supporting SSE2
+ * and AVX2, the best version supported by the running processor is
+ * selected at run time.  The selection can be limited by setting the
+ * environment variable MT2MSEED_KERNEL to "scalar", "sse2" or "avx2".
+ * The SSE2 level uses SSSE3 byte shuffles where the processor
+ * supports them.
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "scankern.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCANKERN_X86 1
+#include <immintrin.h>
+#endif
+
+/* Kernel levels in order of preference */
+#define KERNEL_SCALAR 0
+#define KERNEL_SSE2   1
+#define KERNEL_AVX2   2
+
+/* Kernel level, determined once by kernelinit() */
+static pthread_once_t kernelonce = PTHREAD_ONCE_INIT;
+static int kernel = KERNEL_SCALAR;
+
+static void kernelinit (void);
+static int kernellevel (void);
+static int deinterleave_scalar (const int32_t *scans, int startscan, int nscans,
+				int nchannels, flag swapflag, int32_t **chans,
+				int32_t missingflag, uint8_t *gapmask);
+static int nextgap_scalar (const uint8_t *gapmask, int idx, int nscans,
+			   uint8_t chanbit);
+static void unpack24_scalar (const uint8_t *src, int32_t *dst, int idx,
+			     int count);
+static void swap32_scalar (int32_t *data, size_t idx, size_t count);
+#if SCANKERN_X86
+static void swap32_ssse3 (int32_t *data, size_t count);
+static void swap32_avx2 (int32_t *data, size_t count);
+static void unpack24_ssse3 (const uint8_t *src, int32_t *dst, int count);
+static void unpack24_avx2 (const uint8_t *src, int32_t *dst, int count);
+static int nextgap_sse2 (const uint8_t *gapmask, int idx, int nscans,
+			 uint8_t chanbit);
+static int nextgap_avx2 (const uint8_t *gapmask, int idx, int nscans,
+			 uint8_t chanbit);
+static int deinterleave_sse2 (const int32_t *scans, int nscans, flag swapflag,
+			      int32_t **chans, int32_t missingflag,
+			      uint8_t *gapmask);
+static int deinterleave_avx2 (const int32_t *scans, int nscans, flag swapflag,
+			      int32_t **chans, int32_t missingflag,
+			      uint8_t *gapmask);
+static int deinterleave8_sse2 (const int32_t *scans, int nscans, int nchannels,
+			       flag swapflag, int32_t **chans,
+			       int32_t missingflag, uint8_t *gapmask);
+static int deinterleave8_avx2 (const int32_t *scans, int nscans, int nchannels,
+			       flag swapflag, int32_t **chans,
+			       int32_t missingflag, uint8_t *gapmask);
+
+/* Swap the bytes of each 32-bit lane with SSE2, which has no byte
+ * shuffle: swap the 16-bit halves of each sample, then the bytes of
+ * each half */
+#define SWAP_SSE2(V) \
+  _mm_or_si128 (_mm_slli_epi16 (_mm_shufflehi_epi16 (_mm_shufflelo_epi16 (V, 0xb1), 0xb1), 8), \
+		_mm_srli_epi16 (_mm_shufflehi_epi16 (_mm_shufflelo_epi16 (V, 0xb1), 0xb1), 8))
+
+/* Spread the 4 bits of a mask to the low bit of each of 4 bytes,
+ * the byte order matches the (little-endian) x86 memory layout */
+static const uint32_t spread4[16] = {
+  0x00000000, 0x00000001, 0x00000100, 0x00000101,
+  0x00010000, 0x00010001, 0x00010100, 0x00010101,
+  0x01000000, 0x01000001, 0x01000100, 0x01000101,
+  0x01010000, 0x01010001, 0x01010100, 0x01010101
+};
+#endif
+
+
+/***************************************************************************
+ * scan_deinterleave:
+ *
+ * Split an array of nscans interleaved scans of nchannels channels,
+ * at most SCAN_MAXCHANNELS, into separate, contiguous arrays for each
+ * channel in a single pass.  The chans array must contain nchannels
+ * pointers to arrays of at least nscans samples.
+ *
+ * Scans of 5 channels, as written by NIMS loggers, are transposed
+ * with blends of whole vectors.  Scans of 6 to 8 channels are loaded
+ * as rows of 8 samples and transposed as 8 by 8 blocks, the samples
+ * beyond the channels of a scan are not used.  Other widths use the
+ * portable version.
+ *
+ * If swapflag is set the samples are byte swapped to host order in
+ * the same pass, so the scans can be read directly from a memory
+ * mapped file in the byte order it was written in.
+ *
+ * Missing samples, equal to missingflag or >= SCAN_MAXSAMPLE, are
+ * recorded in the same pass: if gapmask is not NULL bit N of
+ * gapmask[idx] is set when the sample of channel N in scan idx is
+ * missing and clear otherwise.
+ *
+ * Returns the number of missing samples in all channels.
+ ***************************************************************************/
+int
+scan_deinterleave (const int32_t *scans, int nscans, int nchannels,
+		   flag swapflag, int32_t **chans, int32_t missingflag,
+		   uint8_t *gapmask)
+{
+#if SCANKERN_X86
+  switch ( kernellevel () )
+    {
+    case KERNEL_AVX2:
+      if ( nchannels == SCAN_CHANNELS )
+	return deinterleave_avx2 (scans, nscans, swapflag, chans,
+				  missingflag, gapmask);
+      if ( nchannels > SCAN_CHANNELS && nchannels <= SCAN_MAXCHANNELS )
+	return deinterleave8_avx2 (scans, nscans, nchannels, swapflag, chans,
+				   missingflag, gapmask);
+      break;
+    case KERNEL_SSE2:
+      if ( nchannels == SCAN_CHANNELS )
+	return deinterleave_sse2 (scans, nscans, swapflag, chans,
+				  missingflag, gapmask);
+      if ( nchannels > SCAN_CHANNELS && nchannels <= SCAN_MAXCHANNELS )
+	return deinterleave8_sse2 (scans, nscans, nchannels, swapflag, chans,
+				   missingflag, gapmask);
+      break;
+    }
+#endif
+
+  return deinterleave_scalar (scans, 0, nscans, nchannels, swapflag, chans,
+			      missingflag, gapmask);
+}  /* End of scan_deinterleave() */
+
+
+/***************************************************************************
+ * scan_gapruns:
+ *
+ * Build the list of runs of scans without a missing sample in the
+ * specified channel, using the gap mask from scan_deinterleave().
+ * Each run can be packed directly as a slice of the channel array.
+ *
+ * The gap mask is searched for missing samples with vector compares
+ * and movemask, skipping 16 or 32 scans at a time where there are
+ * none.
+ *
+ * The runs are returned in *runs, which is (re)allocated as needed
+ * and holds *maxruns entries.  The caller must free *runs.
+ *
+ * Returns the number of runs on success, and -1 on failure.
+ ***************************************************************************/
+int
+scan_gapruns (const uint8_t *gapmask, int nscans, int channel,
+	      ScanRun **runs, int *maxruns)
+{
+  int (*nextgap) (const uint8_t *, int, int, uint8_t) = nextgap_scalar;
+  uint8_t chanbit = 1 << channel;
+  ScanRun *newruns;
+  int runstart = 0;
+  int nruns = 0;
+  int gap;
+
+#if SCANKERN_X86
+  switch ( kernellevel () )
+    {
+    case KERNEL_AVX2:
+      nextgap = nextgap_avx2;
+      break;
+    case KERNEL_SSE2:
+      nextgap = nextgap_sse2;
+      break;
+    }
+#endif
+
+  while ( runstart <= nscans )
+    {
+      gap = nextgap (gapmask, runstart, nscans, chanbit);
+
+      if ( gap > runstart )
+	{
+	  if ( nruns >= *maxruns )
+	    {
+	      if ( ! (newruns = (ScanRun *) realloc (*runs, sizeof(ScanRun) *
+						       ((*maxruns) ? *maxruns * 2 : 64))) )
+		return -1;
+
+	      *runs = newruns;
+	      *maxruns = (*maxruns) ? *maxruns * 2 : 64;
+	    }
+
+	  (*runs)[nruns].start = runstart;
+	  (*runs)[nruns].length = gap - runstart;
+	  nruns++;
+	}
+
+      runstart = gap + 1;
+    }
+
+  return nruns;
+}  /* End of scan_gapruns() */
+
+
+/***************************************************************************
+ * scan_unpack24:
+ *
+ * Convert count packed 24-bit, big-endian, two's complement samples
+ * at src, as written by NIMS loggers, to sign extended 32-bit samples
+ * at dst.  The source does not need to be aligned and is not read
+ * beyond its last sample.
+ *
+ * The vector versions place the 3 bytes of each sample in the upper
+ * bytes of a 32-bit lane with a byte shuffle and sign extend with an
+ * arithmetic shift.
+ ***************************************************************************/
+void
+scan_unpack24 (const uint8_t *src, int32_t *dst, int count)
+{
+#if SCANKERN_X86
+  switch ( kernellevel () )
+    {
+    case KERNEL_AVX2:
+      unpack24_avx2 (src, dst, count);
+      return;
+    case KERNEL_SSE2:
+      if ( __builtin_cpu_supports ("ssse3") )
+	{
+	  unpack24_ssse3 (src, dst, count);
+	  return;
+	}
+      break;
+    }
+#endif
+
+  unpack24_scalar (src, dst, 0, count);
+}  /* End of scan_unpack24() */
+
+
+/***************************************************************************
+ * scan_swap32:
+ *
+ * Swap the byte order of count 32-bit samples in place.  The data does
+ * not need to be aligned.
+ *
+ * The vector versions reverse the bytes of each 32-bit lane with a
+ * byte shuffle, 16 or 32 samples per iteration.
+ ***************************************************************************/
+void
+scan_swap32 (int32_t *data, size_t count)
+{
+#if SCANKERN_X86
+  switch ( kernellevel () )
+    {
+    case KERNEL_AVX2:
+      swap32_avx2 (data, count);
+      return;
+    case KERNEL_SSE2:
+      if ( __builtin_cpu_supports ("ssse3") )
+	{
+	  swap32_ssse3 (data, count);
+	  return;
+	}
+      break;
+    }
+#endif
+
+  swap32_scalar (data, 0, count);
+}  /* End of scan_swap32() */
+
+
+/***************************************************************************
+ * scan_kernelname:
+ *
+ * Returns the name of the kernel versions selected for this processor.
+ ***************************************************************************/
+const char *
+scan_kernelname (void)
+{
+  switch ( kernellevel () )
+    {
+    case KERNEL_AVX2:
+      return "avx2";
+    case KERNEL_SSE2:
+      return "sse2";
+    }
+
+  return "scalar";
+}  /* End of scan_kernelname() */
+
+
+/***************************************************************************
+ * kernelinit:
+ *
+ * Determine the best kernel level supported by the processor, limited
+ * by the MT2MSEED_KERNEL environment variable if set.  Run once by
+ * kernellevel().
+ ***************************************************************************/
+static void
+kernelinit (void)
+{
+  char *envvariable;
+
+#if SCANKERN_X86
+  __builtin_cpu_init ();
+
+  if ( __builtin_cpu_supports ("avx2") )
+    kernel = KERNEL_AVX2;
+  else if ( __builtin_cpu_supports ("sse2") )
+    kernel = KERNEL_SSE2;
+#endif
+
+  if ( (envvariable = getenv ("MT2MSEED_KERNEL")) )
+    {
+      if ( ! strcmp (envvariable, "scalar") )
+	kernel = KERNEL_SCALAR;
+      else if ( ! strcmp (envvariable, "sse2") && kernel > KERNEL_SSE2 )
+	kernel = KERNEL_SSE2;
+    }
+}  /* End of kernelinit() */
+
+
+/***************************************************************************
+ * kernellevel:
+ *
+ * Return the kernel level, determined on the first call, also when
+ * several threads make the first call at once.
+ ***************************************************************************/
+static int
+kernellevel (void)
+{
+  pthread_once (&kernelonce, kernelinit);
+
+  return kernel;
+}  /* End of kernellevel() */
+
+
+/***************************************************************************
+ * deinterleave_scalar:
+ *
+ * Portable version of scan_deinterleave() for scans startscan up to
+ * nscans, also used for the remainder of the vectorized versions.
+ ***************************************************************************/
+static int
+deinterleave_scalar (const int32_t *scans, int startscan, int nscans,
+		     int nchannels, flag swapflag, int32_t **chans,
+		     int32_t missingflag, uint8_t *gapmask)
+{
+  const int32_t *scan;
+  int32_t sample;
+  uint8_t mask;
+  int missing = 0;
+  int channel;
+  int idx;
+
+  for ( idx = startscan; idx < nscans; idx++ )
+    {
+      scan = scans + ((size_t) nchannels * idx);
+      mask = 0;
+
+      for ( channel = 0; channel < nchannels; channel++ )
+	{
+	  sample = scan[channel];
+	  if ( swapflag )
+	    ms_gswap4a (&sample);
+	  chans[channel][idx] = sample;
+
+	  if ( sample == missingflag || sample >= SCAN_MAXSAMPLE )
+	    {
+	      mask |= 1 << channel;
+	      missing++;
+	    }
+	}
+
+      if ( gapmask )
+	gapmask[idx] = mask;
+    }
+
+  return missing;
+}  /* End of deinterleave_scalar() */
+
+
+/***************************************************************************
+ * nextgap_scalar:
+ *
+ * Find the first scan at or after idx with a missing sample in the
+ * channel of chanbit.
+ *
+ * Returns the scan index, or nscans if there are no more gaps.
+ ***************************************************************************/
+static int
+nextgap_scalar (const uint8_t *gapmask, int idx, int nscans, uint8_t chanbit)
+{
+  for ( ; idx < nscans; idx++ )
+    {
+      if ( gapmask[idx] & chanbit )
+	break;
+    }
+
+  return idx;
+}  /* End of nextgap_scalar() */
+
+
+/***************************************************************************
+ * unpack24_scalar:
+ *
+ * Portable version of scan_unpack24() for samples idx up to count.
+ ***************************************************************************/
+static void
+unpack24_scalar (const uint8_t *src, int32_t *dst, int idx, int count)
+{
+  const uint8_t *sample;
+
+  for ( ; idx < count; idx++ )
+    {
+      sample = src + 3 * (size_t) idx;
+      dst[idx] = (int32_t) (((uint32_t) sample[0] << 24) |
+			    ((uint32_t) sample[1] << 16) |
+			    ((uint32_t) sample[2] << 8)) >> 8;
+    }
+}  /* End of unpack24_scalar() */
+
+
+/***************************************************************************
+ * swap32_scalar:
+ *
+ * Portable version of scan_swap32() for samples idx up to count, also
+ * used for the remainder of the vectorized versions.
+ ***************************************************************************/
+static void
+swap32_scalar (int32_t *data, size_t idx, size_t count)
+{
+  uint32_t value;
+
+  for ( ; idx < count; idx++ )
+    {
+      value = (uint32_t) data[idx];
+      data[idx] = (int32_t) ((value >> 24) | ((value >> 8) & 0xff00) |
+			     ((value << 8) & 0xff0000) | (value << 24));
+    }
+}  /* End of swap32_scalar() */
+
+
+#if SCANKERN_X86
+/***************************************************************************
+ * deinterleave_sse2:
+ *
+ * SSE2 version of scan_deinterleave(), transposing 4 scans at a time.
+ *
+ * The 20 samples of 4 scans are loaded into 5 vectors, the 4 samples
+ * of each channel are then in different vectors and different lanes,
+ * they are combined with lane masks and rotated into scan order.
+ * SSE2 has no byte shuffle, samples are swapped with word shuffles
+ * and shifts.
+ ***************************************************************************/
+__attribute__ ((target ("sse2")))
+static int
+deinterleave_sse2 (const int32_t *scans, int nscans, flag swapflag,
+		   int32_t **chans, int32_t missingflag, uint8_t *gapmask)
+{
+  const __m128i mflag = _mm_set1_epi32 (missingflag);
+  const __m128i mmax = _mm_set1_epi32 (SCAN_MAXSAMPLE);
+  const __m128i lane0 = _mm_setr_epi32 (-1, 0, 0, 0);
+  const __m128i lane1 = _mm_setr_epi32 (0, -1, 0, 0);
+  const __m128i lane2 = _mm_setr_epi32 (0, 0, -1, 0);
+  const __m128i lane3 = _mm_setr_epi32 (0, 0, 0, -1);
+  __m128i v0, v1, v2, v3, v4;
+  __m128i ch[SCAN_CHANNELS];
+  __m128i gap[SCAN_CHANNELS];
+  __m128i anygap;
+  const int32_t *scan;
+  uint32_t maskword;
+  int missing = 0;
+  int channel;
+  int bits;
+  int idx;
+
+#define LANES(A,B,C,D) \
+  _mm_or_si128 (_mm_or_si128 (_mm_and_si128 (A, lane0), _mm_and_si128 (B, lane1)), \
+		_mm_or_si128 (_mm_and_si128 (C, lane2), _mm_and_si128 (D, lane3)))
+
+  for ( idx = 0; idx + 4 <= nscans; idx += 4 )
+    {
+      scan = scans + ((size_t) SCAN_CHANNELS * idx);
+
+      v0 = _mm_loadu_si128 ((const __m128i *) (scan));
+      v1 = _mm_loadu_si128 ((const __m128i *) (scan + 4));
+      v2 = _mm_loadu_si128 ((const __m128i *) (scan + 8));
+      v3 = _mm_loadu_si128 ((const __m128i *) (scan + 12));
+      v4 = _mm_loadu_si128 ((const __m128i *) (scan + 16));
+
+      if ( swapflag )
+	{
+	  v0 = SWAP_SSE2 (v0);
+	  v1 = SWAP_SSE2 (v1);
+	  v2 = SWAP_SSE2 (v2);
+	  v3 = SWAP_SSE2 (v3);
+	  v4 = SWAP_SSE2 (v4);
+	}
+
+      ch[0] = LANES (v0, v1, v2, v3);
+      ch[1] = _mm_shuffle_epi32 (LANES (v4, v0, v1, v2), _MM_SHUFFLE (0, 3, 2, 1));
+      ch[2] = _mm_shuffle_epi32 (LANES (v3, v4, v0, v1), _MM_SHUFFLE (1, 0, 3, 2));
+      ch[3] = _mm_shuffle_epi32 (LANES (v2, v3, v4, v0), _MM_SHUFFLE (2, 1, 0, 3));
+      ch[4] = LANES (v1, v2, v3, v4);
+
+      anygap = _mm_setzero_si128 ();
+      for ( channel = 0; channel < SCAN_CHANNELS; channel++ )
+	{
+	  _mm_storeu_si128 ((__m128i *) (chans[channel] + idx), ch[channel]);
+
+	  gap[channel] = _mm_or_si128 (_mm_cmpeq_epi32 (ch[channel], mflag),
+				       _mm_cmpeq_epi32 (ch[channel], mmax));
+	  anygap = _mm_or_si128 (anygap, gap[channel]);
+	}
+
+      maskword = 0;
+      if ( _mm_movemask_epi8 (anygap) )
+	{
+	  for ( channel = 0; channel < SCAN_CHANNELS; channel++ )
+	    {
+	      bits = _mm_movemask_ps (_mm_castsi128_ps (gap[channel]));
+	      maskword |= spread4[bits] << channel;
+	      missing += __builtin_popcount (bits);
+	    }
+	}
+
+      if ( gapmask )
+	memcpy (gapmask + idx, &maskword, sizeof(maskword));
+    }
+
+#undef LANES
+
+  return missing + deinterleave_scalar (scans, idx, nscans, SCAN_CHANNELS,
+					swapflag, chans, missingflag, gapmask);
+}  /* End of deinterleave_sse2() */
+
+
+/***************************************************************************
+ * deinterleave_avx2:
+ *
+ * AVX2 version of scan_deinterleave(), transposing 8 scans at a time.
+ *
+ * The 40 samples of 8 scans are loaded into 5 vectors.  As 5 and 8
+ * are coprime the 8 samples of each channel are in distinct lanes,
+ * they are combined with 4 blends and permuted into scan order.
+ ***************************************************************************/
+__attribute__ ((target ("avx2")))
+static int
+deinterleave_avx2 (const int32_t *scans, int nscans, flag swapflag,
+		   int32_t **chans, int32_t missingflag, uint8_t *gapmask)
+{
+  const __m256i mflag = _mm256_set1_epi32 (missingflag);
+  const __m256i mmax = _mm256_set1_epi32 (SCAN_MAXSAMPLE);
+  const __m256i perm0 = _mm256_setr_epi32 (0, 5, 2, 7, 4, 1, 6, 3);
+  const __m256i perm1 = _mm256_setr_epi32 (1, 6, 3, 0, 5, 2, 7, 4);
+  const __m256i perm2 = _mm256_setr_epi32 (2, 7, 4, 1, 6, 3, 0, 5);
+  const __m256i perm3 = _mm256_setr_epi32 (3, 0, 5, 2, 7, 4, 1, 6);
+  const __m256i perm4 = _mm256_setr_epi32 (4, 1, 6, 3, 0, 5, 2, 7);
+  const __m256i bswap = _mm256_setr_epi8 (3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+					  3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  __m256i v0, v1, v2, v3, v4;
+  __m256i ch[SCAN_CHANNELS];
+  __m256i gap[SCAN_CHANNELS];
+  __m256i anygap;
+  const int32_t *scan;
+  uint64_t maskword;
+  int missing = 0;
+  int channel;
+  int bits;
+  int idx;
+
+#define BLENDS(M1,M2,M3,M4) \
+  _mm256_blend_epi32 (_mm256_blend_epi32 (_mm256_blend_epi32 ( \
+    _mm256_blend_epi32 (v0, v1, M1), v2, M2), v3, M3), v4, M4)
+
+  for ( idx = 0; idx + 8 <= nscans; idx += 8 )
+    {
+      scan = scans + ((size_t) SCAN_CHANNELS * idx);
+
+      v0 = _mm256_loadu_si256 ((const __m256i *) (scan));
+      v1 = _mm256_loadu_si256 ((const __m256i *) (scan + 8));
+      v2 = _mm256_loadu_si256 ((const __m256i *) (scan + 16));
+      v3 = _mm256_loadu_si256 ((const __m256i *) (scan + 24));
+      v4 = _mm256_loadu_si256 ((const __m256i *) (scan + 32));
+
+      if ( swapflag )
+	{
+	  v0 = _mm256_shuffle_epi8 (v0, bswap);
+	  v1 = _mm256_shuffle_epi8 (v1, bswap);
+	  v2 = _mm256_shuffle_epi8 (v2, bswap);
+	  v3 = _mm256_shuffle_epi8 (v3, bswap);
+	  v4 = _mm256_shuffle_epi8 (v4, bswap);
+	}
+
+      ch[0] = _mm256_permutevar8x32_epi32 (BLENDS (0x84, 0x10, 0x42, 0x08), perm0);
+      ch[1] = _mm256_permutevar8x32_epi32 (BLENDS (0x08, 0x21, 0x84, 0x10), perm1);
+      ch[2] = _mm256_permutevar8x32_epi32 (BLENDS (0x10, 0x42, 0x08, 0x21), perm2);
+      ch[3] = _mm256_permutevar8x32_epi32 (BLENDS (0x21, 0x84, 0x10, 0x42), perm3);
+      ch[4] = _mm256_permutevar8x32_epi32 (BLENDS (0x42, 0x08, 0x21, 0x84), perm4);
+
+      anygap = _mm256_setzero_si256 ();
+      for ( channel = 0; channel < SCAN_CHANNELS; channel++ )
+	{
+	  _mm256_storeu_si256 ((__m256i *) (chans[channel] + idx), ch[channel]);
+
+	  gap[channel] = _mm256_or_si256 (_mm256_cmpeq_epi32 (ch[channel], mflag),
+					  _mm256_cmpeq_epi32 (ch[channel], mmax));
+	  anygap = _mm256_or_si256 (anygap, gap[channel]);
+	}
+
+      maskword = 0;
+      if ( ! _mm256_testz_si256 (anygap, anygap) )
+	{
+	  for ( channel = 0; channel < SCAN_CHANNELS; channel++ )
+	    {
+	      bits = _mm256_movemask_ps (_mm256_castsi256_ps (gap[channel]));
+	      maskword |= ((uint64_t) spread4[bits & 0xf] |
+			   ((uint64_t) spread4[bits >> 4] << 32)) << channel;
+	      missing += __builtin_popcount (bits);
+	    }
+	}
+
+      if ( gapmask )
+	memcpy (gapmask + idx, &maskword, sizeof(maskword));
+    }
+
+#undef BLENDS
+
+  return missing + deinterleave_scalar (scans, idx, nscans, SCAN_CHANNELS,
+					swapflag, chans, missingflag, gapmask);
+}  /* End of deinterleave_avx2() */
+
+
+/***************************************************************************
+ * deinterleave8_sse2:
+ *
+ * SSE2 version of scan_deinterleave() for 6 to 8 channels, transposing
+ * 4 scans at a time.
+ *
+ * Each scan is loaded as two vectors of channels 0-3 and 4-7, which
+ * are transposed as two 4 by 4 blocks with unpacks.  With fewer than 8
+ * channels the last vector of a scan extends into the next one, so
+ * the scans at the end of the array are left to the scalar version.
+ ***************************************************************************/
+__attribute__ ((target ("sse2")))
+static int
+deinterleave8_sse2 (const int32_t *scans, int nscans, int nchannels,
+		    flag swapflag, int32_t **chans, int32_t missingflag,
+		    uint8_t *gapmask)
+{
+  const __m128i mflag = _mm_set1_epi32 (missingflag);
+  const __m128i mmax = _mm_set1_epi32 (SCAN_MAXSAMPLE);
+  const size_t nsamples = (size_t) nchannels * nscans;
+  __m128i row[8];
+  __m128i t0, t1, t2, t3;
+  __m128i ch[8];
+  __m128i gap[8];
+  __m128i anygap;
+  const int32_t *scan;
+  uint32_t maskword;
+  int missing = 0;
+  int channel;
+  int bits;
+  int half;
+  int idx;
+
+  for ( idx = 0; idx + 4 <= nscans &&
+	  (size_t) nchannels * (idx + 3) + 8 <= nsamples; idx += 4 )
+    {
+      scan = scans + ((size_t) nchannels * idx);
+
+      for ( half = 0; half < 2; half++ )
+	{
+	  row[0] = _mm_loadu_si128 ((const __m128i *) (scan + 4 * half));
+	  row[1] = _mm_loadu_si128 ((const __m128i *) (scan + nchannels + 4 * half));
+	  row[2] = _mm_loadu_si128 ((const __m128i *) (scan + 2 * nchannels + 4 * half));
+	  row[3] = _mm_loadu_si128 ((const __m128i *) (scan + 3 * nchannels + 4 * half));
+
+	  if ( swapflag )
+	    {
+	      row[0] = SWAP_SSE2 (row[0]);
+	      row[1] = SWAP_SSE2 (row[1]);
+	      row[2] = SWAP_SSE2 (row[2]);
+	      row[3] = SWAP_SSE2 (row[3]);
+	    }
+
+	  t0 = _mm_unpacklo_epi32 (row[0], row[1]);
+	  t1 = _mm_unpacklo_epi32 (row[2], row[3]);
+	  t2 = _mm_unpackhi_epi32 (row[0], row[1]);
+	  t3 = _mm_unpackhi_epi32 (row[2], row[3]);
+
+	  ch[4 * half] = _mm_unpacklo_epi64 (t0, t1);
+	  ch[4 * half + 1] = _mm_unpackhi_epi64 (t0, t1);
+	  ch[4 * half + 2] = _mm_unpacklo_epi64 (t2, t3);
+	  ch[4 * half + 3] = _mm_unpackhi_epi64 (t2, t3);
+	}
+
+      anygap = _mm_setzero_si128 ();
+      for ( channel = 0; channel < nchannels; channel++ )
+	{
+	  _mm_storeu_si128 ((__m128i *) (chans[channel] + idx), ch[channel]);
+
+	  gap[channel] = _mm_or_si128 (_mm_cmpeq_epi32 (ch[channel], mflag),
+				       _mm_cmpeq_epi32 (ch[channel], mmax));
+	  anygap = _mm_or_si128 (anygap, gap[channel]);
+	}
+
+      maskword = 0;
+      if ( _mm_movemask_epi8 (anygap) )
+	{
+	  for ( channel = 0; channel < nchannels; channel++ )
+	    {
+	      bits = _mm_movemask_ps (_mm_castsi128_ps (gap[channel]));
+	      maskword |= spread4[bits] << channel;
+	      missing += __builtin_popcount (bits);
+	    }
+	}
+
+      if ( gapmask )
+	memcpy (gapmask + idx, &maskword, sizeof(maskword));
+    }
+
+  return missing + deinterleave_scalar (scans, idx, nscans, nchannels,
+					swapflag, chans, missingflag, gapmask);
+}  /* End of deinterleave8_sse2() */
+
+
+/***************************************************************************
+ * deinterleave8_avx2:
+ *
+ * AVX2 version of scan_deinterleave() for 6 to 8 channels, transposing
+ * 8 scans at a time.
+ *
+ * Each scan is loaded as a row of 8 samples and the 8 rows are
+ * transposed with 32-bit and 64-bit unpacks within 128-bit lanes and
+ * a final exchange of lanes.  With fewer than 8 channels a row
+ * extends into the next scan, so the scans at the end of the array
+ * are left to the scalar version.
+ ***************************************************************************/
+__attribute__ ((target ("avx2")))
+static int
+deinterleave8_avx2 (const int32_t *scans, int nscans, int nchannels,
+		    flag swapflag, int32_t **chans, int32_t missingflag,
+		    uint8_t *gapmask)
+{
+  const __m256i mflag = _mm256_set1_epi32 (missingflag);
+  const __m256i mmax = _mm256_set1_epi32 (SCAN_MAXSAMPLE);
+  const __m256i bswap = _mm256_setr_epi8 (3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+					  3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  const size_t nsamples = (size_t) nchannels * nscans;
+  __m256i row[8];
+  __m256i t[8];
+  __m256i u[8];
+  __m256i ch[8];
+  __m256i gap[8];
+  __m256i anygap;
+  const int32_t *scan;
+  uint64_t maskword;
+  int missing = 0;
+  int channel;
+  int bits;
+  int idx;
+  int r;
+
+  for ( idx = 0; idx + 8 <= nscans &&
+	  (size_t) nchannels * (idx + 7) + 8 <= nsamples; idx += 8 )
+    {
+      scan = scans + ((size_t) nchannels * idx);
+
+      for ( r = 0; r < 8; r++ )
+	{
+	  row[r] = _mm256_loadu_si256 ((const __m256i *) (scan + nchannels * r));
+	  if ( swapflag )
+	    row[r] = _mm256_shuffle_epi8 (row[r], bswap);
+	}
+
+      /* Pairs of rows, then quads of rows within each 128-bit lane */
+      for ( r = 0; r < 8; r += 2 )
+	{
+	  t[r] = _mm256_unpacklo_epi32 (row[r], row[r + 1]);
+	  t[r + 1] = _mm256_unpackhi_epi32 (row[r], row[r + 1]);
+	}
+      for ( r = 0; r < 8; r += 4 )
+	{
+	  u[r] = _mm256_unpacklo_epi64 (t[r], t[r + 2]);
+	  u[r + 1] = _mm256_unpackhi_epi64 (t[r], t[r + 2]);
+	  u[r + 2] = _mm256_unpacklo_epi64 (t[r + 1], t[r + 3]);
+	  u[r + 3] = _mm256_unpackhi_epi64 (t[r + 1], t[r + 3]);
+	}
+
+      /* Lane 0 holds channels 0-3 and lane 1 channels 4-7 */
+      for ( r = 0; r < 4; r++ )
+	{
+	  ch[r] = _mm256_permute2x128_si256 (u[r], u[r + 4], 0x20);
+	  ch[r + 4] = _mm256_permute2x128_si256 (u[r], u[r + 4], 0x31);
+	}
+
+      anygap = _mm256_setzero_si256 ();
+      for ( channel = 0; channel < nchannels; channel++ )
+	{
+	  _mm256_storeu_si256 ((__m256i *) (chans[channel] + idx), ch[channel]);
+
+	  gap[channel] = _mm256_or_si256 (_mm256_cmpeq_epi32 (ch[channel], mflag),
+					  _mm256_cmpeq_epi32 (ch[channel], mmax));
+	  anygap = _mm256_or_si256 (anygap, gap[channel]);
+	}
+
+      maskword = 0;
+      if ( ! _mm256_testz_si256 (anygap, anygap) )
+	{
+	  for ( channel = 0; channel < nchannels; channel++ )
+	    {
+	      bits = _mm256_movemask_ps (_mm256_castsi256_ps (gap[channel]));
+	      maskword |= ((uint64_t) spread4[bits & 0xf] |
+			   ((uint64_t) spread4[bits >> 4] << 32)) << channel;
+	      missing += __builtin_popcount (bits);
+	    }
+	}
+
+      if ( gapmask )
+	memcpy (gapmask + idx, &maskword, sizeof(maskword));
+    }
+
+  return missing + deinterleave_scalar (scans, idx, nscans, nchannels,
+					swapflag, chans, missingflag, gapmask);
+}  /* End of deinterleave8_avx2() */
+
+
+/***************************************************************************
+ * nextgap_sse2:
+ *
+ * SSE2 version of nextgap_scalar(), testing 16 scans at a time.
+ ***************************************************************************/
+__attribute__ ((target ("sse2")))
+static int
+nextgap_sse2 (const uint8_t *gapmask, int idx, int nscans, uint8_t chanbit)
+{
+  const __m128i bit = _mm_set1_epi8 ((char) chanbit);
+  __m128i flags;
+  int bits;
+
+  for ( ; idx + 16 <= nscans; idx += 16 )
+    {
+      flags = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *) (gapmask + idx)), bit);
+      bits = _mm_movemask_epi8 (_mm_cmpeq_epi8 (flags, bit));
+
+      if ( bits )
+	return idx + __builtin_ctz (bits);
+    }
+
+  return nextgap_scalar (gapmask, idx, nscans, chanbit);
+}  /* End of nextgap_sse2() */
+
+
+/***************************************************************************
+ * nextgap_avx2:
+ *
+ * AVX2 version of nextgap_scalar(), testing 32 scans at a time.
+ ***************************************************************************/
+__attribute__ ((target ("avx2")))
+static int
+nextgap_avx2 (const uint8_t *gapmask, int idx, int nscans, uint8_t chanbit)
+{
+  const __m256i bit = _mm256_set1_epi8 ((char) chanbit);
+  __m256i flags;
+  uint32_t bits;
+
+  for ( ; idx + 32 <= nscans; idx += 32 )
+    {
+      flags = _mm256_and_si256 (_mm256_loadu_si256 ((const __m256i *) (gapmask + idx)), bit);
+      bits = (uint32_t) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (flags, bit));
+
+      if ( bits )
+	return idx + __builtin_ctz (bits);
+    }
+
+  return nextgap_scalar (gapmask, idx, nscans, chanbit);
+}  /* End of nextgap_avx2() */
+
+
+/***************************************************************************
+ * unpack24_ssse3:
+ *
+ * SSSE3 version of scan_unpack24(), converting 4 samples at a time
+ * from 16 byte loads of which 12 bytes are used.  The last 4 samples
+ * are loaded from 4 bytes before them with a shifted shuffle, so the
+ * loads do not extend beyond the source, a single sample before them
+ * that cannot be loaded this way is converted by the scalar version.
+ ***************************************************************************/
+__attribute__ ((target ("ssse3")))
+static void
+unpack24_ssse3 (const uint8_t *src, int32_t *dst, int count)
+{
+  const __m128i shuffle = _mm_setr_epi8 (-1, 2, 1, 0, -1, 5, 4, 3,
+					 -1, 8, 7, 6, -1, 11, 10, 9);
+  const __m128i shuffleend = _mm_setr_epi8 (-1, 6, 5, 4, -1, 9, 8, 7,
+					    -1, 12, 11, 10, -1, 15, 14, 13);
+  __m128i v;
+  int idx;
+
+  if ( count < 6 )
+    {
+      unpack24_scalar (src, dst, 0, count);
+      return;
+    }
+
+  for ( idx = 0; idx + 6 <= count; idx += 4 )
+    {
+      v = _mm_loadu_si128 ((const __m128i *) (src + 3 * (size_t) idx));
+      v = _mm_srai_epi32 (_mm_shuffle_epi8 (v, shuffle), 8);
+      _mm_storeu_si128 ((__m128i *) (dst + idx), v);
+    }
+
+  if ( idx < count )
+    {
+      unpack24_scalar (src, dst, idx, count - 4);
+      idx = count - 4;
+      v = _mm_loadu_si128 ((const __m128i *) (src + 3 * (size_t) idx - 4));
+      v = _mm_srai_epi32 (_mm_shuffle_epi8 (v, shuffleend), 8);
+      _mm_storeu_si128 ((__m128i *) (dst + idx), v);
+    }
+}  /* End of unpack24_ssse3() */
+
+
+/***************************************************************************
+ * unpack24_avx2:
+ *
+ * AVX2 version of scan_unpack24(), converting 8 samples at a time.
+ * The byte shuffle works within 128-bit lanes, so each lane is loaded
+ * with the 12 bytes of 4 samples.  The last 8 samples are loaded from
+ * 4 bytes before them as in unpack24_ssse3(), with at most a single
+ * sample before them converted by the scalar version.
+ ***************************************************************************/
+__attribute__ ((target ("avx2")))
+static void
+unpack24_avx2 (const uint8_t *src, int32_t *dst, int count)
+{
+  const __m256i shuffle = _mm256_setr_epi8 (-1, 2, 1, 0, -1, 5, 4, 3,
+					    -1, 8, 7, 6, -1, 11, 10, 9,
+					    -1, 2, 1, 0, -1, 5, 4, 3,
+					    -1, 8, 7, 6, -1, 11, 10, 9);
+  const __m256i shuffleend = _mm256_setr_epi8 (-1, 6, 5, 4, -1, 9, 8, 7,
+					       -1, 12, 11, 10, -1, 15, 14, 13,
+					       -1, 6, 5, 4, -1, 9, 8, 7,
+					       -1, 12, 11, 10, -1, 15, 14, 13);
+  const uint8_t *sample;
+  __m256i v;
+  int idx;
+
+  if ( count < 10 )
+    {
+      unpack24_ssse3 (src, dst, count);
+      return;
+    }
+
+  for ( idx = 0; idx + 10 <= count; idx += 8 )
+    {
+      sample = src + 3 * (size_t) idx;
+      v = _mm256_inserti128_si256 (_mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *) sample)),
+				   _mm_loadu_si128 ((const __m128i *) (sample + 12)), 1);
+      v = _mm256_srai_epi32 (_mm256_shuffle_epi8 (v, shuffle), 8);
+      _mm256_storeu_si256 ((__m256i *) (dst + idx), v);
+    }
+
+  if ( idx < count )
+    {
+      unpack24_scalar (src, dst, idx, count - 8);
+      idx = count - 8;
+      sample = src + 3 * (size_t) idx - 4;
+      v = _mm256_inserti128_si256 (_mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *) sample)),
+				   _mm_loadu_si128 ((const __m128i *) (sample + 12)), 1);
+      v = _mm256_srai_epi32 (_mm256_shuffle_epi8 (v, shuffleend), 8);
+      _mm256_storeu_si256 ((__m256i *) (dst + idx), v);
+    }
+}  /* End of unpack24_avx2() */
+
+
+/***************************************************************************
+ * swap32_ssse3:
+ *
+ * SSSE3 version of scan_swap32(), swapping 16 samples per iteration
+ * with four independent shuffles.
+ ***************************************************************************/
+__attribute__ ((target ("ssse3")))
+static void
+swap32_ssse3 (int32_t *data, size_t count)
+{
+  const __m128i shuffle = _mm_setr_epi8 (3, 2, 1, 0, 7, 6, 5, 4,
+					 11, 10, 9, 8, 15, 14, 13, 12);
+  __m128i *vdata;
+  __m128i v0, v1, v2, v3;
+  size_t idx;
+
+  for ( idx = 0; idx + 16 <= count; idx += 16 )
+    {
+      vdata = (__m128i *) (data + idx);
+      v0 = _mm_loadu_si128 (vdata);
+      v1 = _mm_loadu_si128 (vdata + 1);
+      v2 = _mm_loadu_si128 (vdata + 2);
+      v3 = _mm_loadu_si128 (vdata + 3);
+      _mm_storeu_si128 (vdata, _mm_shuffle_epi8 (v0, shuffle));
+      _mm_storeu_si128 (vdata + 1, _mm_shuffle_epi8 (v1, shuffle));
+      _mm_storeu_si128 (vdata + 2, _mm_shuffle_epi8 (v2, shuffle));
+      _mm_storeu_si128 (vdata + 3, _mm_shuffle_epi8 (v3, shuffle));
+    }
+
+  for ( ; idx + 4 <= count; idx += 4 )
+    {
+      vdata = (__m128i *) (data + idx);
+      _mm_storeu_si128 (vdata, _mm_shuffle_epi8 (_mm_loadu_si128 (vdata), shuffle));
+    }
+
+  swap32_scalar (data, idx, count);
+}  /* End of swap32_ssse3() */
+
+
+/***************************************************************************
+ * swap32_avx2:
+ *
+ * AVX2 version of scan_swap32(), swapping 32 samples per iteration
+ * with four independent shuffles.
+ ***************************************************************************/
+__attribute__ ((target ("avx2")))
+static void
+swap32_avx2 (int32_t *data, size_t count)
+{
+  const __m256i shuffle = _mm256_setr_epi8 (3, 2, 1, 0, 7, 6, 5, 4,
+					    11, 10, 9, 8, 15, 14, 13, 12,
+					    3, 2, 1, 0, 7, 6, 5, 4,
+					    11, 10, 9, 8, 15, 14, 13, 12);
+  __m256i *vdata;
+  __m256i v0, v1, v2, v3;
+  size_t idx;
+
+  for ( idx = 0; idx + 32 <= count; idx += 32 )
+    {
+      vdata = (__m256i *) (data + idx);
+      v0 = _mm256_loadu_si256 (vdata);
+      v1 = _mm256_loadu_si256 (vdata + 1);
+      v2 = _mm256_loadu_si256 (vdata + 2);
+      v3 = _mm256_loadu_si256 (vdata + 3);
+      _mm256_storeu_si256 (vdata, _mm256_shuffle_epi8 (v0, shuffle));
+      _mm256_storeu_si256 (vdata + 1, _mm256_shuffle_epi8 (v1, shuffle));
+      _mm256_storeu_si256 (vdata + 2, _mm256_shuffle_epi8 (v2, shuffle));
+      _mm256_storeu_si256 (vdata + 3, _mm256_shuffle_epi8 (v3, shuffle));
+    }
+
+  for ( ; idx + 8 <= count; idx += 8 )
+    {
+      vdata = (__m256i *) (data + idx);
+      _mm256_storeu_si256 (vdata, _mm256_shuffle_epi8 (_mm256_loadu_si256 (vdata), shuffle));
+    }
+
+  swap32_scalar (data, idx, count);
+}  /* End of swap32_avx2() */
+#endif /* SCANKERN_X86 */
@@ -0,0 +1,39 @@
+#ifndef SCANKERN_H
+#define SCANKERN_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libmseed.h>
+
+/* Number of channels in each data scan of a NIMS logger */
+#define SCAN_CHANNELS 5
+
+/* Maximum number of channels in a data scan, one bit each in the gap
+ * mask of a scan */
+#define SCAN_MAXCHANNELS 8
+
+/* Value at or above which samples are considered missing */
+#define SCAN_MAXSAMPLE 2147483647
+
+/* A run of consecutive scans without missing samples */
+typedef struct ScanRun_s {
+  int start;                   /* Index of first scan */
+  int length;                  /* Number of scans */
+} ScanRun;
+
+int scan_deinterleave (const int32_t *scans, int nscans, int nchannels,
+		       flag swapflag, int32_t **chans, int32_t missingflag,
+		       uint8_t *gapmask);
+int scan_gapruns (const uint8_t *gapmask, int nscans, int channel,
+		  ScanRun **runs, int *maxruns);
+void scan_unpack24 (const uint8_t *src, int32_t *dst, int count);
+void scan_swap32 (int32_t *data, size_t count);
+const char *scan_kernelname (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCANKERN_H */
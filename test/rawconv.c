@@ -0,0 +1,224 @@
+/***************************************************************************
+ * rawconv.c
+ *
+ * Generate a raw NIMS DATA.BIN stream in memory, convert it with
+ * nims_readbuffer() and print the gap table of the header and the
+ * segments of each channel.
+ *
+ * The stream has one block per second starting 2008-07-10 00:00:00,
+ * with $GPRMC sentences sent back to back in the GPS characters of the
+ * blocks, each giving the time of the block holding its '$'.  Every
+ * sample holds the number of its scan in the complete stream and its
+ * channel, so the samples of a segment tell whether it is dated
+ * correctly.  Blocks can be removed from the stream without
+ * breaking the framing, as when a logger loses whole blocks.
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmseed.h>
+
+#include "nimsconv.h"
+#include "readNIMSraw.h"
+#include "scankern.h"
+
+#define PACKAGE "rawconv"
+
+/* Text header preceding the data blocks */
+#define STREAMHEADER "NIMS test stream\r\n"
+
+static int parameter_proc (int argcount, char **argvec);
+static void usage (void);
+
+static int nblocks    = 600;
+static int dropfirst  = 0;
+static int dropcount  = 0;
+
+
+int
+main (int argc, char **argv)
+{
+  MSTraceList *mstl = 0;
+  MSTraceID *id;
+  MSTraceSeg *seg;
+  NIMSheader hdr;
+  hptime_t starttime;
+  char sentence[NIMS_BLOCKLEN];
+  char stime[30];
+  char etime[30];
+  unsigned char *buf;
+  unsigned char *block;
+  size_t buflen;
+  int32_t value;
+  int64_t scan;
+  int64_t second;
+  int64_t count;
+  int misdated;
+  int checksum;
+  int sentpos = 0;
+  int sentlen = 0;
+  int idx;
+  int gapidx;
+  int sample;
+
+  if ( parameter_proc (argc, argv) < 0 )
+    return 1;
+
+  buflen = sizeof(STREAMHEADER) - 1 + (size_t) nblocks * NIMS_BLOCKLEN;
+  if ( ! (buf = (unsigned char *) calloc (1, buflen)) )
+    {
+      fprintf (stderr, "Error allocating memory\n");
+      return 1;
+    }
+
+  memcpy (buf, STREAMHEADER, sizeof(STREAMHEADER) - 1);
+  block = buf + sizeof(STREAMHEADER) - 1;
+
+  for ( idx = 0; idx < nblocks; idx++ )
+    {
+      /* Start the next sentence with the time of this block */
+      if ( sentpos == sentlen )
+	{
+	  second = 1215648000 + idx;
+	  sentlen = snprintf (sentence, sizeof(sentence),
+			      "$GPRMC,%02d%02d%02d,A,4433.600,N,12316.800,W,000.0,000.0,100708,,",
+			      (int) (second / 3600 % 24), (int) (second / 60 % 60),
+			      (int) (second % 60));
+	  for ( checksum = 0, sentpos = 1; sentpos < sentlen; sentpos++ )
+	    checksum ^= (unsigned char) sentence[sentpos];
+	  sentlen += snprintf (sentence + sentlen, sizeof(sentence) - sentlen,
+			       "*%02X\r\n", checksum);
+	  sentpos = 0;
+	}
+
+      if ( idx >= dropfirst && idx < dropfirst + dropcount )
+	{
+	  sentpos++;
+	  continue;
+	}
+
+      block[0] = 0x01;
+      block[1] = 0x83;
+      block[3] = (unsigned char) sentence[sentpos++];
+
+      for ( sample = 0; sample < NIMS_BLOCKSCANS * SCAN_CHANNELS; sample++ )
+	{
+	  value = (idx * NIMS_BLOCKSCANS + sample / SCAN_CHANNELS) * 10 +
+	    sample % SCAN_CHANNELS;
+	  block[NIMS_BLOCKHDR + 3 * sample] = (unsigned char) (value >> 16);
+	  block[NIMS_BLOCKHDR + 3 * sample + 1] = (unsigned char) (value >> 8);
+	  block[NIMS_BLOCKHDR + 3 * sample + 2] = (unsigned char) value;
+	}
+
+      block += NIMS_BLOCKLEN;
+    }
+
+  buflen = block - buf;
+
+  if ( nims_readbuffer ((char *) buf, buflen, "XX", "TEST", NULL, &mstl, &hdr) < 0 )
+    {
+      fprintf (stderr, "Error converting raw stream\n");
+      return 1;
+    }
+
+  printf ("%d scans, %d gaps\n", hdr.nscans, hdr.ngaps);
+  for ( gapidx = 0; gapidx < hdr.ngaps; gapidx++ )
+    printf ("Gap of %d scans at scan %d\n",
+	    hdr.gaps[gapidx].length, hdr.gaps[gapidx].start);
+
+  /* Each sample must be of the scan at its time */
+  starttime = ms_time2hptime (2008, 192, 0, 0, 0, 0);
+
+  for ( id = mstl->traces; id != 0; id = id->next )
+    for ( seg = id->first; seg != 0; seg = seg->next )
+      {
+	scan = (seg->starttime - starttime) * NIMS_BLOCKSCANS / HPTMODULUS;
+
+	for ( misdated = 0, count = 0; count < seg->numsamples; count++ )
+	  if ( ((int32_t *) seg->datasamples)[count] / 10 != scan + count )
+	    misdated++;
+
+	printf ("%s %s %s %lld samples from scan %lld, %d misdated\n", id->srcname,
+		ms_hptime2isotimestr (seg->starttime, stime, 1),
+		ms_hptime2isotimestr (seg->endtime, etime, 1),
+		(long long) seg->samplecnt, (long long) scan, misdated);
+      }
+
+  mstl_free (&mstl, 1);
+  free (buf);
+
+  return 0;
+}  /* End of main() */
+
+
+/***************************************************************************
+ * parameter_proc:
+ *
+ * Process the command line parameters.
+ *
+ * Returns 0 on success, and -1 on failure
+ ***************************************************************************/
+static int
+parameter_proc (int argcount, char **argvec)
+{
+  int optind;
+
+  for ( optind = 1; optind < argcount; optind++ )
+    {
+      if ( strcmp (argvec[optind], "-h") == 0 )
+	{
+	  usage ();
+	  exit (0);
+	}
+      else if ( optind + 1 >= argcount )
+	{
+	  fprintf (stderr, "Option %s requires a value\n", argvec[optind]);
+	  return -1;
+	}
+      else if ( strcmp (argvec[optind], "-n") == 0 )
+	{
+	  nblocks = strtol (argvec[++optind], NULL, 10);
+	}
+      else if ( strcmp (argvec[optind], "-d") == 0 )
+	{
+	  dropfirst = strtol (argvec[++optind], NULL, 10);
+	}
+      else if ( strcmp (argvec[optind], "-D") == 0 )
+	{
+	  dropcount = strtol (argvec[++optind], NULL, 10);
+	}
+      else
+	{
+	  fprintf (stderr, "Unknown option: %s\n", argvec[optind]);
+	  return -1;
+	}
+    }
+
+  if ( nblocks <= 0 || dropfirst < 0 || dropcount < 0 )
+    {
+      fprintf (stderr, "Invalid number of blocks\n");
+      return -1;
+    }
+
+  return 0;
+}  /* End of parameter_proc() */
+
+
+/***************************************************************************
+ * usage:
+ *
+ * Print the usage message.
+ ***************************************************************************/
+static void
+usage (void)
+{
+  fprintf (stderr, "Convert a generated raw NIMS stream and print its segments.\n\n");
+  fprintf (stderr, "Usage: %s [options]\n\n", PACKAGE);
+  fprintf (stderr,
+	   " -n blocks      Number of blocks of the stream, default: 600\n"
+	   " -d block       First block removed from the stream, default: 0\n"
+	   " -D count       Number of blocks removed, default: 0\n"
+	   "\n");
+}  /* End of usage() */